@@ -0,0 +1,188 @@
+// autoscale.h
+// Closed-loop actuator for the ScaleMate decisions.
+// - The port is configured with max_q RSS queues up front; only the first
+//   'active' of them receive traffic, the RETA spreads over those
+// - Scale-up: launch a worker for the next queue on a spare lcore
+//   (rte_eal_remote_launch), then widen the RETA to include its queue.
+//   Spare lcores on the port's socket are used first
+// - Scale-down: narrow the RETA first, let the worker drain its queue,
+//   then stop it and rte_eal_wait_lcore() so the lcore is free again
+// - No port restart in either direction
+// - Hysteresis: a change needs AS_UP_TICKS / AS_DOWN_TICKS consecutive
+//   evaluations in the same direction, and none happens within the
+//   cooldown after the previous one, so a scale-up never flaps
+//
+// The app provides the worker: it polls w->queue of w->port while w->run is
+// set, and returns once run is clear and the queue came back empty.
+
+#ifndef AUTOSCALE_H
+#define AUTOSCALE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <rte_cycles.h>
+#include <rte_ethdev.h>
+#include <rte_launch.h>
+#include <rte_lcore.h>
+
+#include "numa_util.h"
+
+#define AS_MAX_QUEUES   16
+#define AS_MAX_RETA     512     // largest RETA in common PMDs
+#define AS_UP_TICKS     3       // consecutive SCALE-UP evaluations before acting
+#define AS_DOWN_TICKS   10      // consecutive idle evaluations before shrinking
+#define AS_COOLDOWN_MS  5000    // minimum time between two changes
+
+struct as_worker {
+    uint16_t port;
+    uint16_t queue;
+    unsigned lcore;             // RTE_MAX_LCORE when not running
+    volatile uint8_t run;
+};
+
+struct autoscale {
+    uint16_t port;
+    uint16_t min_q, max_q;
+    uint16_t active;            // queues in the RETA, one worker each
+    uint16_t reta_size;
+    lcore_function_t *worker_fn;
+    struct as_worker w[AS_MAX_QUEUES];
+    unsigned up_streak, down_streak;
+    uint64_t last_change;       // TSC of the last grow/shrink
+    uint64_t cooldown;          // TSC cycles
+    unsigned nb_up, nb_down;    // actions taken, for the dashboard
+};
+
+// Spread the RETA over queues 0..n-1.
+static inline int autoscale_reta_spread(struct autoscale *as, uint16_t n)
+{
+    struct rte_eth_rss_reta_entry64 reta[AS_MAX_RETA / RTE_ETH_RETA_GROUP_SIZE];
+    memset(reta, 0, sizeof(reta));
+    for (uint16_t i = 0; i < as->reta_size; i++) {
+        struct rte_eth_rss_reta_entry64 *e = &reta[i / RTE_ETH_RETA_GROUP_SIZE];
+        e->mask |= 1ULL << (i % RTE_ETH_RETA_GROUP_SIZE);
+        e->reta[i % RTE_ETH_RETA_GROUP_SIZE] = i % n;
+    }
+    return rte_eth_dev_rss_reta_update(as->port, reta, as->reta_size);
+}
+
+static inline int autoscale_launch(struct autoscale *as, uint16_t q)
+{
+    unsigned l = numa_pick_lcore(numa_port_socket(as->port), NULL);
+    if (l == RTE_MAX_LCORE) return -1;
+    numa_check_lcore(l, as->port);
+    struct as_worker *w = &as->w[q];
+    w->run = 1;
+    if (rte_eal_remote_launch(as->worker_fn, w, l) != 0) { w->run = 0; return -1; }
+    w->lcore = l;
+    return 0;
+}
+
+static inline void autoscale_stop(struct autoscale *as, uint16_t q)
+{
+    struct as_worker *w = &as->w[q];
+    if (w->lcore == RTE_MAX_LCORE) return;
+    w->run = 0;
+    rte_eal_wait_lcore(w->lcore);
+    w->lcore = RTE_MAX_LCORE;
+}
+
+// Call after the port is started with max_q RX queues. Launches min_q workers.
+static inline int autoscale_init(struct autoscale *as, uint16_t port, uint16_t min_q,
+                                 uint16_t max_q, lcore_function_t *worker_fn)
+{
+    struct rte_eth_dev_info dev_info;
+
+    memset(as, 0, sizeof(*as));
+    if (max_q > AS_MAX_QUEUES) max_q = AS_MAX_QUEUES;
+    if (min_q < 1) min_q = 1;
+    if (min_q > max_q) min_q = max_q;
+    as->port = port;
+    as->min_q = min_q;
+    as->max_q = max_q;
+    as->worker_fn = worker_fn;
+    as->cooldown = rte_get_tsc_hz() / 1000 * AS_COOLDOWN_MS;
+    for (uint16_t q = 0; q < AS_MAX_QUEUES; q++) {
+        as->w[q].port = port;
+        as->w[q].queue = q;
+        as->w[q].lcore = RTE_MAX_LCORE;
+    }
+
+    if (rte_eth_dev_info_get(port, &dev_info) != 0) return -1;
+    as->reta_size = dev_info.reta_size;
+    if (max_q > 1 && (as->reta_size == 0 || as->reta_size > AS_MAX_RETA)) {
+        fprintf(stderr, "autoscale: port %u RETA size %u not supported\n", port, as->reta_size);
+        return -1;
+    }
+
+    for (uint16_t q = 0; q < min_q; q++) {
+        if (autoscale_launch(as, q) != 0) {
+            fprintf(stderr, "autoscale: no spare lcore for port %u queue %u\n", port, q);
+            break;
+        }
+        as->active++;
+    }
+    if (as->active == 0) return -1;
+    if (max_q > 1 && autoscale_reta_spread(as, as->active) != 0) {
+        fprintf(stderr, "autoscale: RETA update failed on port %u\n", port);
+        return -1;
+    }
+    as->last_change = rte_rdtsc();
+    return 0;
+}
+
+static inline int autoscale_grow(struct autoscale *as)
+{
+    uint16_t q = as->active;
+    if (q >= as->max_q) return -1;
+    if (autoscale_launch(as, q) != 0) return -1;   // worker first: queue is polled before it gets traffic
+    if (autoscale_reta_spread(as, q + 1) != 0) {
+        autoscale_stop(as, q);
+        return -1;
+    }
+    as->active++;
+    as->nb_up++;
+    return 0;
+}
+
+static inline int autoscale_shrink(struct autoscale *as)
+{
+    uint16_t q = as->active - 1;
+    if (as->active <= as->min_q) return -1;
+    if (autoscale_reta_spread(as, q) != 0) return -1; // steer traffic away first
+    autoscale_stop(as, q);                           // worker drains what is left
+    as->active--;
+    as->nb_down++;
+    return 0;
+}
+
+// One evaluation: want > 0 scale up, want < 0 scale down, 0 hold.
+// Returns +1/-1 when the queue set changed, 0 otherwise.
+static inline int autoscale_step(struct autoscale *as, int want)
+{
+    if (want > 0)      { as->up_streak++; as->down_streak = 0; }
+    else if (want < 0) { as->down_streak++; as->up_streak = 0; }
+    else               { as->up_streak = as->down_streak = 0; }
+
+    if (rte_rdtsc() - as->last_change < as->cooldown) return 0;
+
+    int ret = 0;
+    if (as->up_streak >= AS_UP_TICKS && autoscale_grow(as) == 0) ret = 1;
+    else if (as->down_streak >= AS_DOWN_TICKS && autoscale_shrink(as) == 0) ret = -1;
+    if (ret) {
+        as->last_change = rte_rdtsc();
+        as->up_streak = as->down_streak = 0;
+    }
+    return ret;
+}
+
+// Stop every worker, e.g. on exit.
+static inline void autoscale_fini(struct autoscale *as)
+{
+    for (uint16_t q = 0; q < as->max_q; q++) autoscale_stop(as, q);
+    as->active = 0;
+}
+
+#endif // AUTOSCALE_H
@@ -0,0 +1,118 @@
+// buf_util.h
+// Buffer-pressure telemetry for the ScaleMate tools.
+// - Mempool fill: rte_mempool_in_use_count / pool size
+// - RX descriptor fill: rte_eth_rx_queue_count, or a binary search over
+//   rte_eth_rx_descriptor_status when the PMD does not implement it
+// - TX descriptor fill: binary search over rte_eth_tx_descriptor_status
+// All values are fractions 0..1, or -1 when the PMD cannot report them.
+// The queue probes only read descriptors; they can run from a monitor
+// (also a secondary process) while another lcore polls the queue.
+
+#ifndef BUF_UTIL_H
+#define BUF_UTIL_H
+
+#include <stdint.h>
+#include <errno.h>
+
+#include <rte_ethdev.h>
+#include <rte_mempool.h>
+
+#define BUF_UTIL_DEFAULT_DESC 1024   // when rx/tx_queue_info_get is unsupported
+
+struct buf_util {
+    double pool;        // fill of the mempool feeding RX queue 0
+    double rxq;         // worst RX queue descriptor fill
+    double txq;         // worst TX queue descriptor fill
+    uint16_t rxq_worst; // RX queue with the highest fill
+};
+
+static inline double buf_util_mempool(const struct rte_mempool *mp)
+{
+    if (!mp || mp->size == 0) return -1.0;
+    return (double)rte_mempool_in_use_count(mp) / (double)mp->size;
+}
+
+// Filled RX descriptors are contiguous from the next one to be read, so the
+// first offset that is not DONE is the count: O(log n) status reads.
+static inline int buf_util_rxq_count_sampled(uint16_t port, uint16_t q, uint16_t nb_desc)
+{
+    int st = rte_eth_rx_descriptor_status(port, q, 0);
+    if (st < 0) return st;
+    if (st != RTE_ETH_RX_DESC_DONE) return 0;
+
+    uint16_t lo = 0, hi = nb_desc; // status(lo) is DONE, count is in (lo, hi]
+    while (hi - lo > 1) {
+        uint16_t mid = lo + (hi - lo) / 2;
+        if (rte_eth_rx_descriptor_status(port, q, mid) == RTE_ETH_RX_DESC_DONE) lo = mid;
+        else hi = mid;
+    }
+    return hi;
+}
+
+static inline double buf_util_rxq(uint16_t port, uint16_t q)
+{
+    struct rte_eth_rxq_info qinfo;
+    uint16_t nb_desc = BUF_UTIL_DEFAULT_DESC;
+    if (rte_eth_rx_queue_info_get(port, q, &qinfo) == 0 && qinfo.nb_desc) nb_desc = qinfo.nb_desc;
+
+    int used = rte_eth_rx_queue_count(port, q);
+    if (used == -ENOTSUP) used = buf_util_rxq_count_sampled(port, q, nb_desc);
+    if (used < 0) return -1.0;
+    return (double)used / (double)nb_desc;
+}
+
+// Offset 0 is the next TX slot; the oldest descriptors follow it and the most
+// recently queued ones sit at the end. In-flight = nb_desc - first FULL offset.
+static inline double buf_util_txq(uint16_t port, uint16_t q)
+{
+    struct rte_eth_txq_info qinfo;
+    uint16_t nb_desc = BUF_UTIL_DEFAULT_DESC;
+    if (rte_eth_tx_queue_info_get(port, q, &qinfo) == 0 && qinfo.nb_desc) nb_desc = qinfo.nb_desc;
+
+    int st = rte_eth_tx_descriptor_status(port, q, nb_desc - 1);
+    if (st < 0) return -1.0;
+    if (st != RTE_ETH_TX_DESC_FULL) return 0.0;
+
+    uint16_t lo = 0, hi = nb_desc - 1; // status(hi) is FULL
+    while (lo < hi) {
+        uint16_t mid = lo + (hi - lo) / 2;
+        if (rte_eth_tx_descriptor_status(port, q, mid) == RTE_ETH_TX_DESC_FULL) hi = mid;
+        else lo = mid + 1;
+    }
+    return (double)(nb_desc - hi) / (double)nb_desc;
+}
+
+// Sample every RX/TX queue of a port plus the mempool behind RX queue 0.
+static inline void buf_util_port(uint16_t port, struct buf_util *bu)
+{
+    struct rte_eth_dev_info dev_info;
+    struct rte_eth_rxq_info rxq_info;
+
+    bu->pool = bu->rxq = bu->txq = -1.0;
+    bu->rxq_worst = 0;
+    if (rte_eth_dev_info_get(port, &dev_info) != 0) return;
+
+    if (rte_eth_rx_queue_info_get(port, 0, &rxq_info) == 0)
+        bu->pool = buf_util_mempool(rxq_info.mp);
+
+    for (uint16_t q = 0; q < dev_info.nb_rx_queues; q++) {
+        double f = buf_util_rxq(port, q);
+        if (f > bu->rxq) { bu->rxq = f; bu->rxq_worst = q; }
+    }
+    for (uint16_t q = 0; q < dev_info.nb_tx_queues; q++) {
+        double f = buf_util_txq(port, q);
+        if (f > bu->txq) bu->txq = f;
+    }
+}
+
+// Single pressure figure: the fullest of pool, RX ring and TX ring.
+static inline double buf_util_max(const struct buf_util *bu)
+{
+    double m = 0.0;
+    if (bu->pool > m) m = bu->pool;
+    if (bu->rxq > m)  m = bu->rxq;
+    if (bu->txq > m)  m = bu->txq;
+    return m;
+}
+
+#endif // BUF_UTIL_H
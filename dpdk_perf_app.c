@@ -5,12 +5,15 @@
 #include <inttypes.h>
 #include <stdbool.h>
 #include <signal.h>
+#include <string.h>
+#include <getopt.h>
 #include <unistd.h>
 
 #include <rte_common.h>
 #include <rte_eal.h>
 #include <rte_ethdev.h>
 #include <rte_mbuf.h>
+#include <rte_mbuf_dyn.h>
 #include <rte_lcore.h>
 #include <rte_cycles.h>
 #include <rte_prefetch.h>
@@ -18,23 +21,161 @@
 #include <rte_malloc.h>
 
 #define MAX_QUEUES      8
+#define MAX_RX_QUEUE_PER_LCORE 16
+#define MAX_QUEUE_WEIGHT 16
 #define RX_RING_SIZE    1024
 #define TX_RING_SIZE    1024
-#define NUM_MBUFS       8192
 #define MBUF_CACHE_SZ   256
 #define BURST_SIZE      32
 #define STATS_INTERVAL_SEC 2
+#define MAX_TX_FLUSH    256     /* largest --tx-flush */
+#define TX_DRAIN_US     100     /* default --tx-drain-us */
+#define TX_RETRY        4       /* default --tx-retry */
+
+#define POLL_STATS_MAX_BURST BURST_SIZE
+#include "poll_stats.h"
+#include "lat_hist.h"
+#include "mac_swap.h"
+#include "numa_util.h"
+#include "pool_size.h"
 
 static volatile bool force_quit = false;
-static struct rte_mempool *mbuf_pool = NULL;
 
-/* stats per (port,queue) */
-struct pq_stats {
+/* enabled ports (-p PORTMASK); default is every available port */
+static uint32_t enabled_port_mask = 0;
+
+/* destination port for traffic received on each port (lookup table) */
+static uint16_t tx_port_map[RTE_MAX_ETHPORTS];
+
+/* RSS configuration (--rss-key / --rss-hf) */
+static uint8_t rss_key[64] = {
+    /* symmetric Toeplitz key: both directions of a flow hash to the same queue */
+    0x6d, 0x5a, 0x6d, 0x5a, 0x6d, 0x5a, 0x6d, 0x5a,
+    0x6d, 0x5a, 0x6d, 0x5a, 0x6d, 0x5a, 0x6d, 0x5a,
+    0x6d, 0x5a, 0x6d, 0x5a, 0x6d, 0x5a, 0x6d, 0x5a,
+    0x6d, 0x5a, 0x6d, 0x5a, 0x6d, 0x5a, 0x6d, 0x5a,
+    0x6d, 0x5a, 0x6d, 0x5a, 0x6d, 0x5a, 0x6d, 0x5a,
+};
+static uint8_t rss_key_len = 40;
+static uint64_t rss_hf = RTE_ETH_RSS_IP | RTE_ETH_RSS_TCP | RTE_ETH_RSS_UDP;
+
+/*
+ * Per-lcore counters, written only by the owning lcore and read by the main
+ * lcore. seq is odd while an update is in flight; the reader retries until
+ * it copies the block between two equal, even values of seq.
+ */
+struct lcore_stats {
+    uint32_t seq;
     uint64_t rx;
     uint64_t tx;
     uint64_t dropped;
+    uint64_t tx_retries; /* extra rte_eth_tx_burst calls on a full TX ring */
+    uint64_t rx_bytes;
+    uint64_t tx_bytes;   /* accepted for TX (sent or still buffered) minus drops */
+    struct poll_stats poll; /* burst histogram and busy/idle cycles */
+} __rte_cache_aligned;
+static struct lcore_stats *stats = NULL;
+
+/*
+ * One RX queue polled by an lcore. weight is the burst budget: the queue is
+ * drained for up to weight bursts per scheduling round before moving on.
+ */
+struct lcore_rx_queue {
+    uint16_t port_id;
+    uint16_t queue_id;
+    uint16_t tx_port;
+    uint16_t weight;
+};
+
+/*
+ * TX buffer of one lcore towards one port. Packets are queued until the
+ * flush threshold (--tx-flush) or the drain timeout (--tx-drain-us); what
+ * the PMD does not take is retried up to --tx-retry times, then dropped.
+ */
+struct lcore_tx_buf {
+    struct rte_eth_dev_tx_buffer *buf;
+    uint16_t port_id;
+    uint16_t queue_id;
+    struct lcore_stats *st;
+};
+
+/* per-lcore forwarding assignment; the lcore owns tx_queue on every port */
+struct lcore_conf {
+    uint16_t n_rx_queue;
+    uint16_t tx_queue;
+    uint16_t n_tx_port;
+    struct lcore_rx_queue rx_queue_list[MAX_RX_QUEUE_PER_LCORE];
+    uint16_t tx_port_list[RTE_MAX_ETHPORTS];        /* ports this lcore sends on */
+    struct lcore_tx_buf *tx_buf[RTE_MAX_ETHPORTS];  /* indexed by port */
+} __rte_cache_aligned;
+static struct lcore_conf lcore_conf[RTE_MAX_LCORE];
+
+/* --config (port,queue,lcore[,weight]) entries */
+struct lcore_params {
+    uint16_t port_id;
+    uint16_t queue_id;
+    uint16_t lcore_id;
+    uint16_t weight;
+};
+static struct lcore_params lcore_params[RTE_MAX_LCORE * MAX_RX_QUEUE_PER_LCORE];
+static uint16_t nb_lcore_params = 0;
+
+/* RX queues per port for the default mapping (--rxq) */
+static uint16_t nb_rxq_per_port = MAX_QUEUES;
+
+/* TX buffering (--tx-flush, --tx-drain-us, --tx-retry) */
+static uint16_t tx_flush_thresh = BURST_SIZE;
+static uint32_t tx_drain_us = TX_DRAIN_US;
+static uint32_t tx_retry = TX_RETRY;
+
+/* one watcher per mbuf pool (one pool per socket with ports) */
+static struct pool_watch pool_watch[RTE_MAX_NUMA_NODES];
+static unsigned nb_pool_watch = 0;
+
+/*
+ * Forwarding latency (disabled with --no-latency). Packets are stamped at RX
+ * and measured by a TX callback just before they are handed to the PMD:
+ * - ports with RTE_ETH_RX_OFFLOAD_TIMESTAMP and a readable NIC clock: the
+ *   PMD timestamp dynfield against rte_eth_read_clock() of the RX port
+ * - otherwise: the timer cycles taken after rx_burst, in our own dynfield
+ * The callback runs before the PMD takes anything, so a burst's values are
+ * held back (tx_lat_pending) and recorded on the queue's next burst, after
+ * the TX buffer error callback has cut them down to what was accepted:
+ * retried packets are recorded once, dropped ones never.
+ * One histogram per TX queue index. Every forwarding lcore owns its TX
+ * queue on all ports, so each histogram has a single writer.
+ */
+static bool latency_enabled = true;
+static int rx_tsc_offset = -1;
+static int hwts_offset = -1;
+static uint64_t hwts_flag = 0;
+static double hwts_ns_per_tick[RTE_MAX_ETHPORTS]; /* 0: NIC clock not usable */
+static double ns_per_cycle;
+static struct lat_hist *tx_lat = NULL;
+static uint16_t nb_tx_lat = 0;
+
+#define TX_LAT_NONE UINT64_MAX  /* no sample for this packet (NIC clock unreadable) */
+
+/* latency of a TX queue's last burst, in packet order, not yet recorded */
+struct tx_lat_pending {
+    struct lat_hist *hist;
+    uint16_t n;
+    uint64_t ns[MAX_TX_FLUSH];
 } __rte_cache_aligned;
-static struct pq_stats *stats = NULL;
+static struct tx_lat_pending *tx_pend = NULL;
+
+static inline uint64_t *
+rx_tsc_field(struct rte_mbuf *m)
+{
+    return RTE_MBUF_DYNFIELD(m, rx_tsc_offset, uint64_t *);
+}
+
+/* RX stamp in software unless the PMD stamped this packet with a usable clock */
+static inline bool
+pkt_has_hwts(const struct rte_mbuf *m)
+{
+    return (m->ol_flags & hwts_flag) && hwts_ns_per_tick[m->port] != 0;
+}
 
 /* signal handler */
 static void
@@ -61,15 +202,31 @@ print_dev_caps(uint16_t port)
         printf("  PMD supports TX TCP checksum offload\n");
 }
 
-/* Initialize port with nb_rxq / nb_txq queues and request common offloads */
+/*
+ * Initialize port with nb_rxq / nb_txq queues and request common offloads.
+ * mbuf_pool should live on the port's socket.
+ */
 static int
-port_init(uint16_t port, uint16_t nb_rxq, uint16_t nb_txq)
+port_init(uint16_t port, uint16_t nb_rxq, uint16_t nb_txq, struct rte_mempool *mbuf_pool)
 {
     if (!rte_eth_dev_is_valid_port(port)) {
         fprintf(stderr, "Invalid port %u\n", port);
         return -1;
     }
 
+    struct rte_eth_dev_info dev_info;
+    int ret = rte_eth_dev_info_get(port, &dev_info);
+    if (ret != 0) {
+        fprintf(stderr, "rte_eth_dev_info_get failed: %s\n", rte_strerror(-ret));
+        return ret;
+    }
+
+    if (nb_rxq > dev_info.max_rx_queues || nb_txq > dev_info.max_tx_queues) {
+        fprintf(stderr, "Port %u supports %u rxq / %u txq, need %u / %u\n",
+                port, dev_info.max_rx_queues, dev_info.max_tx_queues, nb_rxq, nb_txq);
+        return -1;
+    }
+
     struct rte_eth_conf port_conf;
     memset(&port_conf, 0, sizeof(port_conf));
 
@@ -80,11 +237,35 @@ port_init(uint16_t port, uint16_t nb_rxq, uint16_t nb_txq)
                                 RTE_ETH_TX_OFFLOAD_TCP_CKSUM |
                                 RTE_ETH_TX_OFFLOAD_UDP_CKSUM |
                                 RTE_ETH_TX_OFFLOAD_MBUF_FAST_FREE;
+    /* ports may sit on different NICs: only ask for what this one supports */
+    port_conf.rxmode.offloads &= dev_info.rx_offload_capa;
+    port_conf.txmode.offloads &= dev_info.tx_offload_capa;
 
-    struct rte_eth_dev_info dev_info;
-    int ret = rte_eth_dev_info_get(port, &dev_info);
-    if (ret != 0) {
-        fprintf(stderr, "rte_eth_dev_info_get failed: %s\n", rte_strerror(-ret));
+    /* the PMD writes RX timestamps into a shared dynfield, registered once */
+    if (latency_enabled && hwts_offset < 0 &&
+        (port_conf.rxmode.offloads & RTE_ETH_RX_OFFLOAD_TIMESTAMP)) {
+        ret = rte_mbuf_dyn_rx_timestamp_register(&hwts_offset, &hwts_flag);
+        if (ret != 0) {
+            printf("Port %u: cannot register RX timestamp dynfield, using TSC\n", port);
+            hwts_offset = -1;
+            hwts_flag = 0;
+        }
+    }
+
+    /* spread flows over the RX queues with RSS */
+    if (nb_rxq > 1) {
+        port_conf.rxmode.mq_mode = RTE_ETH_MQ_RX_RSS;
+        port_conf.rx_adv_conf.rss_conf.rss_hf = rss_hf & dev_info.flow_type_rss_offloads;
+        if (port_conf.rx_adv_conf.rss_conf.rss_hf != rss_hf)
+            printf("Port %u: RSS hash fields 0x%"PRIx64" reduced to 0x%"PRIx64"\n",
+                   port, rss_hf, port_conf.rx_adv_conf.rss_conf.rss_hf);
+        if (dev_info.hash_key_size == 0 || dev_info.hash_key_size == rss_key_len) {
+            port_conf.rx_adv_conf.rss_conf.rss_key = rss_key;
+            port_conf.rx_adv_conf.rss_conf.rss_key_len = rss_key_len;
+        } else {
+            printf("Port %u: RSS key must be %u bytes (got %u), using PMD default\n",
+                   port, dev_info.hash_key_size, rss_key_len);
+        }
     }
 
     ret = rte_eth_dev_configure(port, nb_rxq, nb_txq, &port_conf);
@@ -129,75 +310,928 @@ port_init(uint16_t port, uint16_t nb_rxq, uint16_t nb_txq)
     return 0;
 }
 
-/* worker: handle one (port,queue) pair; arg is (uintptr_t)queue_id */
+/* NIC clock rate of a port with RX timestamps, measured against the TSC */
+static void
+hwts_calibrate(uint16_t port)
+{
+    uint64_t c0, c1;
+
+    if (hwts_flag == 0 || rte_eth_read_clock(port, &c0) != 0) {
+        printf("Port %u: latency from software RX timestamps\n", port);
+        return;
+    }
+    uint64_t t0 = rte_get_timer_cycles();
+    rte_delay_ms(100);
+    uint64_t t1 = rte_get_timer_cycles();
+    if (rte_eth_read_clock(port, &c1) != 0 || c1 <= c0) {
+        printf("Port %u: NIC clock not advancing, latency from software RX timestamps\n", port);
+        return;
+    }
+    hwts_ns_per_tick[port] = (double)(t1 - t0) * ns_per_cycle / (double)(c1 - c0);
+    printf("Port %u: latency from hardware RX timestamps (NIC clock %.1f MHz)\n",
+           port, 1e3 / hwts_ns_per_tick[port]);
+}
+
+/* the pending burst was accepted by the PMD: record it */
+static inline void
+tx_lat_commit(struct tx_lat_pending *p)
+{
+    for (uint16_t i = 0; i < p->n; i++) {
+        if (p->ns[i] != TX_LAT_NONE)
+            lat_hist_record(p->hist, p->ns[i]);
+    }
+    p->n = 0;
+}
+
+/*
+ * residence time of every packet about to be sent, held as the queue's
+ * pending burst; user_param is the TX queue's tx_lat_pending
+ */
+static uint16_t
+tx_latency_cb(__rte_unused uint16_t port, __rte_unused uint16_t queue,
+              struct rte_mbuf *pkts[], uint16_t nb_pkts, void *user_param)
+{
+    struct tx_lat_pending *p = user_param;
+    uint64_t now = rte_get_timer_cycles();
+    uint64_t clk[RTE_MAX_ETHPORTS];
+    int8_t clk_state[RTE_MAX_ETHPORTS] = { 0 }; /* 0 not read yet, 1 read, -1 unreadable */
+
+    /* nothing of the previous burst was refused since it was sent */
+    tx_lat_commit(p);
+    for (uint16_t i = 0; i < nb_pkts && i < MAX_TX_FLUSH; i++) {
+        struct rte_mbuf *m = pkts[i];
+        uint64_t *v = &p->ns[p->n++];
+
+        if (pkt_has_hwts(m)) {
+            /*
+             * the TX buffer mixes packets from every RX queue and port this
+             * lcore polls: read the clock of each RX port once per burst
+             */
+            if (clk_state[m->port] == 0)
+                clk_state[m->port] = rte_eth_read_clock(m->port, &clk[m->port]) == 0 ? 1 : -1;
+            if (clk_state[m->port] < 0) {
+                *v = TX_LAT_NONE;
+                continue;
+            }
+            rte_mbuf_timestamp_t ts = *RTE_MBUF_DYNFIELD(m, hwts_offset, rte_mbuf_timestamp_t *);
+            *v = clk[m->port] > ts ? (uint64_t)((clk[m->port] - ts) * hwts_ns_per_tick[m->port]) : 0;
+        } else {
+            uint64_t ts = *rx_tsc_field(m);
+            *v = now > ts ? (uint64_t)((now - ts) * ns_per_cycle) : 0;
+        }
+    }
+    return nb_pkts;
+}
+
+/* register the RX stamp dynfield; call before any mbuf is received */
+static int
+latency_init(void)
+{
+    static const struct rte_mbuf_dynfield rx_tsc_desc = {
+        .name = "perf_app_dynfield_rx_tsc",
+        .size = sizeof(uint64_t),
+        .align = __alignof__(uint64_t),
+    };
+
+    ns_per_cycle = 1e9 / (double)rte_get_timer_hz();
+    rx_tsc_offset = rte_mbuf_dynfield_register(&rx_tsc_desc);
+    if (rx_tsc_offset < 0) {
+        fprintf(stderr, "Cannot register RX TSC dynfield: %s\n", rte_strerror(rte_errno));
+        return -1;
+    }
+    return 0;
+}
+
+/* one histogram per TX queue index and a TX callback on every (port, queue) */
 static int
-lcore_forward(void *arg)
+latency_attach(const uint16_t *ports, uint16_t nb_ports, uint16_t nb_txq)
 {
-    const uint16_t port = 0; /* single port example */
-    const uint16_t q = (uint16_t)(uintptr_t)arg;
-    struct rte_mbuf *bufs[BURST_SIZE];
+    tx_lat = rte_zmalloc("tx_lat", sizeof(*tx_lat) * nb_txq, RTE_CACHE_LINE_SIZE);
+    if (!tx_lat) {
+        fprintf(stderr, "Failed to allocate latency histograms\n");
+        return -1;
+    }
+    nb_tx_lat = nb_txq;
+    tx_pend = rte_zmalloc("tx_pend", sizeof(*tx_pend) * nb_txq, RTE_CACHE_LINE_SIZE);
+    if (!tx_pend) {
+        fprintf(stderr, "Failed to allocate latency histograms\n");
+        return -1;
+    }
+    for (uint16_t q = 0; q < nb_txq; q++)
+        tx_pend[q].hist = &tx_lat[q];
 
-    uint64_t last_tsc = rte_get_tsc_cycles();
-    const uint64_t tsc_hz = rte_get_timer_hz();
-    const uint64_t stats_tsc_period = tsc_hz * STATS_INTERVAL_SEC;
+    for (uint16_t i = 0; i < nb_ports; i++) {
+        hwts_calibrate(ports[i]);
+        for (uint16_t q = 0; q < nb_txq; q++) {
+            if (rte_eth_add_tx_callback(ports[i], q, tx_latency_cb, &tx_pend[q]) == NULL) {
+                fprintf(stderr, "Port %u queue %u: cannot add TX callback: %s\n",
+                        ports[i], q, rte_strerror(rte_errno));
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+static inline void
+stats_write_begin(struct lcore_stats *st)
+{
+    __atomic_store_n(&st->seq, st->seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static inline void
+stats_write_end(struct lcore_stats *st)
+{
+    __atomic_store_n(&st->seq, st->seq + 1, __ATOMIC_RELEASE);
+}
+
+/* consistent copy of another lcore's counters; never blocks the writer */
+static void
+stats_snapshot(const struct lcore_stats *st, struct lcore_stats *out)
+{
+    uint32_t seq0, seq1;
+
+    do {
+        seq0 = __atomic_load_n(&st->seq, __ATOMIC_ACQUIRE);
+        if (seq0 & 1) {
+            rte_pause();
+            continue;
+        }
+        memcpy(out, st, sizeof(*out));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        seq1 = __atomic_load_n(&st->seq, __ATOMIC_RELAXED);
+    } while ((seq0 & 1) || seq0 != seq1);
+}
 
-    printf("lcore %u: forwarding on port %u queue %u\n", rte_lcore_id(), port, q);
+/*
+ * TX buffer error callback: retry what the PMD refused while the budget
+ * lasts, then free the rest in one bulk call. Runs on the owning lcore.
+ */
+static void
+tx_buffer_retry_cb(struct rte_mbuf **unsent, uint16_t count, void *userdata)
+{
+    struct lcore_tx_buf *tb = userdata;
+    struct lcore_stats *st = tb->st;
+    struct tx_lat_pending *lp = tx_pend ? &tx_pend[tb->queue_id] : NULL;
+    uint64_t drop_bytes = 0;
+    uint32_t retries = 0;
+    uint16_t sent = 0;
+
+    /* the refused packets are the tail of the burst just sent */
+    if (lp)
+        lp->n = lp->n > count ? lp->n - count : 0;
+    while (sent < count && retries < tx_retry) {
+        uint16_t n = rte_eth_tx_burst(tb->port_id, tb->queue_id, unsent + sent, count - sent);
+        if (lp && lp->n > n)
+            lp->n = n;
+        sent += n;
+        retries++;
+    }
+    if (unlikely(sent < count)) {
+        for (uint16_t i = sent; i < count; i++)
+            drop_bytes += rte_pktmbuf_pkt_len(unsent[i]);
+        rte_pktmbuf_free_bulk(unsent + sent, count - sent);
+    }
+
+    stats_write_begin(st);
+    st->tx += sent;
+    st->tx_retries += retries;
+    st->dropped += count - sent;
+    st->tx_bytes -= drop_bytes;
+    stats_write_end(st);
+}
+
+/* flush every TX buffer of this lcore (drain timeout, exit) */
+static inline void
+drain_tx_buffers(const struct lcore_conf *conf, struct lcore_stats *st)
+{
+    uint16_t sent = 0;
+
+    for (uint16_t i = 0; i < conf->n_tx_port; i++) {
+        struct lcore_tx_buf *tb = conf->tx_buf[conf->tx_port_list[i]];
+        sent += rte_eth_tx_buffer_flush(tb->port_id, tb->queue_id, tb->buf);
+    }
+    if (sent) {
+        stats_write_begin(st);
+        st->tx += sent;
+        stats_write_end(st);
+    }
+}
+
+/* swap MACs on one RX burst and queue it for the mapped port */
+static inline void
+forward_burst(const struct lcore_conf *conf, const struct lcore_rx_queue *rxq,
+              struct lcore_stats *st, struct rte_mbuf **bufs, uint16_t nb_rx)
+{
+    struct lcore_tx_buf *tb = conf->tx_buf[rxq->tx_port];
+    uint64_t rx_bytes = 0;
+    uint16_t nb_tx = 0;
+
+    /* per-packet metadata (mbuf struct only) & timestamp */
+    uint64_t now_cycles = rte_get_timer_cycles();
+    for (uint16_t i = 0; i < nb_rx; i++) {
+        struct rte_mbuf *m = bufs[i];
+
+        /* software RX timestamp (cycles) for the TX latency callback */
+        if (latency_enabled && !pkt_has_hwts(m))
+            *rx_tsc_field(m) = now_cycles;
+        rx_bytes += rte_pktmbuf_pkt_len(m);
+    }
+
+    /* in-place L2 swap: the only packet data touched, prefetched i + N ahead */
+    mac_swap_burst(bufs, nb_rx);
+
+    /* this lcore's own TX queue on the mapped port; sends once the buffer is full */
+    for (uint16_t i = 0; i < nb_rx; i++)
+        nb_tx += rte_eth_tx_buffer(tb->port_id, tb->queue_id, tb->buf, bufs[i]);
+
+    /* refused packets are accounted by tx_buffer_retry_cb */
+    stats_write_begin(st);
+    st->rx += nb_rx;
+    st->rx_bytes += rx_bytes;
+    st->tx += nb_tx;
+    st->tx_bytes += rx_bytes;
+    stats_write_end(st);
+}
+
+/*
+ * worker: poll every (port,queue) in lcore_conf[] round-robin. Each queue is
+ * drained for up to its weight in bursts; a short burst means the ring is
+ * empty, so the lcore moves on to the next queue straight away.
+ * Workers only update their own lcore_stats; printing is left to main.
+ */
+static int
+lcore_forward(__rte_unused void *arg)
+{
+    const struct lcore_conf *conf = &lcore_conf[rte_lcore_id()];
+    if (conf->n_rx_queue == 0)
+        return 0;
+
+    struct lcore_stats *st = &stats[rte_lcore_id()];
+    struct rte_mbuf *bufs[BURST_SIZE];
+    uint64_t t = poll_stats_cycles();
+    const uint64_t drain_tsc = (rte_get_tsc_hz() + US_PER_S - 1) / US_PER_S * tx_drain_us;
+    uint64_t prev_drain = rte_rdtsc();
+
+    for (uint16_t i = 0; i < conf->n_rx_queue; i++) {
+        const struct lcore_rx_queue *rxq = &conf->rx_queue_list[i];
+        printf("lcore %u: forwarding port %u queue %u -> port %u queue %u (weight %u)\n",
+               rte_lcore_id(), rxq->port_id, rxq->queue_id, rxq->tx_port,
+               conf->tx_queue, rxq->weight);
+    }
 
     while (!force_quit) {
-        uint16_t nb_rx = rte_eth_rx_burst(port, q, bufs, BURST_SIZE);
-        if (unlikely(nb_rx == 0)) {
+        uint32_t round_rx = 0;
+
+        for (uint16_t i = 0; i < conf->n_rx_queue; i++) {
+            const struct lcore_rx_queue *rxq = &conf->rx_queue_list[i];
+
+            for (uint16_t b = 0; b < rxq->weight; b++) {
+                uint16_t nb_rx = rte_eth_rx_burst(rxq->port_id, rxq->queue_id,
+                                                  bufs, BURST_SIZE);
+                if (nb_rx == 0) {
+                    t = poll_stats_record(&st->poll, 0, t);
+                    break;
+                }
+                forward_burst(conf, rxq, st, bufs, nb_rx);
+                t = poll_stats_record(&st->poll, nb_rx, t);
+                round_rx += nb_rx;
+                if (nb_rx < BURST_SIZE)
+                    break;
+            }
+        }
+
+        /* a partly filled buffer must not wait for more traffic forever */
+        uint64_t now = rte_rdtsc();
+        if (unlikely(now - prev_drain > drain_tsc)) {
+            drain_tx_buffers(conf, st);
+            prev_drain = now;
+        }
+
+        if (unlikely(round_rx == 0)) {
             rte_pause(); /* polite busy-wait */
+            t = poll_stats_idle(&st->poll, t);
+        }
+    }
+
+    drain_tx_buffers(conf, st);
+    if (tx_pend)
+        tx_lat_commit(&tx_pend[conf->tx_queue]);
+    return 0;
+}
+
+static void
+print_lcore_stats(unsigned lcore_id, const struct lcore_stats *cur,
+                  const struct lcore_stats *prev, double dt)
+{
+    printf("  lcore %2u: rx=%10.0f pps tx=%10.0f pps drop=%8.0f pps retry=%8.0f/s rx=%8.1f Mbps"
+           " busy=%5.1f%% empty=%5.1f%% full=%5.1f%% cyc/burst=%6.0f\n",
+           lcore_id,
+           (cur->rx - prev->rx) / dt,
+           (cur->tx - prev->tx) / dt,
+           (cur->dropped - prev->dropped) / dt,
+           (cur->tx_retries - prev->tx_retries) / dt,
+           (cur->rx_bytes - prev->rx_bytes) * 8.0 / dt / 1e6,
+           100.0 * poll_stats_busy_ratio(&cur->poll, &prev->poll),
+           100.0 * poll_stats_empty_ratio(&cur->poll, &prev->poll),
+           100.0 * poll_stats_full_ratio(&cur->poll, &prev->poll, BURST_SIZE),
+           poll_stats_cycles_per_burst(&cur->poll, &prev->poll));
+}
+
+static void
+lcore_stats_read(unsigned lcore_id, struct lcore_stats *out)
+{
+    stats_snapshot(&stats[lcore_id], out);
+    poll_stats_snapshot(&stats[lcore_id].poll, &out->poll);
+}
+
+static void
+print_latency(const char *label, const struct lat_hist *h)
+{
+    printf("  %s: n=%"PRIu64" avg=%"PRIu64" p50=%"PRIu64" p90=%"PRIu64
+           " p99=%"PRIu64" p99.9=%"PRIu64" max=%"PRIu64" ns\n",
+           label, h->count, lat_hist_mean(h),
+           lat_hist_percentile(h, 50.0), lat_hist_percentile(h, 90.0),
+           lat_hist_percentile(h, 99.0), lat_hist_percentile(h, 99.9), h->max);
+}
+
+/*
+ * Merge the TX queue histograms. With prev, only what was recorded since
+ * the previous call (prev is updated); without, everything since start.
+ */
+static void
+latency_merge(struct lat_hist *prev, struct lat_hist *out)
+{
+    static struct lat_hist cur, delta;
+
+    lat_hist_init(out);
+    for (uint16_t q = 0; q < nb_tx_lat; q++) {
+        lat_hist_snapshot(&tx_lat[q], &cur);
+        if (prev) {
+            lat_hist_sub(&delta, &cur, &prev[q]);
+            prev[q] = cur;
+            lat_hist_merge(out, &delta);
+        } else {
+            lat_hist_merge(out, &cur);
+        }
+    }
+}
+
+/* main lcore: snapshot every forwarding lcore each interval and print rates */
+static void
+stats_reader_loop(void)
+{
+    static struct lcore_stats prev[RTE_MAX_LCORE];
+    static struct lat_hist prev_lat[RTE_MAX_LCORE], lat;
+    const uint64_t tsc_hz = rte_get_tsc_hz();
+    uint64_t last_tsc = rte_get_tsc_cycles();
+    unsigned lcore_id;
+
+    while (!force_quit) {
+        usleep(100 * 1000);
+        uint64_t now = rte_get_tsc_cycles();
+        if (now - last_tsc < tsc_hz * STATS_INTERVAL_SEC)
             continue;
+
+        double dt = (double)(now - last_tsc) / tsc_hz;
+        struct lcore_stats cur, total;
+        memset(&total, 0, sizeof(total));
+
+        printf("=== forwarding stats (%.1fs) ===\n", dt);
+        RTE_LCORE_FOREACH(lcore_id) {
+            if (lcore_conf[lcore_id].n_rx_queue == 0)
+                continue;
+            lcore_stats_read(lcore_id, &cur);
+            print_lcore_stats(lcore_id, &cur, &prev[lcore_id], dt);
+            prev[lcore_id] = cur;
+            total.rx += cur.rx;
+            total.tx += cur.tx;
+            total.dropped += cur.dropped;
+            total.tx_retries += cur.tx_retries;
+        }
+        printf("  totals: rx=%"PRIu64" tx=%"PRIu64" drop=%"PRIu64" retries=%"PRIu64"\n",
+               total.rx, total.tx, total.dropped, total.tx_retries);
+        if (tx_lat) {
+            latency_merge(prev_lat, &lat);
+            print_latency("latency", &lat);
         }
+        for (unsigned i = 0; i < nb_pool_watch; i++) {
+            struct pool_watch *w = &pool_watch[i];
+            pool_watch_sample(w);
+            printf("  %s: in use %u/%u, low-water free %u, rx_nombuf %.0f/s\n",
+                   w->mp->name, rte_mempool_in_use_count(w->mp), w->mp->size,
+                   w->min_avail, (w->nombuf - w->nombuf_prev) / dt);
+        }
+        last_tsc = now;
+    }
+}
 
-        /* prefetch first few packets */
-        uint16_t p = (nb_rx < 4) ? nb_rx : 4;
-        for (uint16_t i = 0; i < p; i++)
-            rte_prefetch0(rte_pktmbuf_mtod(bufs[i], void *));
+/* final per-lcore totals with the full burst-size histogram */
+static void
+print_final_stats(void)
+{
+    unsigned lcore_id;
 
-        /* per-packet quick processing & timestamp */
-        uint64_t now_cycles = rte_get_timer_cycles();
-        for (uint16_t i = 0; i < nb_rx; i++) {
-            struct rte_mbuf *m = bufs[i];
+    RTE_LCORE_FOREACH(lcore_id) {
+        struct lcore_stats cur;
+        if (lcore_conf[lcore_id].n_rx_queue == 0)
+            continue;
+        lcore_stats_read(lcore_id, &cur);
+        printf("lcore %u: rx=%"PRIu64" tx=%"PRIu64" drop=%"PRIu64" retries=%"PRIu64
+               " rx_bytes=%"PRIu64" polls=%"PRIu64" empty=%"PRIu64"\n",
+               lcore_id, cur.rx, cur.tx, cur.dropped, cur.tx_retries, cur.rx_bytes,
+               cur.poll.polls, cur.poll.burst_hist[0]);
+        printf("  burst histogram:");
+        for (int i = 0; i <= BURST_SIZE; i++) {
+            if (cur.poll.burst_hist[i])
+                printf(" %d:%"PRIu64, i, cur.poll.burst_hist[i]);
+        }
+        printf("\n");
+    }
+    if (tx_lat) {
+        static struct lat_hist lat;
+        latency_merge(NULL, &lat);
+        print_latency("forwarding latency (total)", &lat);
+    }
+    for (unsigned i = 0; i < nb_pool_watch; i++) {
+        struct pool_watch *w = &pool_watch[i];
+        pool_watch_sample(w);
+        printf("%s: %u mbufs, low-water free %u, rx_nombuf %"PRIu64"\n",
+               w->mp->name, w->mp->size, w->min_avail, w->nombuf);
+    }
+}
+
+/*
+ * --bench: cycles per packet of the L2 swap loop, without ports. Runs on
+ * BENCH_MBUFS mbufs in shuffled order, far more than fit in the LLC, so
+ * headers come from memory the way they do after NIC DMA.
+ */
+#define BENCH_MBUFS     65535   /* 2^n - 1 for the mempool */
+#define BENCH_PKT_LEN   64
+
+static unsigned bench_rounds = 0;
+
+/* the loop as it was: prefetch the first 4, then swap in order */
+static void
+bench_swap_legacy(struct rte_mbuf **pkts, uint16_t n)
+{
+    uint16_t p = (n < 4) ? n : 4;
+    for (uint16_t i = 0; i < p; i++)
+        rte_prefetch0(rte_pktmbuf_mtod(pkts[i], void *));
+    for (uint16_t i = 0; i < n; i++)
+        mac_swap_scalar(pkts[i]);
+}
 
-            /* store software timestamp (cycles) in udata64 for later use */
-            //m->udata64 = now_cycles;
+static double
+bench_one(void (*fn)(struct rte_mbuf **, uint16_t), struct rte_mbuf **pkts, unsigned nb)
+{
+    uint64_t t0 = rte_rdtsc();
+    for (unsigned r = 0; r < bench_rounds; r++) {
+        for (unsigned i = 0; i + BURST_SIZE <= nb; i += BURST_SIZE)
+            fn(&pkts[i], BURST_SIZE);
+    }
+    uint64_t t1 = rte_rdtsc();
+    return (double)(t1 - t0) / ((double)bench_rounds * (nb - nb % BURST_SIZE));
+}
+
+static int
+run_bench(void)
+{
+    struct rte_mempool *mp = rte_pktmbuf_pool_create("BENCH_POOL", BENCH_MBUFS, 0, 0,
+                                                     RTE_MBUF_DEFAULT_BUF_SIZE, rte_socket_id());
+    struct rte_mbuf **pkts = rte_malloc("bench", sizeof(*pkts) * BENCH_MBUFS, 0);
+    if (mp == NULL || pkts == NULL ||
+        rte_pktmbuf_alloc_bulk(mp, pkts, BENCH_MBUFS) != 0) {
+        fprintf(stderr, "bench: cannot allocate %d mbufs\n", BENCH_MBUFS);
+        return -1;
+    }
+
+    for (unsigned i = 0; i < BENCH_MBUFS; i++) {
+        uint8_t *d = (uint8_t *)rte_pktmbuf_append(pkts[i], BENCH_PKT_LEN);
+        for (unsigned b = 0; b < BENCH_PKT_LEN; b++)
+            d[b] = (uint8_t)(i + b);
+    }
+    /* recycled mbufs come back in no particular order: defeat the stride prefetcher */
+    for (unsigned i = BENCH_MBUFS - 1; i > 0; i--) {
+        unsigned j = (unsigned)rand() % (i + 1);
+        struct rte_mbuf *tmp = pkts[i];
+        pkts[i] = pkts[j];
+        pkts[j] = tmp;
+    }
 
-            /* tiny in-place L2 swap (cheap, demo only) */
-            struct rte_ether_hdr *eth = rte_pktmbuf_mtod(m, struct rte_ether_hdr *);
-            struct rte_ether_addr tmp;
-            rte_ether_addr_copy(&eth->src_addr, &tmp);
-            rte_ether_addr_copy(&eth->dst_addr, &eth->src_addr);
-            rte_ether_addr_copy(&tmp, &eth->dst_addr);
+    const char *kernel =
+#if defined(__AVX2__)
+        "avx2";
+#elif defined(__SSSE3__)
+        "ssse3";
+#else
+        "scalar";
+#endif
+    printf("L2 swap bench: %d mbufs x %u rounds, burst %d, prefetch distance %d\n",
+           BENCH_MBUFS, bench_rounds, BURST_SIZE, MAC_SWAP_PREFETCH);
+    printf("  legacy (prefetch 4, scalar)   %6.1f cycles/pkt\n",
+           bench_one(bench_swap_legacy, pkts, BENCH_MBUFS));
+    printf("  pipelined, scalar             %6.1f cycles/pkt\n",
+           bench_one(mac_swap_burst_scalar, pkts, BENCH_MBUFS));
+    printf("  pipelined, %-6s             %6.1f cycles/pkt\n", kernel,
+           bench_one(mac_swap_burst, pkts, BENCH_MBUFS));
 
-            stats[q].rx++;
+    rte_pktmbuf_free_bulk(pkts, BENCH_MBUFS);
+    rte_free(pkts);
+    rte_mempool_free(mp);
+    return 0;
+}
+
+static void
+print_usage(const char *prgname)
+{
+    printf("%s [EAL options] -- [-p PORTMASK] [--config (port,queue,lcore[,weight])[,...]]\n"
+           "        [--rxq N] [--rss-key HEX] [--rss-hf LIST] [--no-latency]\n"
+           "        [--tx-flush N] [--tx-drain-us US] [--tx-retry N] [--bench ROUNDS]\n"
+           "  -p PORTMASK     hexadecimal bitmask of ports to forward on (default: all)\n"
+           "  --config LIST   RX queue to lcore mapping; weight is the burst budget per\n"
+           "                  round (1..%d, default 1). Default: spread over all lcores\n"
+           "  --rxq N         RX queues per port when --config is not given (default: %d)\n"
+           "  --rss-key HEX   RSS hash key as a hex string (default: 40-byte symmetric key)\n"
+           "  --rss-hf LIST   comma-separated RSS fields: ip,tcp,udp,sctp,l2 (default: ip,tcp,udp)\n"
+           "  --no-latency    no RX timestamps and no TX latency histogram\n"
+           "  --tx-flush N    packets buffered per TX queue before a send (1..%d, default: %d)\n"
+           "  --tx-drain-us US  send a partly filled TX buffer after US microseconds (default: %d)\n"
+           "  --tx-retry N    extra send attempts on a full TX ring before dropping (default: %d)\n"
+           "  --bench ROUNDS  measure cycles/packet of the L2 swap loop and exit (no ports needed)\n",
+           prgname, MAX_QUEUE_WEIGHT, MAX_QUEUES, MAX_TX_FLUSH, BURST_SIZE, TX_DRAIN_US, TX_RETRY);
+}
+
+static int
+parse_rss_key(const char *arg)
+{
+    size_t len = strlen(arg);
+    if (len == 0 || len % 2 != 0 || len / 2 > sizeof(rss_key))
+        return -1;
+
+    for (size_t i = 0; i < len / 2; i++) {
+        char byte[3] = { arg[2 * i], arg[2 * i + 1], '\0' };
+        char *end = NULL;
+        unsigned long v = strtoul(byte, &end, 16);
+        if (end == NULL || *end != '\0')
+            return -1;
+        rss_key[i] = (uint8_t)v;
+    }
+    rss_key_len = (uint8_t)(len / 2);
+    return 0;
+}
+
+static int
+parse_rss_hf(const char *arg)
+{
+    char buf[128];
+    uint64_t hf = 0;
+
+    snprintf(buf, sizeof(buf), "%s", arg);
+    for (char *tok = strtok(buf, ","); tok != NULL; tok = strtok(NULL, ",")) {
+        if (strcmp(tok, "ip") == 0)
+            hf |= RTE_ETH_RSS_IP;
+        else if (strcmp(tok, "tcp") == 0)
+            hf |= RTE_ETH_RSS_TCP;
+        else if (strcmp(tok, "udp") == 0)
+            hf |= RTE_ETH_RSS_UDP;
+        else if (strcmp(tok, "sctp") == 0)
+            hf |= RTE_ETH_RSS_SCTP;
+        else if (strcmp(tok, "l2") == 0)
+            hf |= RTE_ETH_RSS_L2_PAYLOAD;
+        else
+            return -1;
+    }
+    if (hf == 0)
+        return -1;
+    rss_hf = hf;
+    return 0;
+}
+
+/* parse --config "(port,queue,lcore[,weight]),..." into lcore_params[] */
+static int
+parse_config(const char *q_arg)
+{
+    const char *p = q_arg;
+
+    nb_lcore_params = 0;
+    while ((p = strchr(p, '(')) != NULL) {
+        const char *end = strchr(++p, ')');
+        char s[64];
+        unsigned long fld[4];
+        int nb_fld = 0;
+
+        if (end == NULL || (size_t)(end - p) >= sizeof(s))
+            return -1;
+        memcpy(s, p, end - p);
+        s[end - p] = '\0';
+
+        char *save = NULL;
+        for (char *tok = strtok_r(s, ",", &save); tok != NULL;
+             tok = strtok_r(NULL, ",", &save)) {
+            char *tail = NULL;
+            if (nb_fld == (int)RTE_DIM(fld))
+                return -1;
+            fld[nb_fld++] = strtoul(tok, &tail, 0);
+            if (tail == tok || *tail != '\0')
+                return -1;
         }
+        if (nb_fld < 3)
+            return -1;
+        if (nb_fld == 3)
+            fld[nb_fld++] = 1;
+
+        if (fld[0] >= RTE_MAX_ETHPORTS || fld[1] >= MAX_QUEUES ||
+            fld[2] >= RTE_MAX_LCORE || fld[3] == 0 || fld[3] > MAX_QUEUE_WEIGHT)
+            return -1;
+        if (nb_lcore_params >= RTE_DIM(lcore_params))
+            return -1;
 
-        /* transmit on same port/queue (simple forward); production code maps dst appropriately */
-        uint16_t nb_tx = rte_eth_tx_burst(port, q, bufs, nb_rx);
-        if (unlikely(nb_tx < nb_rx)) {
-            for (uint16_t i = nb_tx; i < nb_rx; i++) {
-                rte_pktmbuf_free(bufs[i]);
-                stats[q].dropped++;
+        lcore_params[nb_lcore_params].port_id = (uint16_t)fld[0];
+        lcore_params[nb_lcore_params].queue_id = (uint16_t)fld[1];
+        lcore_params[nb_lcore_params].lcore_id = (uint16_t)fld[2];
+        lcore_params[nb_lcore_params].weight = (uint16_t)fld[3];
+        nb_lcore_params++;
+        p = end + 1;
+    }
+    return nb_lcore_params > 0 ? 0 : -1;
+}
+
+static int
+parse_args(int argc, char **argv)
+{
+    enum { OPT_RSS_KEY = 256, OPT_RSS_HF, OPT_CONFIG, OPT_RXQ, OPT_NO_LATENCY,
+           OPT_TX_FLUSH, OPT_TX_DRAIN, OPT_TX_RETRY, OPT_BENCH };
+    static const struct option lgopts[] = {
+        { "config",  required_argument, NULL, OPT_CONFIG },
+        { "rxq",     required_argument, NULL, OPT_RXQ },
+        { "rss-key", required_argument, NULL, OPT_RSS_KEY },
+        { "rss-hf",  required_argument, NULL, OPT_RSS_HF },
+        { "no-latency", no_argument,    NULL, OPT_NO_LATENCY },
+        { "tx-flush", required_argument, NULL, OPT_TX_FLUSH },
+        { "tx-drain-us", required_argument, NULL, OPT_TX_DRAIN },
+        { "tx-retry", required_argument, NULL, OPT_TX_RETRY },
+        { "bench",   required_argument, NULL, OPT_BENCH },
+        { NULL, 0, NULL, 0 },
+    };
+    const char *prgname = argv[0];
+    int opt;
+
+    while ((opt = getopt_long(argc, argv, "p:", lgopts, NULL)) != EOF) {
+        switch (opt) {
+        case 'p':
+            enabled_port_mask = (uint32_t)strtoul(optarg, NULL, 16);
+            if (enabled_port_mask == 0) {
+                fprintf(stderr, "Invalid portmask '%s'\n", optarg);
+                print_usage(prgname);
+                return -1;
             }
-        } else {
-            stats[q].tx += nb_tx;
+            break;
+        case OPT_CONFIG:
+            if (parse_config(optarg) != 0) {
+                fprintf(stderr, "Invalid --config '%s'\n", optarg);
+                print_usage(prgname);
+                return -1;
+            }
+            break;
+        case OPT_RXQ:
+            nb_rxq_per_port = (uint16_t)strtoul(optarg, NULL, 10);
+            if (nb_rxq_per_port == 0 || nb_rxq_per_port > MAX_QUEUES) {
+                fprintf(stderr, "Invalid --rxq '%s' (1..%d)\n", optarg, MAX_QUEUES);
+                print_usage(prgname);
+                return -1;
+            }
+            break;
+        case OPT_RSS_KEY:
+            if (parse_rss_key(optarg) != 0) {
+                fprintf(stderr, "Invalid RSS key '%s'\n", optarg);
+                print_usage(prgname);
+                return -1;
+            }
+            break;
+        case OPT_RSS_HF:
+            if (parse_rss_hf(optarg) != 0) {
+                fprintf(stderr, "Invalid RSS hash fields '%s'\n", optarg);
+                print_usage(prgname);
+                return -1;
+            }
+            break;
+        case OPT_NO_LATENCY:
+            latency_enabled = false;
+            break;
+        case OPT_TX_FLUSH:
+            tx_flush_thresh = (uint16_t)strtoul(optarg, NULL, 10);
+            if (tx_flush_thresh == 0 || tx_flush_thresh > MAX_TX_FLUSH) {
+                fprintf(stderr, "Invalid --tx-flush '%s' (1..%d)\n", optarg, MAX_TX_FLUSH);
+                print_usage(prgname);
+                return -1;
+            }
+            break;
+        case OPT_TX_DRAIN:
+            tx_drain_us = (uint32_t)strtoul(optarg, NULL, 10);
+            if (tx_drain_us == 0) {
+                fprintf(stderr, "Invalid --tx-drain-us '%s'\n", optarg);
+                print_usage(prgname);
+                return -1;
+            }
+            break;
+        case OPT_TX_RETRY:
+            tx_retry = (uint32_t)strtoul(optarg, NULL, 10);
+            break;
+        case OPT_BENCH:
+            bench_rounds = (unsigned)strtoul(optarg, NULL, 10);
+            if (bench_rounds == 0) {
+                fprintf(stderr, "Invalid --bench '%s'\n", optarg);
+                print_usage(prgname);
+                return -1;
+            }
+            break;
+        default:
+            print_usage(prgname);
+            return -1;
         }
+    }
+    return 0;
+}
+
+/* Pair enabled ports (0<->1, 2<->3, ...); an odd port out forwards to itself */
+static void
+build_tx_port_map(const uint16_t *ports, uint16_t nb_ports)
+{
+    for (uint16_t i = 0; i < nb_ports; i++) {
+        if (i % 2 == 0)
+            tx_port_map[ports[i]] = (i + 1 < nb_ports) ? ports[i + 1] : ports[i];
+        else
+            tx_port_map[ports[i]] = ports[i - 1];
+    }
+    for (uint16_t i = 0; i < nb_ports; i++)
+        printf("Port %u -> port %u\n", ports[i], tx_port_map[ports[i]]);
+}
+
+/* no --config: spread every (port,queue) over the forwarding lcores */
+static void
+build_default_lcore_params(const uint16_t *ports, uint16_t nb_ports,
+                           const unsigned *fwd_lcores, unsigned nb_fwd_lcores)
+{
+    unsigned next_any = 0;
+    unsigned next_local[RTE_MAX_NUMA_NODES] = { 0 };
+
+    /*
+     * queue-major so both ports get their first queues on different lcores;
+     * round-robin over the lcores on the port's socket, all of them if none
+     */
+    for (uint16_t q = 0; q < MAX_QUEUES; q++) {
+        for (uint16_t i = 0; i < nb_ports; i++) {
+            struct rte_eth_dev_info dev_info;
+            uint16_t n = nb_rxq_per_port;
+            if (rte_eth_dev_info_get(ports[i], &dev_info) == 0 && n > dev_info.max_rx_queues)
+                n = dev_info.max_rx_queues;
+            if (q >= n)
+                continue;
 
-        /* periodic stats print from one worker core (cooperative) */
-        if ((rte_get_tsc_cycles() - last_tsc) > stats_tsc_period) {
-            uint64_t rx_sum = 0, tx_sum = 0, drop_sum = 0;
-            for (int i = 0; i < MAX_QUEUES; i++) {
-                rx_sum += stats[i].rx;
-                tx_sum += stats[i].tx;
-                drop_sum += stats[i].dropped;
+            int socket = numa_port_socket(ports[i]);
+            unsigned nb_local = 0, lcore = fwd_lcores[next_any % nb_fwd_lcores];
+            for (unsigned k = 0; k < nb_fwd_lcores; k++)
+                nb_local += (int)rte_lcore_to_socket_id(fwd_lcores[k]) == socket;
+            if (nb_local > 0) {
+                unsigned want = next_local[socket]++ % nb_local;
+                for (unsigned k = 0; k < nb_fwd_lcores; k++) {
+                    if ((int)rte_lcore_to_socket_id(fwd_lcores[k]) != socket)
+                        continue;
+                    if (want-- == 0) {
+                        lcore = fwd_lcores[k];
+                        break;
+                    }
+                }
+            } else {
+                next_any++;
             }
-            printf("[lcore %u] totals: rx=%"PRIu64" tx=%"PRIu64" drop=%"PRIu64"\n",
-                   rte_lcore_id(), rx_sum, tx_sum, drop_sum);
-            last_tsc = rte_get_tsc_cycles();
+
+            lcore_params[nb_lcore_params].port_id = ports[i];
+            lcore_params[nb_lcore_params].queue_id = q;
+            lcore_params[nb_lcore_params].lcore_id = (uint16_t)lcore;
+            lcore_params[nb_lcore_params].weight = 1;
+            nb_lcore_params++;
+        }
+    }
+}
+
+/*
+ * Turn lcore_params[] into lcore_conf[], derive the RX queue count of each
+ * port and give every forwarding lcore its own TX queue index.
+ * Returns the number of TX queues each port needs, or -1 on a bad mapping.
+ */
+static int
+init_lcore_conf(const uint16_t *ports, uint16_t nb_ports, uint16_t *nb_rxq)
+{
+    bool port_enabled[RTE_MAX_ETHPORTS] = { false };
+    uint16_t nb_txq = 0;
+
+    for (uint16_t i = 0; i < nb_ports; i++) {
+        port_enabled[ports[i]] = true;
+        nb_rxq[ports[i]] = 0;
+    }
+
+    for (uint16_t i = 0; i < nb_lcore_params; i++) {
+        const struct lcore_params *lp = &lcore_params[i];
+        struct lcore_conf *conf = &lcore_conf[lp->lcore_id];
+
+        if (!port_enabled[lp->port_id]) {
+            fprintf(stderr, "--config: port %u is not enabled\n", lp->port_id);
+            return -1;
+        }
+        if (!rte_lcore_is_enabled(lp->lcore_id)) {
+            fprintf(stderr, "--config: lcore %u is not enabled\n", lp->lcore_id);
+            return -1;
+        }
+        if (conf->n_rx_queue >= MAX_RX_QUEUE_PER_LCORE) {
+            fprintf(stderr, "--config: lcore %u has more than %d queues\n",
+                    lp->lcore_id, MAX_RX_QUEUE_PER_LCORE);
+            return -1;
+        }
+        /* an RX queue is not thread-safe: exactly one lcore may poll it */
+        for (uint16_t k = 0; k < i; k++) {
+            if (lcore_params[k].port_id == lp->port_id &&
+                lcore_params[k].queue_id == lp->queue_id) {
+                fprintf(stderr, "--config: port %u queue %u is listed twice (lcores %u and %u)\n",
+                        lp->port_id, lp->queue_id, lcore_params[k].lcore_id, lp->lcore_id);
+                return -1;
+            }
+        }
+        if (conf->n_rx_queue == 0)
+            conf->tx_queue = nb_txq++;
+
+        struct lcore_rx_queue *rxq = &conf->rx_queue_list[conf->n_rx_queue++];
+        rxq->port_id = lp->port_id;
+        rxq->queue_id = lp->queue_id;
+        rxq->tx_port = tx_port_map[lp->port_id];
+        rxq->weight = lp->weight;
+
+        bool known = false;
+        for (uint16_t k = 0; k < conf->n_tx_port && !known; k++)
+            known = conf->tx_port_list[k] == rxq->tx_port;
+        if (!known)
+            conf->tx_port_list[conf->n_tx_port++] = rxq->tx_port;
+
+        if (lp->queue_id + 1 > nb_rxq[lp->port_id])
+            nb_rxq[lp->port_id] = lp->queue_id + 1;
+    }
+
+    /* report RX queues the topology (or --config) makes poll from another socket */
+    uint16_t nb_remote = 0;
+    for (uint16_t i = 0; i < nb_lcore_params; i++)
+        nb_remote += numa_check_lcore(lcore_params[i].lcore_id, lcore_params[i].port_id);
+    if (nb_remote > 0)
+        printf("Warning: %u of %u RX queues are polled from a remote socket\n",
+               nb_remote, nb_lcore_params);
+
+    /* RSS spreads over queues 0..nb_rxq-1: every one of them needs a poller */
+    for (uint16_t i = 0; i < nb_ports; i++) {
+        uint16_t port = ports[i];
+        if (nb_rxq[port] == 0)
+            nb_rxq[port] = 1;
+        for (uint16_t q = 0; q < nb_rxq[port]; q++) {
+            bool polled = false;
+            for (uint16_t k = 0; k < nb_lcore_params && !polled; k++)
+                polled = lcore_params[k].port_id == port && lcore_params[k].queue_id == q;
+            if (!polled)
+                printf("Warning: port %u queue %u has no lcore to poll it\n", port, q);
         }
     }
 
+    return nb_txq;
+}
+
+/* one TX buffer per (forwarding lcore, TX port), on the lcore's socket */
+static int
+init_tx_buffers(void)
+{
+    unsigned lcore_id;
+
+    RTE_LCORE_FOREACH(lcore_id) {
+        struct lcore_conf *conf = &lcore_conf[lcore_id];
+        int socket = (int)rte_lcore_to_socket_id(lcore_id);
+
+        for (uint16_t i = 0; i < conf->n_tx_port; i++) {
+            uint16_t port = conf->tx_port_list[i];
+            struct lcore_tx_buf *tb = rte_zmalloc_socket("tx_buf", sizeof(*tb),
+                                                         RTE_CACHE_LINE_SIZE, socket);
+            if (tb == NULL)
+                return -1;
+            tb->buf = rte_zmalloc_socket("tx_buffer", RTE_ETH_TX_BUFFER_SIZE(tx_flush_thresh),
+                                         RTE_CACHE_LINE_SIZE, socket);
+            if (tb->buf == NULL)
+                return -1;
+            tb->port_id = port;
+            tb->queue_id = conf->tx_queue;
+            tb->st = &stats[lcore_id];
+            rte_eth_tx_buffer_init(tb->buf, tx_flush_thresh);
+            if (rte_eth_tx_buffer_set_err_callback(tb->buf, tx_buffer_retry_cb, tb) != 0)
+                return -1;
+            conf->tx_buf[port] = tb;
+        }
+    }
     return 0;
 }
 
@@ -213,64 +1247,132 @@ main(int argc, char **argv)
     argc -= ret;
     argv += ret;
 
+    if (parse_args(argc, argv) != 0)
+        return -1;
+
+    if (bench_rounds > 0)
+        return run_bench();
+
     signal(SIGINT, sig_handler);
     signal(SIGTERM, sig_handler);
 
-    uint16_t nb_ports = rte_eth_dev_count_avail();
+    if (latency_enabled && latency_init() != 0)
+        return -1;
+
+    /* collect enabled ports */
+    uint16_t ports[RTE_MAX_ETHPORTS];
+    uint16_t nb_ports = 0;
+    uint16_t port_id;
+    RTE_ETH_FOREACH_DEV(port_id) {
+        if (enabled_port_mask != 0 &&
+            (port_id >= 32 || (enabled_port_mask & (1u << port_id)) == 0))
+            continue;
+        ports[nb_ports++] = port_id;
+    }
     if (nb_ports == 0) {
         fprintf(stderr, "No ports available\n");
         return -1;
     }
+    build_tx_port_map(ports, nb_ports);
 
-    /* create mbuf pool */
-    mbuf_pool = rte_pktmbuf_pool_create("MBUF_POOL", NUM_MBUFS, MBUF_CACHE_SZ, 0,
-                                        RTE_MBUF_DEFAULT_BUF_SIZE, rte_socket_id());
-    if (mbuf_pool == NULL) {
-        fprintf(stderr, "Cannot create mbuf pool\n");
-        return -1;
+    /* forwarding lcores: every worker, or the main lcore when there are none */
+    unsigned fwd_lcores[RTE_MAX_LCORE];
+    unsigned nb_fwd_lcores = 0;
+    unsigned lcore_id;
+    RTE_LCORE_FOREACH_WORKER(lcore_id) {
+        fwd_lcores[nb_fwd_lcores++] = lcore_id;
     }
+    if (nb_fwd_lcores == 0)
+        fwd_lcores[nb_fwd_lcores++] = rte_lcore_id();
 
-    /* allocate stats array sized for MAX_QUEUES */
-    stats = rte_zmalloc("stats", sizeof(struct pq_stats) * MAX_QUEUES, RTE_CACHE_LINE_SIZE);
+    if (nb_lcore_params == 0)
+        build_default_lcore_params(ports, nb_ports, fwd_lcores, nb_fwd_lcores);
+
+
+    /* one cache-line-aligned stats block per lcore */
+    stats = rte_zmalloc("stats", sizeof(struct lcore_stats) * RTE_MAX_LCORE,
+                        RTE_CACHE_LINE_SIZE);
     if (!stats) {
         fprintf(stderr, "Failed to allocate stats\n");
         return -1;
     }
 
-    /* init first port with MAX_QUEUES rx/tx */
-    uint16_t port_id = 0;
-    if (port_init(port_id, MAX_QUEUES, MAX_QUEUES) != 0) {
-        fprintf(stderr, "port_init failed\n");
+    /* one TX queue per forwarding lcore on every port, so TX needs no locking */
+    uint16_t nb_rxq[RTE_MAX_ETHPORTS];
+    int nb_txq = init_lcore_conf(ports, nb_ports, nb_rxq);
+    if (nb_txq <= 0)
+        return -1;
+
+    if (init_tx_buffers() != 0) {
+        fprintf(stderr, "Failed to allocate TX buffers\n");
         return -1;
     }
 
-    /* Launch one worker per RX queue (assign to slave lcores) */
-    unsigned q = 0;
-    unsigned lcore_id;
-    RTE_LCORE_FOREACH_WORKER(lcore_id) {
-        if (q >= MAX_QUEUES) break;
-        printf("Launching lcore %u for queue %u\n", lcore_id, q);
-        rte_eal_remote_launch(lcore_forward, (void *)(uintptr_t)q, lcore_id);
-        q++;
-    }
-
-    /* If fewer slave lcores than queues, use master core(s) as well */
-    if (q < MAX_QUEUES) {
-        /* use master as needed */
-        unsigned master = rte_lcore_id();
-        for (; q < MAX_QUEUES; q++) {
-            printf("Launching master for queue %u (fallback)\n", q);
-            lcore_forward((void *)(uintptr_t)q);
+    /*
+     * one mbuf pool per socket that has ports, sized for the rings of the
+     * ports on it. Any lcore may free into it, and each one holds a burst
+     * plus a TX buffer towards every port outside the rings.
+     */
+    struct pool_size_req req[RTE_MAX_NUMA_NODES];
+    memset(req, 0, sizeof(req));
+    for (uint16_t i = 0; i < nb_ports; i++) {
+        struct pool_size_req *r = &req[numa_port_socket(ports[i])];
+        r->nb_rxq += nb_rxq[ports[i]];
+        r->rx_desc = RX_RING_SIZE;
+        r->nb_txq += (unsigned)nb_txq;
+        r->tx_desc = TX_RING_SIZE;
+        r->nb_lcores = rte_lcore_count();
+        r->cache = MBUF_CACHE_SZ;
+        r->burst = BURST_SIZE;
+        r->depth = 1 + nb_ports * ((tx_flush_thresh + BURST_SIZE - 1) / BURST_SIZE);
+    }
+    for (int socket = 0; socket < RTE_MAX_NUMA_NODES; socket++) {
+        if (req[socket].nb_rxq == 0)
+            continue;
+        unsigned n = pool_size_calc(&req[socket]);
+        struct rte_mempool *mp = numa_pool_get("MBUF_POOL", socket, n, MBUF_CACHE_SZ);
+        if (mp == NULL) {
+            fprintf(stderr, "Cannot create mbuf pool on socket %d\n", socket);
+            return -1;
         }
+        pool_size_report(mp->name, &req[socket], n, RTE_MBUF_DEFAULT_BUF_SIZE);
+        pool_watch_init(&pool_watch[nb_pool_watch++], mp);
+    }
+
+    for (uint16_t i = 0; i < nb_ports; i++) {
+        struct rte_mempool *mp = numa_pool_get("MBUF_POOL", numa_port_socket(ports[i]), 0, 0);
+        if (port_init(ports[i], nb_rxq[ports[i]], (uint16_t)nb_txq, mp) != 0) {
+            fprintf(stderr, "port_init failed for port %u\n", ports[i]);
+            return -1;
+        }
+    }
+
+    if (latency_enabled && latency_attach(ports, nb_ports, (uint16_t)nb_txq) != 0)
+        return -1;
+
+    /* launch workers; the main lcore forwards too if it was given queues */
+    RTE_LCORE_FOREACH_WORKER(lcore_id) {
+        if (lcore_conf[lcore_id].n_rx_queue == 0)
+            continue;
+        rte_eal_remote_launch(lcore_forward, NULL, lcore_id);
+    }
+    if (lcore_conf[rte_lcore_id()].n_rx_queue > 0) {
+        printf("Main lcore is forwarding: periodic stats disabled\n");
+        lcore_forward(NULL);
+    } else {
+        stats_reader_loop();
     }
 
     /* wait for workers */
     rte_eal_mp_wait_lcore();
+    print_final_stats();
 
     /* cleanup */
-    printf("Stopping port %u\n", port_id);
-    rte_eth_dev_stop(port_id);
-    rte_eth_dev_close(port_id);
+    for (uint16_t i = 0; i < nb_ports; i++) {
+        printf("Stopping port %u\n", ports[i]);
+        rte_eth_dev_stop(ports[i]);
+        rte_eth_dev_close(ports[i]);
+    }
 
     printf("Bye\n");
     return 0;
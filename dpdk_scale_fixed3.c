@@ -1,6 +1,10 @@
 // dpdk_scale_demo_perport.c
 // DPDK ScaleMate Demo (single-file, per-port RX workers)
 // RX-only traffic now correctly counted on all ports
+// Busy column = RX lcore poll-loop busy cycles (poll_stats_shm.h), not /proc/stat
+// Per-queue pps/bytes/errors from xstats (IDs resolved once), RSS skew per port
+// --autoscale: per port, SCALE-UP/OUT grows the RX queue/lcore set, idle shrinks it (autoscale.h)
+// --headless: no ncurses, metrics served on the DPDK telemetry socket (/scalemate/ports)
 #define _POSIX_C_SOURCE 200809L
 #include <stdio.h>
 #include <stdlib.h>
@@ -18,18 +22,29 @@
 #include <rte_launch.h>
 #include <rte_lcore.h>
 
+#include "autoscale.h"
+#include "buf_util.h"
+#include "numa_util.h"
+#include "pool_size.h"
+#include "poll_stats_shm.h"
+#include "queue_xstats.h"
+#include "scalemate_export.h"
+
 //
 // CONFIG
 //
 #define LINK_CAPACITY_GBPS 100.0
 #define INTERVAL_MS 1000
+#define MIN_INTERVAL_MS 100
 
-#define DEMO_CPU_THRESH 0.20
+#define DEMO_BUSY_THRESH 0.20
 #define DEMO_RING_FILL  0.10
 #define DEMO_DROP_RATIO 0.001
 #define DEMO_RX_UTIL    0.30
+#define DEMO_IDLE_BUSY  0.05 // autoscale: shrink below this busy ratio with no drops
 
-#define NUM_MBUFS 8192
+#define RX_DESC 1024
+#define TX_DESC 1024
 #define MBUF_CACHE_SIZE 256
 #define BURST_SIZE 32
 
@@ -40,6 +55,10 @@
 
 static bool opt_verbose = false;
 static bool opt_color = true;
+static uint16_t opt_rxq = 1; // --rxq N: RX queues (RSS) per port
+static bool opt_headless = false; // --headless: telemetry only, no ncurses
+static unsigned opt_interval_ms = INTERVAL_MS; // --interval-ms N
+static bool opt_autoscale = false; // --autoscale: act on the decisions
 static volatile sig_atomic_t stop_requested = 0;
 static void handle_sigint(int _) { (void)_; stop_requested = 1; }
 
@@ -48,47 +67,21 @@ static double now_s(void) {
     return ts.tv_sec + ts.tv_nsec*1e-9;
 }
 
-// CPU util from /proc/stat
-static double get_cpu_util_percent(void)
-{
-    static unsigned long long prev_total=0, prev_idle=0;
-    FILE *f = fopen("/proc/stat","r"); if (!f) return 0.0;
-    char line[512]; if (!fgets(line,sizeof(line),f)) { fclose(f); return 0.0; }
-    fclose(f);
-
-    unsigned long long user=0,nice=0,systemv=0,idle=0,iowait=0,irq=0,softirq=0,steal=0;
-    sscanf(line,"cpu  %llu %llu %llu %llu %llu %llu %llu %llu",
-           &user,&nice,&systemv,&idle,&iowait,&irq,&softirq,&steal);
-
-    unsigned long long idle_all = idle+iowait;
-    unsigned long long non_idle = user+nice+systemv+irq+softirq+steal;
-    unsigned long long total = idle_all+non_idle;
-
-    unsigned long long diff_total = total-prev_total;
-    unsigned long long diff_idle  = idle_all-prev_idle;
-    prev_total = total; prev_idle = idle_all;
-
-    if (diff_total==0) return 0.0;
-    double util = 1.0 - ((double)diff_idle/(double)diff_total);
-    if(util<0) util=0; if(util>1) util=1;
-    return util;
-}
-
 typedef enum { DECISION_STABLE=0, DECISION_SCALE_UP, DECISION_SCALE_OUT } decision_t;
 
-static decision_t decide_demo(double rx_util,double cpu_util,double ring_fill,double drop_ratio,char *reason,size_t rlen)
+static decision_t decide_demo(double rx_util,double busy_util,double ring_fill,double drop_ratio,char *reason,size_t rlen)
 {
-    if(cpu_util>DEMO_CPU_THRESH || ring_fill>DEMO_RING_FILL || drop_ratio>DEMO_DROP_RATIO) {
-        snprintf(reason,rlen,"Scale-Up: cpu=%.0f%% ring=%.1f%% drops=%.4f",
-                 cpu_util*100.0, ring_fill*100.0, drop_ratio);
+    if(busy_util>DEMO_BUSY_THRESH || ring_fill>DEMO_RING_FILL || drop_ratio>DEMO_DROP_RATIO) {
+        snprintf(reason,rlen,"Scale-Up: busy=%.0f%% ring=%.1f%% drops=%.4f",
+                 busy_util*100.0, ring_fill*100.0, drop_ratio);
         return DECISION_SCALE_UP;
     }
-    if(rx_util>DEMO_RX_UTIL && cpu_util>DEMO_CPU_THRESH) {
-        snprintf(reason,rlen,"Scale-Out: rx=%.1f%% cpu=%.0f%%",rx_util*100.0,cpu_util*100.0);
+    if(rx_util>DEMO_RX_UTIL && busy_util>DEMO_BUSY_THRESH) {
+        snprintf(reason,rlen,"Scale-Out: rx=%.1f%% busy=%.0f%%",rx_util*100.0,busy_util*100.0);
         return DECISION_SCALE_OUT;
     }
-    snprintf(reason,rlen,"Stable: rx=%.1f%% cpu=%.0f%% ring=%.1f%% drops=%.4f",
-             rx_util*100.0,cpu_util*100.0,ring_fill*100.0,drop_ratio);
+    snprintf(reason,rlen,"Stable: rx=%.1f%% busy=%.0f%% ring=%.1f%% drops=%.4f",
+             rx_util*100.0,busy_util*100.0,ring_fill*100.0,drop_ratio);
     return DECISION_STABLE;
 }
 
@@ -99,7 +92,27 @@ static void ui_init(void) { initscr(); cbreak(); noecho(); curs_set(FALSE);
         init_pair(CLR_CYAN,COLOR_CYAN,COLOR_BLACK); } }
 static void ui_shutdown(void) { endwin(); }
 
-static struct rte_mempool *global_mbuf_pool = NULL;
+// per-queue rows under the port table (qx already sampled); returns next free row
+static int draw_queue_rows(int row, const struct queue_xstats *qx, double dt)
+{
+    double total_pps=0.0;
+    double skew=queue_xstats_skew(qx,dt,&total_pps);
+    bool imbalance=skew>QX_SKEW_WARN && total_pps>QX_SKEW_MIN_PPS;
+
+    if(imbalance && opt_color && has_colors()) attron(COLOR_PAIR(CLR_RED));
+    mvprintw(row++,0,"Port %u queues: skew=%.2f %-16s",(unsigned)qx->port,skew,imbalance?"RSS IMBALANCE":"");
+    if(imbalance && opt_color && has_colors()) attroff(COLOR_PAIR(CLR_RED));
+    for(uint16_t q=0;q<qx->nb_q;q++){
+        double pps=queue_xstats_rate(qx,q,QX_RX_PKTS,dt), bps=queue_xstats_rate(qx,q,QX_RX_BYTES,dt)*8.0;
+        double errs=queue_xstats_rate(qx,q,QX_RX_ERRORS,dt), missed=queue_xstats_rate(qx,q,QX_RX_MISSED,dt);
+        mvprintw(row++,0,"  q%-2u rx=%9.0f pps %9.0fk bps  err=%7.0f/s  missed=%7.0f/s",(unsigned)q,
+                 pps<0?0:pps, bps<0?0:bps/1000.0, errs<0?0:errs, missed<0?0:missed);
+    }
+    return row;
+}
+
+// RX worker poll instrumentation, one memzone slot per worker lcore
+static struct poll_stats_shm *poll_shm = NULL;
 
 // RX worker arg
 struct rx_arg { uint16_t port; };
@@ -110,24 +123,53 @@ static int rx_worker_main(void *arg)
     struct rx_arg *a = (struct rx_arg*)arg;
     uint16_t port = a->port;
     struct rte_mbuf *pkts[BURST_SIZE];
+    struct poll_stats *ps=poll_stats_shm_attach(poll_shm,port,0);
+    uint64_t t=poll_stats_cycles();
 
+    uint16_t q=0;
     while(!stop_requested){
-        uint16_t nb = rte_eth_rx_burst(port,0,pkts,BURST_SIZE);
+        uint16_t nb = rte_eth_rx_burst(port,q,pkts,BURST_SIZE);
+        if(++q==opt_rxq) q=0; // round-robin over the port's RX queues
         for(uint16_t i=0;i<nb;i++) rte_pktmbuf_free(pkts[i]);
         if(nb==0) rte_pause();
+        t=poll_stats_record(ps,nb,t);
     }
+    poll_stats_shm_detach(poll_shm);
     return 0;
 }
 
-// init single port
-static int port_init(uint16_t port, struct rte_mempool *mbuf_pool)
+// autoscale worker: one queue per lcore, exits once stopped and drained
+static int rx_queue_worker(void *arg)
+{
+    struct as_worker *w=arg;
+    struct rte_mbuf *pkts[BURST_SIZE];
+    struct poll_stats *ps=poll_stats_shm_attach(poll_shm,w->port,w->queue);
+    uint64_t t=poll_stats_cycles();
+    while(!stop_requested){
+        uint16_t nb=rte_eth_rx_burst(w->port,w->queue,pkts,BURST_SIZE);
+        for(uint16_t i=0;i<nb;i++) rte_pktmbuf_free(pkts[i]);
+        if(nb==0){ if(!w->run) break; rte_pause(); }
+        t=poll_stats_record(ps,nb,t);
+    }
+    poll_stats_shm_detach(poll_shm);
+    return 0;
+}
+
+// init single port, RSS over rx_rings queues when >1
+static int port_init(uint16_t port, struct rte_mempool *mbuf_pool, uint16_t rx_rings)
 {
     int ret;
     struct rte_eth_conf port_conf = {0};
-    const uint16_t rx_rings=1, tx_rings=1;
-    const uint16_t rx_size=1024, tx_size=1024;
+    const uint16_t tx_rings=1;
+    const uint16_t rx_size=RX_DESC, tx_size=TX_DESC;
 
     if(!rte_eth_dev_is_valid_port(port)) { fprintf(stderr,"Invalid port %u\n",port); return -1; }
+    if(rx_rings>1){
+        struct rte_eth_dev_info dev_info;
+        ret=rte_eth_dev_info_get(port,&dev_info); if(ret!=0){ fprintf(stderr,"rte_eth_dev_info_get failed\n"); return ret; }
+        port_conf.rxmode.mq_mode=RTE_ETH_MQ_RX_RSS;
+        port_conf.rx_adv_conf.rss_conf.rss_hf=(RTE_ETH_RSS_IP|RTE_ETH_RSS_TCP|RTE_ETH_RSS_UDP)&dev_info.flow_type_rss_offloads;
+    }
     ret=rte_eth_dev_configure(port,rx_rings,tx_rings,&port_conf); if(ret<0){ fprintf(stderr,"rte_eth_dev_configure failed\n"); return ret; }
 
     for(uint16_t q=0;q<rx_rings;q++){
@@ -152,6 +194,18 @@ int main(int argc,char **argv)
     for(int i=1;i<argc;i++){
         if(strcmp(argv[i],"--verbose")==0) opt_verbose=true;
         if(strcmp(argv[i],"--no-color")==0) opt_color=false;
+        if(strcmp(argv[i],"--rxq")==0 && i+1<argc){
+            int n=atoi(argv[++i]);
+            if(n<1 || n>QX_MAX_QUEUES){ fprintf(stderr,"--rxq must be 1..%d\n",QX_MAX_QUEUES); return 1; }
+            opt_rxq=(uint16_t)n;
+        }
+        if(strcmp(argv[i],"--headless")==0) opt_headless=true;
+        if(strcmp(argv[i],"--autoscale")==0) opt_autoscale=true;
+        if(strcmp(argv[i],"--interval-ms")==0 && i+1<argc){
+            int n=atoi(argv[++i]);
+            if(n<MIN_INTERVAL_MS){ fprintf(stderr,"--interval-ms must be >= %d\n",MIN_INTERVAL_MS); return 1; }
+            opt_interval_ms=(unsigned)n;
+        }
     }
     signal(SIGINT,handle_sigint);
 
@@ -159,23 +213,50 @@ int main(int argc,char **argv)
 
     uint16_t nb_ports=rte_eth_dev_count_avail();
     if(nb_ports==0){ fprintf(stderr,"No DPDK ports found\n"); return 1; }
+    if(sm_export_init("dpdk_scale_fixed3")!=0){
+        fprintf(stderr,"Failed to register telemetry commands\n"); if(opt_headless) return 1;
+    }
 
-    // mbuf pool
+    // one mbuf pool per socket, each port's RX queues fill from the local one,
+    // sized (pool_size_calc) for the rings of the ports on that socket
     char pool_name[32]; snprintf(pool_name,sizeof(pool_name),"MBUF_POOL_%d",getpid());
-    global_mbuf_pool=rte_pktmbuf_pool_create(pool_name,NUM_MBUFS*nb_ports,MBUF_CACHE_SIZE,0,RTE_MBUF_DEFAULT_BUF_SIZE,rte_socket_id());
-    if(!global_mbuf_pool){ fprintf(stderr,"Failed to create mbuf pool\n"); return 1; }
+    struct pool_size_req req[RTE_MAX_NUMA_NODES];
+    memset(req,0,sizeof(req));
+    for(uint16_t p=0;p<nb_ports;p++){
+        struct pool_size_req *r=&req[numa_port_socket(p)];
+        r->nb_rxq+=opt_rxq; r->rx_desc=RX_DESC; r->nb_txq+=1; r->tx_desc=TX_DESC;
+        r->nb_lcores=rte_lcore_count(); r->cache=MBUF_CACHE_SIZE; r->burst=BURST_SIZE; r->depth=1;
+    }
 
     // init ports
     for(uint16_t p=0;p<nb_ports;p++){
-        if(port_init(p,global_mbuf_pool)!=0){ fprintf(stderr,"Port %u init failed\n",p); return 1; }
+        int s=numa_port_socket(p);
+        unsigned n=pool_size_calc(&req[s]);
+        bool created=numa_pools[s]==NULL;
+        struct rte_mempool *mp=numa_pool_get(pool_name,s,n,MBUF_CACHE_SIZE);
+        if(!mp){ fprintf(stderr,"Failed to create mbuf pool on socket %d\n",s); return 1; }
+        if(created && opt_verbose) pool_size_report(mp->name,&req[s],n,RTE_MBUF_DEFAULT_BUF_SIZE);
+        if(port_init(p,mp,opt_rxq)!=0){ fprintf(stderr,"Port %u init failed\n",p); return 1; }
     }
 
-    // launch RX worker per port
+    // poll-loop busy counters, published for this and any secondary monitor
+    poll_shm=poll_stats_shm_create();
+    struct poll_stats *poll_cur=calloc(RTE_MAX_LCORE,sizeof(struct poll_stats));
+    struct poll_stats *poll_prev=calloc(RTE_MAX_LCORE,sizeof(struct poll_stats));
+    if(!poll_shm || !poll_cur || !poll_prev){ fprintf(stderr,"Failed to set up poll stats memzone\n"); return 1; }
+
+    // launch RX worker per port, each on its own worker lcore
+    // (autoscale: one per queue, started at one queue per port)
     struct rx_arg args[RTE_MAX_ETHPORTS];
-    for(uint16_t p=0;p<nb_ports;p++){
+    static struct autoscale as[RTE_MAX_ETHPORTS];
+    for(uint16_t p=0;p<nb_ports && opt_autoscale;p++){
+        if(autoscale_init(&as[p],p,1,opt_rxq,rx_queue_worker)!=0){ fprintf(stderr,"Autoscale init failed on port %u\n",p); return 1; }
+    }
+    for(uint16_t p=0;p<nb_ports && !opt_autoscale;p++){
         args[p].port=p;
-        unsigned lcore=rte_get_next_lcore(rte_lcore_id(),1,0);
-        if(lcore==RTE_MAX_LCORE){ printf("No lcore for port %u RX\n",p); break; }
+        unsigned lcore=numa_pick_lcore(numa_port_socket(p),NULL); // local to the port if possible
+        if(lcore>=RTE_MAX_LCORE){ printf("No lcore for port %u RX\n",p); break; }
+        numa_check_lcore(lcore,p);
         rte_eal_remote_launch(rx_worker_main,&args[p],lcore);
     }
 
@@ -187,19 +268,42 @@ int main(int argc,char **argv)
     uint64_t *prev_imissed=calloc(nb_ports,sizeof(uint64_t));
     uint64_t *prev_errors=calloc(nb_ports,sizeof(uint64_t));
 
+    // per-queue xstats: names -> IDs once, then fetch by ID each tick
+    struct queue_xstats *qx=calloc(nb_ports,sizeof(struct queue_xstats));
+    if(!qx){ fprintf(stderr,"Allocation failed\n"); return 1; }
+    for(uint16_t p=0;p<nb_ports;p++)
+        if(queue_xstats_init(&qx[p],p)<=0 && opt_verbose) printf("Port %u: no per-queue xstats\n",p);
+
+    // per-port metrics for the telemetry exporter
+    struct sm_port_metrics *metrics=calloc(nb_ports,sizeof(struct sm_port_metrics));
+    if(!metrics){ fprintf(stderr,"Allocation failed\n"); return 1; }
+
     double last_time=now_s();
-    ui_init();
-    mvprintw(0,0,"DPDK ScaleMate Demo (Per-Port RX) Ports=%u Interval=%dms",nb_ports,INTERVAL_MS);
-    mvprintw(1,0,"Thresholds: SCALE-UP cpu>20%% or ring>10%% or drops>0.1%% | SCALE-OUT rx>30%% & cpu>20%%");
-    mvprintw(3,0,"+------+---------+---------+---------+--------+-------+-------------------------+");
-    mvprintw(4,0,"| Port | Rx-pps  | Tx-pps  | Rx-bps  | Drop%  |  CPU  | Decision / Reason       |");
-    mvprintw(5,0,"+------+---------+---------+---------+--------+-------+-------------------------+");
+    if(opt_headless){
+        printf("Headless: ports=%u interval=%ums, query /scalemate/ports on the DPDK telemetry socket\n",nb_ports,opt_interval_ms);
+        fflush(stdout);
+    } else {
+        ui_init();
+        mvprintw(0,0,"DPDK ScaleMate Demo (Per-Port RX) Ports=%u Interval=%ums",nb_ports,opt_interval_ms);
+        mvprintw(1,0,"Thresholds: SCALE-UP busy>20%% or ring>10%% or drops>0.1%% | SCALE-OUT rx>30%% & busy>20%%");
+        mvprintw(3,0,"+------+---------+---------+---------+--------+-------+-------------------------+");
+        mvprintw(4,0,"| Port | Rx-pps  | Tx-pps  | Rx-bps  | Drop%  | Busy  | Decision / Reason       |");
+        mvprintw(5,0,"+------+---------+---------+---------+--------+-------+-------------------------+");
+    }
 
     while(!stop_requested){
         double t0=now_s();
+        poll_stats_shm_sample(poll_shm,poll_cur); // one busy sample for all ports
+        int qrow=9+nb_ports;
         for(uint16_t p=0;p<nb_ports;p++){
+            struct sm_port_metrics *m=&metrics[p];
+            memset(m,0,sizeof(*m)); m->port=p; m->busy=m->score=-1.0; m->skew=1.0;
             struct rte_eth_stats st;
-            if(rte_eth_stats_get(p,&st)!=0){ mvprintw(7+p,0,"| %3u  | stat read error |",(unsigned)p); continue; }
+            if(rte_eth_stats_get(p,&st)!=0){
+                snprintf(m->decision,sizeof(m->decision),"error"); snprintf(m->reason,sizeof(m->reason),"stat read error");
+                if(!opt_headless) mvprintw(7+p,0,"| %3u  | stat read error |",(unsigned)p);
+                continue;
+            }
 
             uint64_t d_ipackets=(st.ipackets>=prev_ipackets[p])?st.ipackets-prev_ipackets[p]:st.ipackets;
             uint64_t d_opackets=(st.opackets>=prev_opackets[p])?st.opackets-prev_opackets[p]:st.opackets;
@@ -208,7 +312,7 @@ int main(int argc,char **argv)
             uint64_t d_imissed =(st.imissed >=prev_imissed[p]) ?st.imissed-prev_imissed[p] :st.imissed;
             uint64_t d_errors  =((st.ierrors+st.oerrors)>=prev_errors[p]) ? (st.ierrors+st.oerrors-prev_errors[p]) : (st.ierrors+st.oerrors);
 
-            double dt=now_s()-last_time; if(dt<=0) dt=INTERVAL_MS/1000.0;
+            double dt=now_s()-last_time; if(dt<=0) dt=opt_interval_ms/1000.0;
 
             double rx_pps=d_ipackets/dt;
             double tx_pps=d_opackets/dt;
@@ -221,20 +325,38 @@ int main(int argc,char **argv)
             double drop_ratio=0.0; uint64_t total_seen=d_ipackets+d_imissed;
             if(total_seen>0) drop_ratio=(double)d_imissed/(double)total_seen;
 
-            double ring_fill=0.0; uint64_t denom=st.ipackets+st.imissed+1;
-            if(denom>0) ring_fill=(double)st.imissed/(double)denom;
+            // ring_fill: fullest of RX mempool, RX and TX descriptor rings right now
+            struct buf_util bu; buf_util_port(p,&bu);
+            double ring_fill=buf_util_max(&bu);
 
-            double cpu_util=get_cpu_util_percent();
+            double busy=poll_stats_shm_port_busy(poll_shm,poll_cur,poll_prev,p);
+            double busy_util=(busy<0)?0.0:busy; // -1: no RX worker on this port
             char reason[128];
-            decision_t dec=decide_demo(rx_util,cpu_util,ring_fill,drop_ratio,reason,sizeof(reason));
+            decision_t dec=decide_demo(rx_util,busy_util,ring_fill,drop_ratio,reason,sizeof(reason));
 
             int color=CLR_GREEN; const char *dec_text="Stable";
             if(dec==DECISION_SCALE_UP){dec_text="SCALE-UP"; color=CLR_YELLOW;}
             if(dec==DECISION_SCALE_OUT){dec_text="SCALE-OUT"; color=CLR_RED;}
-            if(opt_color && has_colors()) attron(COLOR_PAIR(color));
-            mvprintw(7+p,0,"| %4u | %7.0f | %7.0f | %7.0fk | %6.3f | %5.1f%% | %-23s |",
-                     (unsigned)p,rx_pps,tx_pps,rx_bps/1000.0,drop_ratio*100.0,cpu_util*100.0,reason);
-            if(opt_color && has_colors()) attroff(COLOR_PAIR(color));
+            if(opt_autoscale){
+                // SCALE-UP and SCALE-OUT both add a queue/lcore on this host
+                int want=(dec!=DECISION_STABLE)?1:(busy_util<DEMO_IDLE_BUSY && drop_ratio==0.0)?-1:0;
+                autoscale_step(&as[p],want);
+            }
+            bool qx_ok=queue_xstats_sample(&qx[p])==0;
+
+            m->valid=1; m->rx_pps=rx_pps; m->tx_pps=tx_pps; m->rx_bps=rx_bps; m->tx_bps=tx_bps;
+            m->rx_util=rx_util; m->drop_ratio=drop_ratio; m->busy=busy; m->buf_fill=ring_fill;
+            if(qx_ok) m->skew=queue_xstats_skew(&qx[p],dt,NULL);
+            snprintf(m->decision,sizeof(m->decision),"%s",dec_text);
+            snprintf(m->reason,sizeof(m->reason),"%s",reason);
+
+            if(!opt_headless){
+                if(opt_color && has_colors()) attron(COLOR_PAIR(color));
+                mvprintw(7+p,0,"| %4u | %7.0f | %7.0f | %7.0fk | %6.3f | %5.1f%% | %-23s |",
+                         (unsigned)p,rx_pps,tx_pps,rx_bps/1000.0,drop_ratio*100.0,busy_util*100.0,reason);
+                if(opt_color && has_colors()) attroff(COLOR_PAIR(color));
+                if(qx_ok) qrow=draw_queue_rows(qrow,&qx[p],dt);
+            }
 
             prev_ipackets[p]=st.ipackets;
             prev_opackets[p]=st.opackets;
@@ -243,17 +365,28 @@ int main(int argc,char **argv)
             prev_imissed[p]=st.imissed;
             prev_errors[p]=st.ierrors+st.oerrors;
         }
-        int last_row=7+nb_ports;
-        mvprintw(last_row,0,"+------+---------+---------+---------+--------+-------+-------------------------+");
-        refresh();
-        double elapsed=now_s()-t0; double to_wait=(INTERVAL_MS/1000.0)-elapsed;
+        memcpy(poll_prev,poll_cur,RTE_MAX_LCORE*sizeof(struct poll_stats));
+        sm_export_publish(metrics,nb_ports);
+        if(!opt_headless){
+            if(opt_autoscale){
+                mvprintw(2,0,"Autoscale queues:");
+                for(uint16_t p=0;p<nb_ports && p<16;p++)
+                    mvprintw(2,17+10*p," p%-2u=%2u/%-2u",(unsigned)p,as[p].active,as[p].max_q);
+            }
+            int last_row=7+nb_ports;
+            mvprintw(last_row,0,"+------+---------+---------+---------+--------+-------+-------------------------+");
+            refresh();
+        }
+        double elapsed=now_s()-t0; double to_wait=(opt_interval_ms/1000.0)-elapsed;
         if(to_wait>0) usleep((useconds_t)(to_wait*1e6));
         last_time=now_s();
     }
 
-    ui_shutdown();
+    for(uint16_t p=0;p<nb_ports && opt_autoscale;p++) autoscale_fini(&as[p]);
+    if(!opt_headless) ui_shutdown();
     free(prev_ipackets); free(prev_opackets); free(prev_ibytes);
     free(prev_obytes); free(prev_imissed); free(prev_errors);
+    free(poll_cur); free(poll_prev); free(qx); free(metrics);
 
     printf("\nExiting cleanly\n");
     return 0;
@@ -1,8 +1,11 @@
 // dpdk_scale_demo.c
 // DPDK ScaleMate Demo (single-file)
 // - DPDK stats via rte_eth_stats_get
-// - CPU util from /proc/stat
-// - ncurses dashboard
+// - RX lcore busy ratio from the poll_stats memzone published by the RX
+//   workers (run with --proc-type=secondary next to dpdk_scalemate_fixed /
+//   dpdk_scale_fixed3); /proc/stat shows a poll-mode core as 100% busy
+// - ncurses dashboard, or --headless: metrics served on the DPDK telemetry
+//   socket (/scalemate/ports; a secondary process gets its own socket path)
 // - Demo LOW thresholds to show Scale-Up and Scale-Out
 
 #define _POSIX_C_SOURCE 200809L
@@ -19,11 +22,16 @@
 #include <rte_eal.h>
 #include <rte_ethdev.h>
 
+#include "buf_util.h"
+#include "poll_stats_shm.h"
+#include "scalemate_export.h"
+
 // ---------------- Config / Demo thresholds ----------------
 #define LINK_CAPACITY_GBPS 100.0   // adjust to your NIC
 #define INTERVAL_MS 1000
+#define MIN_INTERVAL_MS 100
 // Demo (low) thresholds:
-#define DEMO_CPU_THRESH 0.20       // 20%
+#define DEMO_BUSY_THRESH 0.20      // 20% of RX lcore cycles doing useful work
 #define DEMO_RING_FILL  0.10       // 10%
 #define DEMO_DROP_RATIO 0.001      // 0.1%
 #define DEMO_RX_UTIL    0.30       // 30%
@@ -37,6 +45,8 @@
 // CLI options
 static bool opt_verbose = false;
 static bool opt_color = true;
+static bool opt_headless = false;               // --headless: telemetry only, no ncurses
+static unsigned opt_interval_ms = INTERVAL_MS;  // --interval-ms N
 
 // ---------------- Utility: current time in seconds (double) --------------
 static double now_s(void) {
@@ -45,38 +55,6 @@ static double now_s(void) {
     return ts.tv_sec + ts.tv_nsec * 1e-9;
 }
 
-// ---------------- CPU util (from /proc/stat) ----------------
-static double get_cpu_util_percent()
-{
-    static unsigned long long prev_total = 0, prev_idle = 0;
-    FILE *f = fopen("/proc/stat", "r");
-    if (!f) return 0.0;
-    char line[512];
-    if (!fgets(line, sizeof(line), f)) { fclose(f); return 0.0; }
-    fclose(f);
-
-    // parse: cpu  user nice system idle iowait irq softirq steal guest guest_nice
-    unsigned long long user=0, nice=0, systemv=0, idle=0, iowait=0, irq=0, softirq=0, steal=0;
-    sscanf(line, "cpu  %llu %llu %llu %llu %llu %llu %llu %llu",
-           &user, &nice, &systemv, &idle, &iowait, &irq, &softirq, &steal);
-
-    unsigned long long idle_all = idle + iowait;
-    unsigned long long non_idle = user + nice + systemv + irq + softirq + steal;
-    unsigned long long total = idle_all + non_idle;
-
-    unsigned long long diff_total = total - prev_total;
-    unsigned long long diff_idle = idle_all - prev_idle;
-
-    prev_total = total;
-    prev_idle = idle_all;
-
-    if (diff_total == 0) return 0.0;
-    double util = 1.0 - ((double)diff_idle / (double)diff_total);
-    if (util < 0) util = 0;
-    if (util > 1) util = 1;
-    return util; // fraction 0..1
-}
-
 // ---------------- ncurses UI helpers ----------------
 static void ui_init(void) {
     initscr();
@@ -98,22 +76,22 @@ static void ui_shutdown(void) {
 // ---------------- Scale decision (demo thresholds) ----------------
 typedef enum { DECISION_STABLE=0, DECISION_SCALE_UP, DECISION_SCALE_OUT } decision_t;
 
-static decision_t decide_demo(double rx_util, double cpu_util, double ring_fill, double drop_ratio, char *reason, size_t rlen)
+static decision_t decide_demo(double rx_util, double busy_util, double ring_fill, double drop_ratio, char *reason, size_t rlen)
 {
-    // SCALE-UP if CPU > 20% OR ring_fill > 10% OR drops > 0.1%
-    if (cpu_util > DEMO_CPU_THRESH || ring_fill > DEMO_RING_FILL || drop_ratio > DEMO_DROP_RATIO) {
-        snprintf(reason, rlen, "Scale-Up: cpu=%.0f%% ring=%.1f%% drops=%.4f",
-                 cpu_util*100.0, ring_fill*100.0, drop_ratio);
+    // SCALE-UP if busy > 20% OR ring_fill > 10% OR drops > 0.1%
+    if (busy_util > DEMO_BUSY_THRESH || ring_fill > DEMO_RING_FILL || drop_ratio > DEMO_DROP_RATIO) {
+        snprintf(reason, rlen, "Scale-Up: busy=%.0f%% ring=%.1f%% drops=%.4f",
+                 busy_util*100.0, ring_fill*100.0, drop_ratio);
         return DECISION_SCALE_UP;
     }
-    // SCALE-OUT if rx_util>30% AND cpu>20%
-    if (rx_util > DEMO_RX_UTIL && cpu_util > DEMO_CPU_THRESH) {
-        snprintf(reason, rlen, "Scale-Out: rx=%.1f%% cpu=%.0f%%",
-                 rx_util*100.0, cpu_util*100.0);
+    // SCALE-OUT if rx_util>30% AND busy>20%
+    if (rx_util > DEMO_RX_UTIL && busy_util > DEMO_BUSY_THRESH) {
+        snprintf(reason, rlen, "Scale-Out: rx=%.1f%% busy=%.0f%%",
+                 rx_util*100.0, busy_util*100.0);
         return DECISION_SCALE_OUT;
     }
-    snprintf(reason, rlen, "Stable: rx=%.1f%% cpu=%.0f%% ring=%.1f%% drops=%.4f",
-             rx_util*100.0, cpu_util*100.0, ring_fill*100.0, drop_ratio);
+    snprintf(reason, rlen, "Stable: rx=%.1f%% busy=%.0f%% ring=%.1f%% drops=%.4f",
+             rx_util*100.0, busy_util*100.0, ring_fill*100.0, drop_ratio);
     return DECISION_STABLE;
 }
 
@@ -124,6 +102,15 @@ int main(int argc, char **argv)
     for (int i=1;i<argc;i++){
         if (strcmp(argv[i],"--verbose")==0) opt_verbose=true;
         if (strcmp(argv[i],"--no-color")==0) opt_color=false;
+        if (strcmp(argv[i],"--headless")==0) opt_headless=true;
+        if (strcmp(argv[i],"--interval-ms")==0 && i+1<argc) {
+            int n = atoi(argv[++i]);
+            if (n < MIN_INTERVAL_MS) {
+                fprintf(stderr, "--interval-ms must be >= %d\n", MIN_INTERVAL_MS);
+                return 1;
+            }
+            opt_interval_ms = (unsigned)n;
+        }
     }
 
     // init DPDK EAL
@@ -139,6 +126,11 @@ int main(int argc, char **argv)
         return 1;
     }
 
+    if (sm_export_init("dpdk_scalemate") != 0) {
+        fprintf(stderr, "Failed to register telemetry commands\n");
+        if (opt_headless) return 1;
+    }
+
     // allocate arrays for previous counters
     uint64_t *prev_ipackets = calloc(nb_ports, sizeof(uint64_t));
     uint64_t *prev_opackets = calloc(nb_ports, sizeof(uint64_t));
@@ -148,25 +140,54 @@ int main(int argc, char **argv)
     uint64_t *prev_errors   = calloc(nb_ports, sizeof(uint64_t));
     double   *prev_time     = calloc(1, sizeof(double));
 
+    // poll-loop busy samples (filled once the RX workers' memzone shows up)
+    struct poll_stats_shm *poll_shm = NULL;
+    struct poll_stats *poll_cur  = calloc(RTE_MAX_LCORE, sizeof(struct poll_stats));
+    struct poll_stats *poll_prev = calloc(RTE_MAX_LCORE, sizeof(struct poll_stats));
+
+    // per-port metrics for the telemetry exporter
+    struct sm_port_metrics *metrics = calloc(nb_ports, sizeof(struct sm_port_metrics));
+    if (!poll_cur || !poll_prev || !metrics) {
+        fprintf(stderr, "Allocation failed\n");
+        return 1;
+    }
+
     double last_time = now_s();
     prev_time[0] = last_time;
 
-    ui_init();
-
-    // header row
-    mvprintw(0,0,"DPDK ScaleMate Demo (low thresholds)   Ports=%u   Interval=%d ms", nb_ports, INTERVAL_MS);
-    mvprintw(1,0,"Thresholds (demo): SCALE-UP cpu>20%% or ring>10%% or drops>0.1%% | SCALE-OUT rx>30%% and cpu>20%%");
-    mvprintw(3,0,"+------+---------+---------+---------+--------+-------+-------------------------+");
-    mvprintw(4,0,"| Port | Rx-pps  | Tx-pps  | Rx-bps  | Drop%  |  CPU  | Decision / Reason       |");
-    mvprintw(5,0,"+------+---------+---------+---------+--------+-------+-------------------------+");
+    if (opt_headless) {
+        printf("Headless: ports=%u interval=%u ms, query /scalemate/ports on the DPDK telemetry socket\n",
+               nb_ports, opt_interval_ms);
+        fflush(stdout);
+    } else {
+        ui_init();
+
+        // header row
+        mvprintw(0,0,"DPDK ScaleMate Demo (low thresholds)   Ports=%u   Interval=%u ms", nb_ports, opt_interval_ms);
+        mvprintw(1,0,"Thresholds (demo): SCALE-UP busy>20%% or ring>10%% or drops>0.1%% | SCALE-OUT rx>30%% and busy>20%%");
+        mvprintw(3,0,"+------+---------+---------+---------+--------+-------+-------------------------+");
+        mvprintw(4,0,"| Port | Rx-pps  | Tx-pps  | Rx-bps  | Drop%  | Busy  | Decision / Reason       |");
+        mvprintw(5,0,"+------+---------+---------+---------+--------+-------+-------------------------+");
+    }
 
     while (1) {
         double t0 = now_s();
+        // busy-cycle sample shared by all ports of this interval
+        if (!poll_shm) poll_shm = poll_stats_shm_lookup();
+        if (poll_shm) poll_stats_shm_sample(poll_shm, poll_cur);
         // read stats for each port
         for (uint16_t port=0; port<nb_ports; port++) {
+            struct sm_port_metrics *m = &metrics[port];
             struct rte_eth_stats st;
+            memset(m, 0, sizeof(*m));
+            m->port = port;
+            m->busy = m->score = -1.0;
+            m->skew = 1.0;
             if (rte_eth_stats_get(port, &st) != 0) {
-                mvprintw(7+port,0,"| %3u  |  stat read error                                   |", port);
+                snprintf(m->decision, sizeof(m->decision), "error");
+                snprintf(m->reason, sizeof(m->reason), "stat read error");
+                if (!opt_headless)
+                    mvprintw(7+port,0,"| %3u  |  stat read error                                   |", port);
                 continue;
             }
 
@@ -180,7 +201,7 @@ int main(int argc, char **argv)
 
             double t1 = now_s();
             double dt = t1 - last_time;
-            if (dt <= 0) dt = INTERVAL_MS / 1000.0;
+            if (dt <= 0) dt = opt_interval_ms / 1000.0;
 
             double rx_pps = d_ipackets / dt;
             double tx_pps = d_opackets / dt;
@@ -196,16 +217,21 @@ int main(int argc, char **argv)
             uint64_t total_seen = (d_ipackets + d_imissed);
             if (total_seen > 0) drop_ratio = (double)d_imissed / (double)total_seen;
 
-            // approximate ring_fill: if imissed increases a lot, consider ring congested
-            double ring_fill = (double)st.imissed / (double)(st.ipackets + st.imissed + 1);
-            if (ring_fill < 0) ring_fill = 0; if (ring_fill > 1) ring_fill = 1;
+            // ring_fill: fullest of RX mempool, RX and TX descriptor rings right now
+            struct buf_util bu;
+            buf_util_port(port, &bu);
+            double ring_fill = buf_util_max(&bu);
 
-            // CPU util
-            double cpu_util = get_cpu_util_percent();
+            // RX lcore busy ratio; -1 when no worker publishes for this port
+            double busy = poll_shm ? poll_stats_shm_port_busy(poll_shm, poll_cur, poll_prev, port) : -1.0;
+            double busy_util = (busy < 0) ? 0.0 : busy;
+            char busy_txt[8];
+            if (busy < 0) snprintf(busy_txt, sizeof(busy_txt), "  n/a ");
+            else          snprintf(busy_txt, sizeof(busy_txt), "%5.1f%%", busy * 100.0);
 
             // decision (demo thresholds)
             char reason[128];
-            decision_t dec = decide_demo(rx_util, cpu_util, ring_fill, drop_ratio, reason, sizeof(reason));
+            decision_t dec = decide_demo(rx_util, busy_util, ring_fill, drop_ratio, reason, sizeof(reason));
 
             // format decision text
             const char *dec_text = "Stable";
@@ -213,12 +239,24 @@ int main(int argc, char **argv)
             if (dec == DECISION_SCALE_UP) { dec_text = "SCALE-UP"; color = CLR_YELLOW; }
             else if (dec == DECISION_SCALE_OUT) { dec_text = "SCALE-OUT"; color = CLR_RED; }
 
+            m->valid = 1;
+            m->rx_pps = rx_pps; m->tx_pps = tx_pps;
+            m->rx_bps = rx_bps; m->tx_bps = tx_bps;
+            m->rx_util = rx_util;
+            m->drop_ratio = drop_ratio;
+            m->busy = busy;
+            m->buf_fill = ring_fill;
+            snprintf(m->decision, sizeof(m->decision), "%s", dec_text);
+            snprintf(m->reason, sizeof(m->reason), "%s", reason);
+
             // print row
-            if (has_colors() && opt_color) attron(COLOR_PAIR(color));
-            mvprintw(7+port, 0,
-                     "| %4u | %7.0f | %7.0f | %7.0fk | %6.3f | %5.1f%% | %-23s |",
-                     port, rx_pps, tx_pps, rx_bps/1000.0, drop_ratio*100.0, cpu_util*100.0, reason);
-            if (has_colors() && opt_color) attroff(COLOR_PAIR(color));
+            if (!opt_headless) {
+                if (has_colors() && opt_color) attron(COLOR_PAIR(color));
+                mvprintw(7+port, 0,
+                         "| %4u | %7.0f | %7.0f | %7.0fk | %6.3f | %s | %-23s |",
+                         port, rx_pps, tx_pps, rx_bps/1000.0, drop_ratio*100.0, busy_txt, reason);
+                if (has_colors() && opt_color) attroff(COLOR_PAIR(color));
+            }
 
             // store previous
             prev_ipackets[port] = st.ipackets;
@@ -229,22 +267,28 @@ int main(int argc, char **argv)
             prev_errors[port]   = st.ierrors + st.oerrors;
         }
 
-        // finalize row boundary
-        int last_row = 7 + nb_ports;
-        mvprintw(last_row, 0, "+------+---------+---------+---------+--------+-------+-------------------------+");
+        memcpy(poll_prev, poll_cur, RTE_MAX_LCORE * sizeof(struct poll_stats));
+        sm_export_publish(metrics, nb_ports);
 
-        refresh();
+        if (!opt_headless) {
+            // finalize row boundary
+            int last_row = 7 + nb_ports;
+            mvprintw(last_row, 0, "+------+---------+---------+---------+--------+-------+-------------------------+");
+
+            refresh();
+        }
 
         // sleep remaining interval
         double t_elapsed = now_s() - t0;
-        double to_wait = (INTERVAL_MS / 1000.0) - t_elapsed;
+        double to_wait = (opt_interval_ms / 1000.0) - t_elapsed;
         if (to_wait > 0) usleep((useconds_t)(to_wait * 1e6));
         last_time = now_s();
     }
 
     // cleanup (never reached)
-    ui_shutdown();
+    if (!opt_headless) ui_shutdown();
     free(prev_ipackets); free(prev_opackets); free(prev_ibytes);
     free(prev_obytes); free(prev_imissed); free(prev_errors); free(prev_time);
+    free(poll_cur); free(poll_prev); free(metrics);
     return 0;
 }
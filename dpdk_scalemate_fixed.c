@@ -3,6 +3,16 @@
 // - Proper DPDK port init + mbuf pool
 // - RX worker that polls and frees mbufs (ensures RX counters update)
 // - ncurses dashboard with per-port PPS/BPS and Scale decision
+// - Per-queue pps/bytes/errors from xstats (IDs resolved once) with RSS skew
+// - Busy = poll-loop useful cycles / all cycles of the RX lcore (poll_stats_shm.h),
+//   not /proc/stat, since a poll-mode core always looks 100% busy to the kernel
+// - Port counters sampled every --sample-ms (10..100 ms) against one TSC
+//   stamp for all ports (rate_sampler.h); the table shows the interval
+//   average, EWMA and the peak sample-to-sample rate (microbursts)
+// - --autoscale: SCALE-UP/OUT decisions grow the set of RX queues + lcores
+//   at runtime, idle periods shrink it (autoscale.h, RETA rebalanced live)
+// - --headless: no ncurses, metrics and decision served on the DPDK telemetry
+//   socket (/scalemate/ports, see scalemate_export.h), --interval-ms down to 100
 // - Demo low thresholds for visibility
 // - Graceful shutdown (Ctrl-C)
 
@@ -24,21 +34,38 @@
 #include <rte_mbuf.h>
 #include <rte_lcore.h>
 #include <rte_launch.h>
+#include <rte_cycles.h>
+
+#include "autoscale.h"
+#include "buf_util.h"
+#include "numa_util.h"
+#include "pool_size.h"
+#include "poll_stats_shm.h"
+#include "queue_xstats.h"
+#include "rate_sampler.h"
+#include "scalemate_export.h"
 
 //
 // CONFIG (tweak these for your NIC)
 //
 #define LINK_CAPACITY_GBPS 100.0   // adjust to NIC (10/25/40/100)
 #define INTERVAL_MS 1000
+#define MIN_INTERVAL_MS 100
+#define SAMPLE_MS 10               // port counter sampling period
+#define MIN_SAMPLE_MS 10
+#define MAX_SAMPLE_MS 100
+#define EWMA_MS 500                // EWMA time constant
 
 // Demo (low) thresholds
-#define DEMO_CPU_THRESH 0.20       // 20%
+#define DEMO_BUSY_THRESH 0.20      // 20% of RX lcore cycles doing useful work
 #define DEMO_RING_FILL  0.10       // 10%
 #define DEMO_DROP_RATIO 0.001      // 0.1%
 #define DEMO_RX_UTIL    0.30       // 30%
+#define DEMO_IDLE_BUSY  0.05       // autoscale: shrink below 5% busy and no drops
 
-// mbuf pool params
-#define NUM_MBUFS 8192
+// mbuf pool params (pool size from pool_size_calc)
+#define RX_DESC 1024
+#define TX_DESC 1024
 #define MBUF_CACHE_SIZE 256
 #define BURST_SIZE 32
 
@@ -51,65 +78,44 @@
 // CLI
 static bool opt_verbose = false;
 static bool opt_color = true;
+static uint16_t opt_rxq = 1;   // --rxq N: RX queues (RSS) on the polled port
+static bool opt_headless = false;          // --headless: telemetry only, no ncurses
+static unsigned opt_interval_ms = INTERVAL_MS;  // --interval-ms N
+static unsigned opt_sample_ms = SAMPLE_MS;      // --sample-ms N
+static unsigned opt_ewma_ms = EWMA_MS;          // --ewma-ms N
+static unsigned opt_peak_ms = 0;                // --peak-window-ms N, 0 = interval
+static bool opt_autoscale = false;              // --autoscale: act on the decisions
 
 // graceful shutdown
 static volatile sig_atomic_t stop_requested = 0;
 static void handle_sigint(int _) { (void)_; stop_requested = 1; }
 
-// helper: monotonic time
-static double now_s(void) {
-    struct timespec ts;
-    clock_gettime(CLOCK_MONOTONIC, &ts);
-    return ts.tv_sec + ts.tv_nsec * 1e-9;
-}
-
-// CPU util from /proc/stat (fraction 0..1)
-static double get_cpu_util_percent(void)
-{
-    static unsigned long long prev_total = 0, prev_idle = 0;
-    FILE *f = fopen("/proc/stat","r");
-    if (!f) return 0.0;
-    char line[512];
-    if (!fgets(line, sizeof(line), f)) { fclose(f); return 0.0; }
-    fclose(f);
-
-    unsigned long long user=0, nice=0, systemv=0, idle=0, iowait=0, irq=0, softirq=0, steal=0;
-    int n = sscanf(line, "cpu  %llu %llu %llu %llu %llu %llu %llu %llu",
-           &user, &nice, &systemv, &idle, &iowait, &irq, &softirq, &steal);
-    if (n < 4) return 0.0;
-
-    unsigned long long idle_all = idle + iowait;
-    unsigned long long non_idle = user + nice + systemv + irq + softirq + steal;
-    unsigned long long total = idle_all + non_idle;
-
-    unsigned long long diff_total = (total > prev_total) ? (total - prev_total) : 0;
-    unsigned long long diff_idle  = (idle_all > prev_idle) ? (idle_all - prev_idle) : 0;
-
-    prev_total = total;
-    prev_idle  = idle_all;
-
-    if (diff_total == 0) return 0.0;
-    double util = 1.0 - ((double)diff_idle / (double)diff_total);
-    if (util < 0) util = 0; if (util > 1) util = 1;
-    return util;
+// helper: sleep until a TSC deadline (usleep granularity, then spin the rest)
+static void wait_until_tsc(uint64_t deadline, uint64_t hz) {
+    uint64_t now = rte_rdtsc();
+    if (now >= deadline) return;
+    uint64_t us = (deadline - now) * 1000000ULL / hz;
+    if (us > 50) usleep((useconds_t)(us - 50));
+    while (rte_rdtsc() < deadline) rte_pause();
 }
 
 // decision types
 typedef enum { DECISION_STABLE=0, DECISION_SCALE_UP, DECISION_SCALE_OUT } decision_t;
 
-static decision_t decide_demo(double rx_util, double cpu_util, double ring_fill, double drop_ratio, char *reason, size_t rlen)
+// busy_util: poll-loop busy ratio of the RX lcore(s), the real packet-processing headroom
+static decision_t decide_demo(double rx_util, double busy_util, double ring_fill, double drop_ratio, char *reason, size_t rlen)
 {
-    if (cpu_util > DEMO_CPU_THRESH || ring_fill > DEMO_RING_FILL || drop_ratio > DEMO_DROP_RATIO) {
-        snprintf(reason, rlen, "Scale-Up: cpu=%.0f%% ring=%.1f%% drops=%.4f",
-                 cpu_util*100.0, ring_fill*100.0, drop_ratio);
+    if (busy_util > DEMO_BUSY_THRESH || ring_fill > DEMO_RING_FILL || drop_ratio > DEMO_DROP_RATIO) {
+        snprintf(reason, rlen, "Scale-Up: busy=%.0f%% ring=%.1f%% drops=%.4f",
+                 busy_util*100.0, ring_fill*100.0, drop_ratio);
         return DECISION_SCALE_UP;
     }
-    if (rx_util > DEMO_RX_UTIL && cpu_util > DEMO_CPU_THRESH) {
-        snprintf(reason, rlen, "Scale-Out: rx=%.1f%% cpu=%.0f%%", rx_util*100.0, cpu_util*100.0);
+    if (rx_util > DEMO_RX_UTIL && busy_util > DEMO_BUSY_THRESH) {
+        snprintf(reason, rlen, "Scale-Out: rx=%.1f%% busy=%.0f%%", rx_util*100.0, busy_util*100.0);
         return DECISION_SCALE_OUT;
     }
-    snprintf(reason, rlen, "Stable: rx=%.1f%% cpu=%.0f%% ring=%.1f%% drops=%.4f",
-             rx_util*100.0, cpu_util*100.0, ring_fill*100.0, drop_ratio);
+    snprintf(reason, rlen, "Stable: rx=%.1f%% busy=%.0f%% ring=%.1f%% drops=%.4f",
+             rx_util*100.0, busy_util*100.0, ring_fill*100.0, drop_ratio);
     return DECISION_STABLE;
 }
 
@@ -131,20 +137,54 @@ static void ui_shutdown(void) {
     endwin();
 }
 
+// Per-queue rows under the port table (qx already sampled); returns the next free row.
+static int draw_queue_rows(int row, const struct queue_xstats *qx, double dt)
+{
+    double total_pps = 0.0;
+    double skew = queue_xstats_skew(qx, dt, &total_pps);
+    bool imbalance = skew > QX_SKEW_WARN && total_pps > QX_SKEW_MIN_PPS;
+
+    if (imbalance && opt_color && has_colors()) attron(COLOR_PAIR(CLR_RED));
+    mvprintw(row++, 0, "Port %u queues: skew=%.2f %-16s", (unsigned)qx->port, skew,
+             imbalance ? "RSS IMBALANCE" : "");
+    if (imbalance && opt_color && has_colors()) attroff(COLOR_PAIR(CLR_RED));
+
+    for (uint16_t q = 0; q < qx->nb_q; q++) {
+        double pps    = queue_xstats_rate(qx, q, QX_RX_PKTS, dt);
+        double bps    = queue_xstats_rate(qx, q, QX_RX_BYTES, dt) * 8.0;
+        double errs   = queue_xstats_rate(qx, q, QX_RX_ERRORS, dt);
+        double missed = queue_xstats_rate(qx, q, QX_RX_MISSED, dt);
+        if (opt_color && has_colors()) attron(COLOR_PAIR(CLR_CYAN));
+        mvprintw(row++, 0, "  q%-2u rx=%9.0f pps %9.0fk bps  err=%7.0f/s  missed=%7.0f/s",
+                 (unsigned)q, pps < 0 ? 0 : pps, bps < 0 ? 0 : bps / 1000.0,
+                 errs < 0 ? 0 : errs, missed < 0 ? 0 : missed);
+        if (opt_color && has_colors()) attroff(COLOR_PAIR(CLR_CYAN));
+    }
+    return row;
+}
+
 // global for RX thread control
 static volatile int rx_thread_running = 0;
 static uint16_t rx_worker_port = 0;
 static struct rte_mempool *global_mbuf_pool = NULL;
 
+// RX worker poll instrumentation (burst histogram, busy/idle cycles), shared memory
+static struct poll_stats_shm *poll_shm = NULL;
+
 // RX worker: poll and free pkts so that RX counters update reliably.
 // Run on a slave lcore via rte_eal_remote_launch.
 static int rx_worker_main(__rte_unused void *arg)
 {
     uint16_t port = rx_worker_port;
+    uint16_t q = 0;
     struct rte_mbuf *pkts[BURST_SIZE];
+    struct poll_stats *ps = poll_stats_shm_attach(poll_shm, port, 0);
+    uint64_t t = poll_stats_cycles();
     rx_thread_running = 1;
     while (!stop_requested) {
-        const uint16_t nb_rx = rte_eth_rx_burst(port, 0, pkts, BURST_SIZE);
+        // round-robin over all RX queues of the port
+        const uint16_t nb_rx = rte_eth_rx_burst(port, q, pkts, BURST_SIZE);
+        if (++q == opt_rxq) q = 0;
         if (nb_rx) {
             for (uint16_t i = 0; i < nb_rx; ++i) {
                 rte_pktmbuf_free(pkts[i]);
@@ -153,24 +193,59 @@ static int rx_worker_main(__rte_unused void *arg)
             // small pause to avoid burning CPU too hard if idle
             rte_pause();
         }
+        t = poll_stats_record(ps, nb_rx, t);
     }
+    poll_stats_shm_detach(poll_shm);
     rx_thread_running = 0;
     return 0;
 }
 
-// Initialize one port with 1 RX and 1 TX queue (sufficient for demo).
-static int port_init(uint16_t port, struct rte_mempool *mbuf_pool)
+// Autoscale worker: one RX queue per lcore. Returns once asked to stop and the
+// queue is drained (RETA no longer points at it), or on Ctrl-C.
+static int rx_queue_worker(void *arg)
+{
+    struct as_worker *w = arg;
+    struct rte_mbuf *pkts[BURST_SIZE];
+    struct poll_stats *ps = poll_stats_shm_attach(poll_shm, w->port, w->queue);
+    uint64_t t = poll_stats_cycles();
+    while (!stop_requested) {
+        const uint16_t nb_rx = rte_eth_rx_burst(w->port, w->queue, pkts, BURST_SIZE);
+        for (uint16_t i = 0; i < nb_rx; ++i) rte_pktmbuf_free(pkts[i]);
+        if (nb_rx == 0) {
+            if (!w->run) break;
+            rte_pause();
+        }
+        t = poll_stats_record(ps, nb_rx, t);
+    }
+    poll_stats_shm_detach(poll_shm);
+    return 0;
+}
+
+// Initialize one port with rx_rings RX queues (RSS when >1) and 1 TX queue.
+static int port_init(uint16_t port, struct rte_mempool *mbuf_pool, uint16_t rx_rings)
 {
     int ret;
     struct rte_eth_conf port_conf = {0};
-    const uint16_t rx_rings = 1, tx_rings = 1;
-    const uint16_t rx_ring_size = 1024, tx_ring_size = 1024;
+    const uint16_t tx_rings = 1;
+    const uint16_t rx_ring_size = RX_DESC, tx_ring_size = TX_DESC;
 
     if (!rte_eth_dev_is_valid_port(port)) {
         fprintf(stderr, "Invalid port %u\n", port);
         return -1;
     }
 
+    if (rx_rings > 1) {
+        struct rte_eth_dev_info dev_info;
+        ret = rte_eth_dev_info_get(port, &dev_info);
+        if (ret != 0) {
+            fprintf(stderr, "rte_eth_dev_info_get failed: %d\n", ret);
+            return ret;
+        }
+        port_conf.rxmode.mq_mode = RTE_ETH_MQ_RX_RSS;
+        port_conf.rx_adv_conf.rss_conf.rss_hf =
+            (RTE_ETH_RSS_IP | RTE_ETH_RSS_TCP | RTE_ETH_RSS_UDP) & dev_info.flow_type_rss_offloads;
+    }
+
     ret = rte_eth_dev_configure(port, rx_rings, tx_rings, &port_conf);
     if (ret < 0) {
         fprintf(stderr, "rte_eth_dev_configure failed: %d\n", ret);
@@ -216,7 +291,36 @@ int main(int argc, char **argv)
     for (int i = 1; i < argc; ++i) {
         if (strcmp(argv[i], "--verbose") == 0) opt_verbose = true;
         if (strcmp(argv[i], "--no-color") == 0) opt_color = false;
+        if (strcmp(argv[i], "--rxq") == 0 && i + 1 < argc) {
+            int n = atoi(argv[++i]);
+            if (n < 1 || n > QX_MAX_QUEUES) {
+                fprintf(stderr, "--rxq must be 1..%d\n", QX_MAX_QUEUES);
+                return 1;
+            }
+            opt_rxq = (uint16_t)n;
+        }
+        if (strcmp(argv[i], "--headless") == 0) opt_headless = true;
+        if (strcmp(argv[i], "--autoscale") == 0) opt_autoscale = true;
+        if (strcmp(argv[i], "--interval-ms") == 0 && i + 1 < argc) {
+            int n = atoi(argv[++i]);
+            if (n < MIN_INTERVAL_MS) {
+                fprintf(stderr, "--interval-ms must be >= %d\n", MIN_INTERVAL_MS);
+                return 1;
+            }
+            opt_interval_ms = (unsigned)n;
+        }
+        if (strcmp(argv[i], "--sample-ms") == 0 && i + 1 < argc) {
+            int n = atoi(argv[++i]);
+            if (n < MIN_SAMPLE_MS || n > MAX_SAMPLE_MS) {
+                fprintf(stderr, "--sample-ms must be %d..%d\n", MIN_SAMPLE_MS, MAX_SAMPLE_MS);
+                return 1;
+            }
+            opt_sample_ms = (unsigned)n;
+        }
+        if (strcmp(argv[i], "--ewma-ms") == 0 && i + 1 < argc) opt_ewma_ms = (unsigned)atoi(argv[++i]);
+        if (strcmp(argv[i], "--peak-window-ms") == 0 && i + 1 < argc) opt_peak_ms = (unsigned)atoi(argv[++i]);
     }
+    if (opt_peak_ms == 0) opt_peak_ms = opt_interval_ms;
 
     signal(SIGINT, handle_sigint);
 
@@ -233,88 +337,154 @@ int main(int argc, char **argv)
         return 1;
     }
 
-    // create mbuf pool
+    if (sm_export_init("dpdk_scalemate_fixed") != 0) {
+        fprintf(stderr, "Failed to register telemetry commands\n");
+        if (opt_headless) return 1;
+    }
+
+    // for demo, we'll init port 0 (you can extend to loop ports)
+    uint16_t port = 0;
+
+    // mbuf pool on the port's socket, sized for its rings and the RX workers
     char pool_name[32];
     snprintf(pool_name, sizeof(pool_name), "MBUF_POOL_%d", getpid());
-    global_mbuf_pool = rte_pktmbuf_pool_create(pool_name, NUM_MBUFS * nb_ports,
-                                               MBUF_CACHE_SIZE, 0,
-                                               RTE_MBUF_DEFAULT_BUF_SIZE, rte_socket_id());
+    struct pool_size_req req = {
+        .nb_rxq = opt_rxq, .rx_desc = RX_DESC, .nb_txq = 1, .tx_desc = TX_DESC,
+        .nb_lcores = rte_lcore_count(), .cache = MBUF_CACHE_SIZE, .burst = BURST_SIZE, .depth = 1,
+    };
+    unsigned nb_mbufs = pool_size_calc(&req);
+    global_mbuf_pool = numa_pool_get(pool_name, numa_port_socket(port), nb_mbufs, MBUF_CACHE_SIZE);
     if (global_mbuf_pool == NULL) {
         fprintf(stderr, "Failed to create mbuf pool\n");
         return 1;
     }
-
-    // for demo, we'll init port 0 (you can extend to loop ports)
-    uint16_t port = 0;
-    if (port_init(port, global_mbuf_pool) != 0) {
+    if (opt_verbose) pool_size_report(global_mbuf_pool->name, &req, nb_mbufs, RTE_MBUF_DEFAULT_BUF_SIZE);
+    if (port_init(port, global_mbuf_pool, opt_rxq) != 0) {
         fprintf(stderr, "Port init failed\n");
         return 1;
     }
     rx_worker_port = port;
 
-    // launch RX worker on a slave lcore
-    unsigned lcore_id = rte_get_next_lcore(rte_lcore_id(), 1, 0);
-    if (lcore_id == RTE_MAX_LCORE) {
-        fprintf(stderr, "No slave lcore available for rx thread; continuing without active rx worker\n");
+    // poll-loop busy counters, published for this and any secondary monitor
+    poll_shm = poll_stats_shm_create();
+    struct poll_stats *poll_cur  = calloc(RTE_MAX_LCORE, sizeof(struct poll_stats));
+    struct poll_stats *poll_prev = calloc(RTE_MAX_LCORE, sizeof(struct poll_stats));
+    if (!poll_shm || !poll_cur || !poll_prev) {
+        fprintf(stderr, "Failed to set up poll stats memzone\n");
+        return 1;
+    }
+
+    static struct autoscale as;
+    if (opt_autoscale) {
+        // autoscale: start with one queue/lcore, grow up to --rxq
+        if (autoscale_init(&as, port, 1, opt_rxq, rx_queue_worker) != 0) {
+            fprintf(stderr, "Autoscale init failed on port %u\n", port);
+            return 1;
+        }
+        if (opt_verbose) printf("Autoscale: port %u, %u..%u queues\n", port, as.min_q, as.max_q);
     } else {
-        ret = rte_eal_remote_launch(rx_worker_main, NULL, lcore_id);
-        if (ret != 0) {
-            fprintf(stderr, "Failed to launch rx worker on lcore %u\n", lcore_id);
+        // launch RX worker on a slave lcore, local to the port if possible
+        unsigned lcore_id = numa_pick_lcore(numa_port_socket(port), NULL);
+        if (lcore_id == RTE_MAX_LCORE) {
+            fprintf(stderr, "No slave lcore available for rx thread; continuing without active rx worker\n");
         } else {
-            if (opt_verbose) printf("RX worker launched on lcore %u\n", lcore_id);
+            numa_check_lcore(lcore_id, port);
+            ret = rte_eal_remote_launch(rx_worker_main, NULL, lcore_id);
+            if (ret != 0) {
+                fprintf(stderr, "Failed to launch rx worker on lcore %u\n", lcore_id);
+            } else {
+                if (opt_verbose) printf("RX worker launched on lcore %u\n", lcore_id);
+            }
         }
     }
 
-    // allocate previous counters arrays for all ports
-    uint16_t max_ports = nb_ports;
-    uint64_t *prev_ipackets = calloc(max_ports, sizeof(uint64_t));
-    uint64_t *prev_opackets = calloc(max_ports, sizeof(uint64_t));
-    uint64_t *prev_ibytes   = calloc(max_ports, sizeof(uint64_t));
-    uint64_t *prev_obytes   = calloc(max_ports, sizeof(uint64_t));
-    uint64_t *prev_imissed  = calloc(max_ports, sizeof(uint64_t));
-    uint64_t *prev_errors   = calloc(max_ports, sizeof(uint64_t));
-    if (!prev_ipackets || !prev_opackets || !prev_ibytes || !prev_obytes || !prev_imissed || !prev_errors) {
+    // sample ring: enough history for the longer of the table interval and peak window
+    struct rate_sampler rs;
+    unsigned span_ms = opt_peak_ms > opt_interval_ms ? opt_peak_ms : opt_interval_ms;
+    if (rate_sampler_init(&rs, nb_ports, span_ms / opt_sample_ms + 2, opt_ewma_ms) != 0) {
         fprintf(stderr, "Allocation failed\n");
         return 1;
     }
 
-    double last_time = now_s();
+    // per-queue xstats: resolve names to IDs once, fetch by ID every tick
+    struct queue_xstats *qx = calloc(nb_ports, sizeof(struct queue_xstats));
+    if (!qx) {
+        fprintf(stderr, "Allocation failed\n");
+        return 1;
+    }
+    for (uint16_t p = 0; p < nb_ports; ++p) {
+        if (queue_xstats_init(&qx[p], p) <= 0 && opt_verbose)
+            printf("Port %u: no per-queue xstats\n", p);
+    }
 
-    // init UI
-    ui_init();
+    // per-port metrics handed to the telemetry exporter every tick
+    struct sm_port_metrics *metrics = calloc(nb_ports, sizeof(struct sm_port_metrics));
+    if (!metrics) {
+        fprintf(stderr, "Allocation failed\n");
+        return 1;
+    }
+
+    if (opt_headless) {
+        printf("Headless: ports=%u interval=%u ms sample=%u ms, query /scalemate/ports on the DPDK telemetry socket\n",
+               nb_ports, opt_interval_ms, opt_sample_ms);
+        fflush(stdout);
+    } else {
+        // init UI
+        ui_init();
+
+        // header
+        mvprintw(0,0,"DPDK ScaleMate Demo (fixed RX)   Ports=%u   Interval=%u ms   Sample=%u ms   EWMA=%u ms   Peak=%u ms",
+                 nb_ports, opt_interval_ms, opt_sample_ms, opt_ewma_ms, opt_peak_ms);
+        mvprintw(1,0,"Demo thresholds: SCALE-UP busy>20%% or ring>10%% or drops>0.1%% | SCALE-OUT rx>30%% & busy>20%%");
+        mvprintw(3,0,"+------+---------+---------+---------+---------+---------+--------+-------+-------------------------+");
+        mvprintw(4,0,"| Port | Rx-pps  | Rx-ewma | Rx-peak | Tx-pps  | Rx-bps  | Drop%  | Busy  | Decision / Reason       |");
+        mvprintw(5,0,"+------+---------+---------+---------+---------+---------+--------+-------+-------------------------+");
+    }
 
-    // header
-    mvprintw(0,0,"DPDK ScaleMate Demo (fixed RX)   Ports=%u   Interval=%d ms", nb_ports, INTERVAL_MS);
-    mvprintw(1,0,"Demo thresholds: SCALE-UP cpu>20%% or ring>10%% or drops>0.1%% | SCALE-OUT rx>30%% & cpu>20%%");
-    mvprintw(3,0,"+------+---------+---------+---------+--------+-------+-------------------------+");
-    mvprintw(4,0,"| Port | Rx-pps  | Tx-pps  | Rx-bps  | Drop%  |  CPU  | Decision / Reason       |");
-    mvprintw(5,0,"+------+---------+---------+---------+--------+-------+-------------------------+");
+    // Sample all ports every opt_sample_ms on a TSC schedule; evaluate and
+    // draw every opt_interval_ms from the samples in the ring.
+    const uint64_t hz = rte_get_tsc_hz();
+    const uint64_t sample_cyc = hz / 1000 * opt_sample_ms;
+    const uint64_t interval_cyc = hz / 1000 * opt_interval_ms;
+    // half a sample of slack so jitter does not drop the window's first entry
+    const unsigned window_ms = opt_interval_ms + opt_sample_ms / 2;
+    uint64_t last_eval = rate_sampler_take(&rs);
+    uint64_t next_sample = last_eval + sample_cyc;
 
     while (!stop_requested) {
-        double t0 = now_s();
+        wait_until_tsc(next_sample, hz);
+        next_sample += sample_cyc;
+        if (rte_rdtsc() > next_sample) next_sample = rte_rdtsc() + sample_cyc; // fell behind, skip ahead
+
+        uint64_t now = rate_sampler_take(&rs);
+        if (now - last_eval < interval_cyc - sample_cyc / 2) continue;
+        double dt = (double)(now - last_eval) / (double)hz;
+        last_eval = now;
+
+        // one busy-cycle sample for all ports
+        poll_stats_shm_sample(poll_shm, poll_cur);
+        int qrow = 9 + nb_ports;
         for (uint16_t p = 0; p < nb_ports; ++p) {
-            struct rte_eth_stats st;
-            if (rte_eth_stats_get(p, &st) != 0) {
-                mvprintw(7 + p, 0, "| %3u  |  stat read error                                   |", (unsigned)p);
+            struct sm_port_metrics *m = &metrics[p];
+            struct rs_rates win, peak;
+            memset(m, 0, sizeof(*m));
+            m->port = p;
+            m->busy = m->score = -1.0;
+            m->skew = 1.0;
+            if (!rate_sampler_window(&rs, p, window_ms, &win)) {
+                snprintf(m->decision, sizeof(m->decision), "error");
+                snprintf(m->reason, sizeof(m->reason), "stat read error");
+                if (!opt_headless)
+                    mvprintw(7 + p, 0, "| %3u  |  stat read error                                   |", (unsigned)p);
                 continue;
             }
+            rate_sampler_peak(&rs, p, opt_peak_ms, &peak);
+            const struct rs_rates *ewma = rate_sampler_ewma(&rs, p);
 
-            // compute deltas
-            uint64_t d_ipackets = (st.ipackets >= prev_ipackets[p]) ? (st.ipackets - prev_ipackets[p]) : st.ipackets;
-            uint64_t d_opackets = (st.opackets >= prev_opackets[p]) ? (st.opackets - prev_opackets[p]) : st.opackets;
-            uint64_t d_ibytes   = (st.ibytes   >= prev_ibytes[p] ) ? (st.ibytes   - prev_ibytes[p]) : st.ibytes;
-            uint64_t d_obytes   = (st.obytes   >= prev_obytes[p] ) ? (st.obytes   - prev_obytes[p]) : st.obytes;
-            uint64_t d_imissed  = (st.imissed  >= prev_imissed[p]) ? (st.imissed  - prev_imissed[p]) : st.imissed;
-            uint64_t d_errors   = (((uint64_t)st.ierrors + st.oerrors) >= prev_errors[p]) ? ((uint64_t)st.ierrors + st.oerrors - prev_errors[p]) : (uint64_t)st.ierrors + st.oerrors;
-
-            double t1 = now_s();
-            double dt = t1 - last_time;
-            if (dt <= 0) dt = INTERVAL_MS / 1000.0;
-
-            double rx_pps = (double)d_ipackets / dt;
-            double tx_pps = (double)d_opackets / dt;
-            double rx_bps = (double)d_ibytes * 8.0 / dt;
-            double tx_bps = (double)d_obytes * 8.0 / dt;
+            double rx_pps = win.rx_pps;
+            double tx_pps = win.tx_pps;
+            double rx_bps = win.rx_bps;
+            double tx_bps = win.tx_bps;
 
             double link_bps = LINK_CAPACITY_GBPS * 1e9;
             double rx_util = (rx_bps / link_bps);
@@ -322,59 +492,86 @@ int main(int argc, char **argv)
 
             // drop ratio: missed / (rx + missed)
             double drop_ratio = 0.0;
-            uint64_t total_seen = d_ipackets + d_imissed;
-            if (total_seen > 0) drop_ratio = (double)d_imissed / (double)total_seen;
+            double total_seen = win.rx_pps + win.missed_pps;
+            if (total_seen > 0) drop_ratio = win.missed_pps / total_seen;
 
-            // approximate ring_fill: cumulative imissed / (ipackets + imissed + 1)
-            double ring_fill = 0.0;
-            uint64_t denom = st.ipackets + st.imissed + 1;
-            if (denom > 0) ring_fill = (double)st.imissed / (double)denom;
-            if (ring_fill < 0) ring_fill = 0; if (ring_fill > 1) ring_fill = 1;
+            // ring_fill: fullest of RX mempool, RX and TX descriptor rings right now
+            struct buf_util bu;
+            buf_util_port(p, &bu);
+            double ring_fill = buf_util_max(&bu);
 
-            double cpu_util = get_cpu_util_percent();
+            // ports without an RX worker have no busy figure (-1)
+            double busy = poll_stats_shm_port_busy(poll_shm, poll_cur, poll_prev, p);
+            double busy_util = (busy < 0) ? 0.0 : busy;
 
             char reason[128];
-            decision_t dec = decide_demo(rx_util, cpu_util, ring_fill, drop_ratio, reason, sizeof(reason));
+            decision_t dec = decide_demo(rx_util, busy_util, ring_fill, drop_ratio, reason, sizeof(reason));
 
             const char *dec_text = "Stable";
             int color = CLR_GREEN;
             if (dec == DECISION_SCALE_UP)  { dec_text = "SCALE-UP";  color = CLR_YELLOW; }
             if (dec == DECISION_SCALE_OUT) { dec_text = "SCALE-OUT"; color = CLR_RED; }
 
-            if (opt_color && has_colors()) attron(COLOR_PAIR(color));
-            mvprintw(7 + p, 0,
-                     "| %4u | %7.0f | %7.0f | %7.0fk | %6.3f | %5.1f%% | %-23s |",
-                     (unsigned)p, rx_pps, tx_pps, rx_bps/1000.0, drop_ratio*100.0, cpu_util*100.0, reason);
-            if (opt_color && has_colors()) attroff(COLOR_PAIR(color));
-
-            // save previous counters
-            prev_ipackets[p] = st.ipackets;
-            prev_opackets[p] = st.opackets;
-            prev_ibytes[p]   = st.ibytes;
-            prev_obytes[p]   = st.obytes;
-            prev_imissed[p]  = st.imissed;
-            prev_errors[p]   = (uint64_t)st.ierrors + st.oerrors;
+            if (opt_autoscale && p == as.port) {
+                // both SCALE-UP and SCALE-OUT add a queue/lcore on this host
+                int want = 0;
+                if (dec != DECISION_STABLE) want = 1;
+                else if (busy_util < DEMO_IDLE_BUSY && drop_ratio == 0.0) want = -1;
+                int acted = autoscale_step(&as, want);
+                if (acted && opt_headless && opt_verbose)
+                    printf("Autoscale: port %u %s to %u queues\n", p, acted > 0 ? "grew" : "shrank", as.active);
+            }
+
+            bool qx_ok = queue_xstats_sample(&qx[p]) == 0;
+
+            m->valid = 1;
+            m->rx_pps = rx_pps; m->tx_pps = tx_pps;
+            m->rx_bps = rx_bps; m->tx_bps = tx_bps;
+            m->rx_pps_ewma = ewma->rx_pps;
+            m->rx_pps_peak = peak.rx_pps;
+            m->missed_pps_peak = peak.missed_pps;
+            m->rx_util = rx_util;
+            m->drop_ratio = drop_ratio;
+            m->busy = busy;
+            m->buf_fill = ring_fill;
+            if (qx_ok) m->skew = queue_xstats_skew(&qx[p], dt, NULL);
+            snprintf(m->decision, sizeof(m->decision), "%s", dec_text);
+            snprintf(m->reason, sizeof(m->reason), "%s", reason);
+
+            if (!opt_headless) {
+                if (opt_color && has_colors()) attron(COLOR_PAIR(color));
+                mvprintw(7 + p, 0,
+                         "| %4u | %7.0f | %7.0f | %7.0f | %7.0f | %7.0fk | %6.3f | %5.1f%% | %-23s |",
+                         (unsigned)p, rx_pps, ewma->rx_pps, peak.rx_pps, tx_pps, rx_bps/1000.0,
+                         drop_ratio*100.0, busy_util*100.0, reason);
+                if (opt_color && has_colors()) attroff(COLOR_PAIR(color));
+
+                if (qx_ok) qrow = draw_queue_rows(qrow, &qx[p], dt);
+            }
         }
 
-        int last_row = 7 + nb_ports;
-        mvprintw(last_row, 0, "+------+---------+---------+---------+--------+-------+-------------------------+");
-        refresh();
+        memcpy(poll_prev, poll_cur, RTE_MAX_LCORE * sizeof(struct poll_stats));
+        sm_export_publish(metrics, nb_ports);
 
-        // wait remaining
-        double elapsed = now_s() - t0;
-        double to_wait = (INTERVAL_MS / 1000.0) - elapsed;
-        if (to_wait > 0) usleep((useconds_t)(to_wait * 1e6));
-        last_time = now_s();
+        if (!opt_headless) {
+            if (opt_autoscale)
+                mvprintw(2, 0, "Autoscale port %u: queues=%u/%u  grown=%u  shrunk=%u  streak up=%u down=%u   ",
+                         as.port, as.active, as.max_q, as.nb_up, as.nb_down, as.up_streak, as.down_streak);
+            int last_row = 7 + nb_ports;
+            mvprintw(last_row, 0, "+------+---------+---------+---------+---------+---------+--------+-------+-------------------------+");
+            refresh();
+        }
     }
 
     // stop RX worker (signal and wait)
     stop_requested = 1;
     // wait a short moment for worker to stop
     for (int i = 0; i < 50 && rx_thread_running; ++i) usleep(10000);
+    if (opt_autoscale) autoscale_fini(&as);
 
-    ui_shutdown();
-    free(prev_ipackets); free(prev_opackets); free(prev_ibytes);
-    free(prev_obytes); free(prev_imissed); free(prev_errors);
+    if (!opt_headless) ui_shutdown();
+    rate_sampler_free(&rs);
+    free(poll_cur); free(poll_prev); free(qx); free(metrics);
 
     printf("\nExiting cleanly\n");
     return 0;
@@ -1,30 +1,2149 @@
+// flow_tc.c
+// rte_flow rule installer and flow-table benchmark.
+// - sync:  rte_flow_create per rule on the main lcore
+// - async: rte_flow_configure, one pattern and one actions template, a
+//          template table, then rte_flow_async_create on several flow
+//          queues (one lcore each). Ops are postponed and pushed every
+//          --batch rules; completions are pulled as they arrive.
+//          Falls back to sync when the PMD or DPDK lacks the template API.
+// Both report rules/s and per-rule insertion latency percentiles
+// (sync: the rte_flow_create call, async: enqueue to completion).
+//
+// Rule shapes (--shape):
+//   udp       ETH / IPV4 dst, proto UDP / UDP dst           -> QUEUE
+//   5tuple    ETH / IPV4 src, dst, proto UDP / UDP src, dst -> QUEUE
+//   ipv6      ETH / IPV6 dst, proto UDP / UDP dst           -> QUEUE
+//   vxlan     ETH / IPV4 / UDP 4789 / VXLAN vni / ETH / IPV4 / UDP dst -> QUEUE
+//   mark-rss  as udp                                        -> MARK / RSS
+//
+// --bench fills the table in 1-2-5 steps from 1K to --bench-max rules
+// (per shape, or every shape with --shape all). At each occupancy it times
+// the fill, then insert, update (rte_flow_actions_update, DPDK 23.07+) and
+// delete of --bench-probe extra rules, samples the rte_malloc heap of every
+// socket, and with --bench-pps measures the forwarding rate of packets
+// hitting the installed rules on a loopback port (e.g. --vdev=net_ring0, or
+// a NIC cabled back to itself). One CSV row per step goes to --csv, tagged
+// with the driver and firmware version so runs can be compared.
+//
+// --sw-fallback keeps policy complete past the NIC's limit: rules the NIC
+// rejects (or beyond --hw-max) go into an rte_hash keyed on the masked IPv4
+// 5-tuple (all rules of a shape share one mask, so a masked key is an exact
+// match; udp, 5tuple and mark-rss shapes). One worker lcore per RX queue
+// classifies what the NIC did not mark with rte_hash_lookup_bulk_data and
+// tags hits like a MARK action would. Readers are lock-free, deleted keys
+// are reclaimed through RCU QSBR. Once a second the main lcore moves
+// software rules back into the NIC while it accepts them, backing off
+// when it refuses.
+//
+// --rules-file loads exact IPv4 5-tuple -> queue rules from a file instead
+// of generating them: text, one "src dst sport dport udp|tcp [queue]" per
+// line with # comments, or a binary file (a "FTCR" header and 16-byte
+// records, mmap'd, so million-rule sets load without parsing) which
+// --save-rules writes. SIGHUP, or with --watch any rewrite of the file
+// (inotify), reloads it; only the difference to the installed set goes to
+// the NIC (new rules created, changed queues updated, dropped rules
+// destroyed). A file that does not parse is rejected and the rules stay.
+// --rules is then the minimum rule store size (default: twice the file).
+//
+// --steer D splits the RX queues: the last D are dedicated to elephant
+// flows, the others form the shared group that a lowest-priority catch-all
+// RSS rule (the RSS redirection table if the PMD refuses it) spreads
+// everything else over. Every rule gets a COUNT action and RSS over the
+// shared group. Once a second the main lcore reads and resets every rule's
+// counter; a flow above --elephant-pps is re-pointed (RSS over one queue)
+// to the least loaded dedicated queue, and goes back to the shared group
+// when it falls below half of that. One lcore polls each RX queue and the
+// per-queue rates are printed, so one heavy flow no longer starves the
+// small ones sharing its queue.
+//
+// Usage:
+//   flow_tc [EAL options] -- [--rules N] [--mode sync|async]
+//           [--flow-queues Q] [--batch B] [--rxq N] [--shape NAME|all]
+//           [--bench] [--bench-max N] [--bench-probe P] [--bench-pps MS]
+//           [--csv FILE] [--sw-fallback] [--hw-max N]
+//           [--rules-file FILE] [--watch] [--save-rules FILE]
+//           [--steer D] [--elephant-pps PPS]
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
 #include <signal.h>
 #include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/inotify.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
+#include <rte_cycles.h>
 #include <rte_eal.h>
 #include <rte_ethdev.h>
 #include <rte_flow.h>
+#include <rte_hash.h>
+#include <rte_hash_crc.h>
+#include <rte_ip.h>
+#include <rte_launch.h>
+#include <rte_lcore.h>
+#include <rte_malloc.h>
 #include <rte_mempool.h>
+#include <rte_rcu_qsbr.h>
+#include <rte_udp.h>
+#include <rte_version.h>
+#include <rte_vxlan.h>
+
+#include "lat_hist.h"
+#include "numa_util.h"
+#include "pool_size.h"
 
-#define NB_MBUF 8192
 #define NUM_DESC 1024
+#define DEFAULT_RULES 100000
+#define RULE_PORTS 50000            // UDP ports per address before the address moves on
+#define MAX_RXQ 64
+#define MAX_FLOW_QUEUES 16
+#define FLOW_QUEUE_SIZE 1024        // outstanding ops per async flow queue
+#define FLOW_PULL_BURST 64
+#define MAX_ITEMS 8
+
+#define BENCH_MIN 1000
+#define BENCH_MAX 1000000
+#define BENCH_PROBE 1000
+#define BENCH_BURST 32
+#define BENCH_PAYLOAD 18
+#define BENCH_PKT_SET 256           // prebuilt packets per pps sample
+
+#define SW_BURST 32
+#define SW_MIGRATE_BATCH 1024       // rules moved into the NIC per second
+#define SW_RETRY_MAX_S 64           // longest back-off after the NIC refuses
+
+#define STEER_PPS 100000            // default --elephant-pps
+#define STEER_MAX_MOVES 256         // flows pinned or unpinned per scan
+#define STEER_DEFAULT_PRIO 1        // catch-all rule, below the per-flow rules (0)
+#define STEER_RETA_MAX 512
+
+#if RTE_VERSION >= RTE_VERSION_NUM(22, 3, 0, 0)
+#define HAVE_FLOW_ASYNC 1
+#endif
+#if RTE_VERSION >= RTE_VERSION_NUM(23, 7, 0, 0)
+#define HAVE_FLOW_UPDATE 1
+#endif
 
 volatile bool keep_running = true;
 
 static struct rte_mempool *mbuf_pool;
+static uint16_t port_id = 0;
+
+enum { SHAPE_UDP, SHAPE_5TUPLE, SHAPE_IPV6, SHAPE_VXLAN, SHAPE_MARK_RSS, NB_SHAPES, SHAPE_ALL = NB_SHAPES,
+       SHAPE_FILE };        // rules from --rules-file, not a --shape choice
+static const char *const shape_names[NB_SHAPES] = { "udp", "5tuple", "ipv6", "vxlan", "mark-rss" };
+
+enum { FLOW_OP_CREATE, FLOW_OP_UPDATE, FLOW_OP_DESTROY };
+
+static uint32_t opt_rules = DEFAULT_RULES;
+static bool opt_async = false;
+static uint16_t opt_flow_queues = 4;
+static uint32_t opt_batch = 32;
+static uint16_t opt_rxq = 1;
+static int opt_shape = SHAPE_UDP;
+static bool opt_bench = false;
+static uint32_t opt_bench_max = BENCH_MAX;
+static uint32_t opt_bench_probe = BENCH_PROBE;
+static unsigned opt_bench_pps = 0;  // ms per pps sample, 0 = off
+static const char *opt_csv = "flow_tc_bench.csv";
+static bool opt_sw_fallback = false;
+static uint32_t opt_hw_max = UINT32_MAX;
+static const char *opt_rules_file;
+static bool opt_watch = false;
+static const char *opt_save_rules;
+static uint16_t opt_steer = 0;      // dedicated elephant queues, 0 = off
+static uint32_t opt_elephant_pps = STEER_PPS;
+
+// Rule store: one slot per rule id, all in one slab allocated up front
+// (hugepage memory on the port's socket, the C heap if that is short), so
+// nothing moves or grows while rules are installed. Generated rule sets
+// take a contiguous id range (rule_reserve); single rules take ids from
+// rule_alloc, which hands out released ids first (LIFO free list chained
+// through the slots).
+#define RULE_ID_NONE UINT32_MAX
+
+// One rule of a rule file: exact IPv4 5-tuple -> RX queue, every field in
+// network order; also the record of the binary file format.
+struct rule_rec {
+    uint32_t src_addr, dst_addr;
+    uint16_t src_port, dst_port;
+    uint8_t proto;                  // IPPROTO_UDP or IPPROTO_TCP
+    uint8_t pad;
+    uint16_t queue;
+};
+
+struct rule_slot {
+    struct rte_flow *flow;          // NIC handle, NULL while the NIC does not hold the rule
+    uint64_t enq_tsc;               // enqueue time of the rule's last async op
+    uint32_t next_free;             // free list link
+    uint32_t gen;                   // rule file generation that last listed the rule
+    uint8_t used;
+    uint8_t in_sw;                  // lives in the software table
+    uint16_t steer;                 // --steer: 0 shared queues, q + 1 pinned to queue q
+    uint8_t op_failed;              // the rule's last create/update/destroy failed
+    struct rule_rec rec;            // match and action of a rule loaded from a file
+};
+
+static struct rule_slot *slots;
+static uint32_t slot_cap;           // ids 0 .. slot_cap - 1
+static uint32_t slot_hwm;           // ids >= slot_hwm were never handed out
+static uint32_t slot_free = RULE_ID_NONE;
+static bool slots_on_heap;          // rte_zmalloc failed, slots came from calloc
+
+static bool use_async;             // rules are created/destroyed through flow queues
+static uint16_t rss_queues[MAX_RXQ];
+static double ns_per_cycle;
+
+static volatile sig_atomic_t reload_requested;
 
 static void handle_signal(int sig) {
     keep_running = false;
 }
 
-static const struct rte_eth_conf port_conf_default = {
-    .rxmode = { .mq_mode = RTE_ETH_MQ_RX_NONE },
-    .txmode = { .mq_mode = RTE_ETH_MQ_TX_NONE },
+static void handle_reload(int sig) {
+    reload_requested = 1;
+}
+
+static void rule_store_init(uint32_t cap, int socket) {
+    size_t size = (size_t)cap * sizeof(*slots);
+
+    slots = rte_zmalloc_socket("flow_tc_rules", size, RTE_CACHE_LINE_SIZE, socket);
+    if (!slots) {
+        printf("Warning: no hugepage memory for %u rule slots, using the heap\n", cap);
+        slots = calloc(cap, sizeof(*slots));
+        slots_on_heap = true;
+    }
+    if (!slots)
+        rte_exit(EXIT_FAILURE, "Cannot allocate %u rule slots\n", cap);
+    slot_cap = cap;
+    printf("Rule store: %u slots, %.1f MB %s\n", cap, size / (1024.0 * 1024.0),
+           slots_on_heap ? "heap" : "hugepage");
+}
+
+static void rule_store_free(void) {
+    if (slots_on_heap)
+        free(slots);
+    else
+        rte_free(slots);
+    slots = NULL;
+}
+
+// Forgets every id; the caller has removed the rules.
+static void rule_store_reset(void) {
+    memset(slots, 0, (size_t)slot_cap * sizeof(*slots));
+    slot_hwm = 0;
+    slot_free = RULE_ID_NONE;
+}
+
+// n fresh contiguous ids, the first one returned; RULE_ID_NONE if full.
+static uint32_t rule_reserve(uint32_t n) {
+    if (n > slot_cap - slot_hwm)
+        return RULE_ID_NONE;
+    uint32_t first = slot_hwm;
+    for (uint32_t i = first; i < first + n; i++)
+        slots[i].used = 1;
+    slot_hwm += n;
+    return first;
+}
+
+static inline uint32_t rule_alloc(void) {
+    uint32_t id = slot_free;
+
+    if (id != RULE_ID_NONE)
+        slot_free = slots[id].next_free;
+    else if (slot_hwm < slot_cap)
+        id = slot_hwm++;
+    else
+        return RULE_ID_NONE;
+    slots[id] = (struct rule_slot){ .used = 1 };
+    return id;
+}
+
+// The rule must be out of the NIC and the software table.
+static inline void rule_release(uint32_t id) {
+    slots[id].used = 0;
+    slots[id].next_free = slot_free;
+    slot_free = id;
+}
+
+// Pattern and actions of one rule, with storage for the item specs.
+// Index 0 of eth/ip/udp is the outer header, 1 the VXLAN inner one.
+struct flow_rule {
+    struct rte_flow_item_eth eth_spec[2], eth_mask[2];
+    struct rte_flow_item_ipv4 ip_spec[2], ip_mask[2];
+    struct rte_flow_item_udp udp_spec[2], udp_mask[2];
+    struct rte_flow_item_tcp tcp_spec, tcp_mask;
+    struct rte_flow_item_ipv6 ip6_spec, ip6_mask;
+    struct rte_flow_item_vxlan vx_spec, vx_mask;
+    struct rte_flow_action_queue queue;
+    struct rte_flow_action_mark mark;
+    struct rte_flow_action_rss rss;
+    struct rte_flow_item pattern[MAX_ITEMS + 1];
+    struct rte_flow_action actions[4];
+    uint8_t tmpl;                   // async pattern template index (1: TCP file rule)
+};
+
+static int rule_item(struct flow_rule *r, int n, enum rte_flow_item_type type,
+                     const void *spec, const void *mask) {
+    r->pattern[n] = (struct rte_flow_item){ .type = type, .spec = spec, .mask = mask };
+    return n + 1;
+}
+
+// A rule file record: ETH / IPV4 src, dst, proto / UDP or TCP src, dst -> QUEUE.
+static void rule_fill_rec(const struct rule_rec *rec, struct flow_rule *r) {
+    int n = 0;
+
+    memset(r, 0, sizeof(*r));
+    r->ip_spec[0].hdr.src_addr = rec->src_addr;
+    r->ip_spec[0].hdr.dst_addr = rec->dst_addr;
+    r->ip_spec[0].hdr.next_proto_id = rec->proto;
+    r->ip_mask[0].hdr.src_addr = 0xFFFFFFFF;
+    r->ip_mask[0].hdr.dst_addr = 0xFFFFFFFF;
+    r->ip_mask[0].hdr.next_proto_id = 0xFF;
+    n = rule_item(r, n, RTE_FLOW_ITEM_TYPE_ETH, &r->eth_spec[0], &r->eth_mask[0]);
+    n = rule_item(r, n, RTE_FLOW_ITEM_TYPE_IPV4, &r->ip_spec[0], &r->ip_mask[0]);
+    if (rec->proto == IPPROTO_TCP) {
+        r->tcp_spec.hdr.src_port = rec->src_port;
+        r->tcp_spec.hdr.dst_port = rec->dst_port;
+        r->tcp_mask.hdr.src_port = 0xFFFF;
+        r->tcp_mask.hdr.dst_port = 0xFFFF;
+        n = rule_item(r, n, RTE_FLOW_ITEM_TYPE_TCP, &r->tcp_spec, &r->tcp_mask);
+        r->tmpl = 1;
+    } else {
+        r->udp_spec[0].hdr.src_port = rec->src_port;
+        r->udp_spec[0].hdr.dst_port = rec->dst_port;
+        r->udp_mask[0].hdr.src_port = 0xFFFF;
+        r->udp_mask[0].hdr.dst_port = 0xFFFF;
+        n = rule_item(r, n, RTE_FLOW_ITEM_TYPE_UDP, &r->udp_spec[0], &r->udp_mask[0]);
+    }
+    r->pattern[n].type = RTE_FLOW_ITEM_TYPE_END;
+
+    r->queue.index = rte_be_to_cpu_16(rec->queue);
+    r->actions[0] = (struct rte_flow_action){ .type = RTE_FLOW_ACTION_TYPE_QUEUE, .conf = &r->queue };
+    r->actions[1] = (struct rte_flow_action){ .type = RTE_FLOW_ACTION_TYPE_END };
+}
+
+// Rule i of a shape. Addresses and ports are derived from i so every rule
+// is distinct: a = i / RULE_PORTS picks the address, p = i % RULE_PORTS the port.
+// File rules come from the record in slot i.
+static void rule_fill(int shape, uint32_t i, struct flow_rule *r) {
+    uint32_t a = i / RULE_PORTS;
+    uint16_t p = 10000 + i % RULE_PORTS;
+    int n = 0;
+
+    if (shape == SHAPE_FILE) {
+        rule_fill_rec(&slots[i].rec, r);
+        return;
+    }
+    memset(r, 0, sizeof(*r));
+    n = rule_item(r, n, RTE_FLOW_ITEM_TYPE_ETH, &r->eth_spec[0], &r->eth_mask[0]);
+
+    switch (shape) {
+    case SHAPE_5TUPLE:
+        r->ip_spec[0].hdr.src_addr = rte_cpu_to_be_32(RTE_IPV4(192, 168, 0, 0) + a);
+        r->ip_mask[0].hdr.src_addr = 0xFFFFFFFF;
+        r->udp_spec[0].hdr.src_port = rte_cpu_to_be_16(p);
+        r->udp_mask[0].hdr.src_port = 0xFFFF;
+        r->ip_spec[0].hdr.dst_addr = rte_cpu_to_be_32(RTE_IPV4(10, 0, 0, 1));
+        r->udp_spec[0].hdr.dst_port = rte_cpu_to_be_16(4000);
+        break;
+    case SHAPE_IPV6: {
+        static const uint8_t prefix[4] = { 0x20, 0x01, 0x0d, 0xb8 };   // 2001:db8::i
+        uint8_t *dst = (uint8_t *)&r->ip6_spec.hdr.dst_addr;
+        uint32_t be = rte_cpu_to_be_32(i);
+        memcpy(dst, prefix, sizeof(prefix));
+        memcpy(dst + 12, &be, sizeof(be));
+        memset(&r->ip6_mask.hdr.dst_addr, 0xFF, 16);
+        r->ip6_spec.hdr.proto = IPPROTO_UDP;
+        r->ip6_mask.hdr.proto = 0xFF;
+        r->udp_spec[0].hdr.dst_port = rte_cpu_to_be_16(4000);
+        r->udp_mask[0].hdr.dst_port = 0xFFFF;
+        n = rule_item(r, n, RTE_FLOW_ITEM_TYPE_IPV6, &r->ip6_spec, &r->ip6_mask);
+        n = rule_item(r, n, RTE_FLOW_ITEM_TYPE_UDP, &r->udp_spec[0], &r->udp_mask[0]);
+        break;
+    }
+    case SHAPE_VXLAN: {
+        uint32_t vni = 1 + a;
+        r->ip_spec[0].hdr.next_proto_id = IPPROTO_UDP;
+        r->udp_spec[0].hdr.dst_port = rte_cpu_to_be_16(4789);
+        r->udp_mask[0].hdr.dst_port = 0xFFFF;
+        r->vx_spec.flags = 0x08;
+        r->vx_spec.vni[0] = vni >> 16;
+        r->vx_spec.vni[1] = vni >> 8;
+        r->vx_spec.vni[2] = vni;
+        memset(r->vx_mask.vni, 0xFF, sizeof(r->vx_mask.vni));
+        r->ip_spec[1].hdr.next_proto_id = IPPROTO_UDP;
+        r->ip_mask[1].hdr.next_proto_id = 0xFF;
+        r->udp_spec[1].hdr.dst_port = rte_cpu_to_be_16(p);
+        r->udp_mask[1].hdr.dst_port = 0xFFFF;
+        n = rule_item(r, n, RTE_FLOW_ITEM_TYPE_IPV4, &r->ip_spec[0], &r->ip_mask[0]);
+        n = rule_item(r, n, RTE_FLOW_ITEM_TYPE_UDP, &r->udp_spec[0], &r->udp_mask[0]);
+        n = rule_item(r, n, RTE_FLOW_ITEM_TYPE_VXLAN, &r->vx_spec, &r->vx_mask);
+        n = rule_item(r, n, RTE_FLOW_ITEM_TYPE_ETH, &r->eth_spec[1], &r->eth_mask[1]);
+        n = rule_item(r, n, RTE_FLOW_ITEM_TYPE_IPV4, &r->ip_spec[1], &r->ip_mask[1]);
+        n = rule_item(r, n, RTE_FLOW_ITEM_TYPE_UDP, &r->udp_spec[1], &r->udp_mask[1]);
+        break;
+    }
+    default:    // SHAPE_UDP, SHAPE_MARK_RSS
+        r->ip_spec[0].hdr.dst_addr = rte_cpu_to_be_32(RTE_IPV4(10, 0, 0, 0) + a);
+        r->udp_spec[0].hdr.dst_port = rte_cpu_to_be_16(p);
+        break;
+    }
+
+    if (shape == SHAPE_UDP || shape == SHAPE_5TUPLE || shape == SHAPE_MARK_RSS) {
+        r->ip_spec[0].hdr.next_proto_id = IPPROTO_UDP;
+        r->ip_mask[0].hdr.next_proto_id = 0xFF;
+        r->ip_mask[0].hdr.dst_addr = 0xFFFFFFFF;
+        r->udp_mask[0].hdr.dst_port = 0xFFFF;
+        n = rule_item(r, n, RTE_FLOW_ITEM_TYPE_IPV4, &r->ip_spec[0], &r->ip_mask[0]);
+        n = rule_item(r, n, RTE_FLOW_ITEM_TYPE_UDP, &r->udp_spec[0], &r->udp_mask[0]);
+    }
+    r->pattern[n].type = RTE_FLOW_ITEM_TYPE_END;
+
+    n = 0;
+    if (shape == SHAPE_MARK_RSS) {
+        r->mark.id = i + 1;
+        r->actions[n++] = (struct rte_flow_action){ .type = RTE_FLOW_ACTION_TYPE_MARK, .conf = &r->mark };
+    }
+    if (opt_steer > 0) {
+        // counted; RSS over the shared queues, or over the one it is pinned to
+        uint16_t pin = slots[i].steer;
+        r->rss = (struct rte_flow_action_rss){
+            .func = RTE_ETH_HASH_FUNCTION_DEFAULT,
+            .types = RTE_ETH_RSS_IP | RTE_ETH_RSS_UDP,
+            .queue_num = pin ? 1 : opt_rxq - opt_steer,
+            .queue = pin ? &rss_queues[pin - 1] : rss_queues,
+        };
+        r->actions[n++] = (struct rte_flow_action){ .type = RTE_FLOW_ACTION_TYPE_COUNT };
+        r->actions[n++] = (struct rte_flow_action){ .type = RTE_FLOW_ACTION_TYPE_RSS, .conf = &r->rss };
+    } else if (shape == SHAPE_MARK_RSS) {
+        r->rss = (struct rte_flow_action_rss){
+            .func = RTE_ETH_HASH_FUNCTION_DEFAULT,
+            .types = RTE_ETH_RSS_IP | RTE_ETH_RSS_UDP,
+            .queue_num = opt_rxq,
+            .queue = rss_queues,
+        };
+        r->actions[n++] = (struct rte_flow_action){ .type = RTE_FLOW_ACTION_TYPE_RSS, .conf = &r->rss };
+    } else {
+        r->queue.index = 0;
+        r->actions[n++] = (struct rte_flow_action){ .type = RTE_FLOW_ACTION_TYPE_QUEUE, .conf = &r->queue };
+    }
+    r->actions[n].type = RTE_FLOW_ACTION_TYPE_END;
+}
+
+// A rule carrying the masks every rule of the shape uses (templates and the
+// software key); file rules have a UDP and a TCP variant (tmpl 0 and 1).
+static void rule_fill_sample(int shape, int tmpl, struct flow_rule *r) {
+    if (shape == SHAPE_FILE) {
+        const struct rule_rec rec = { .proto = tmpl ? IPPROTO_TCP : IPPROTO_UDP };
+        rule_fill_rec(&rec, r);
+    } else {
+        rule_fill(shape, 0, r);
+    }
+}
+
+// New actions for an installed rule: next RX queue, or the next mark value.
+// File and steered rules already carry the new action in their slot.
+static void rule_update(int shape, struct flow_rule *r) {
+    if (shape == SHAPE_FILE || opt_steer > 0)
+        return;
+    r->queue.index = (r->queue.index + 1) % opt_rxq;
+    r->mark.id++;
+}
+
+static void print_report(const char *mode, uint32_t ok, uint32_t failed, uint64_t cycles,
+                         const struct lat_hist *lat) {
+    double s = cycles * ns_per_cycle / 1e9;
+    printf("%s: %u rules in %.3f s (%u failed), %.0f rules/s\n",
+           mode, ok, s, failed, s > 0 ? ok / s : 0.0);
+    printf("  insertion latency: p50=%.1f p90=%.1f p99=%.1f p99.9=%.1f max=%.1f us\n",
+           lat_hist_percentile(lat, 50.0) / 1e3, lat_hist_percentile(lat, 90.0) / 1e3,
+           lat_hist_percentile(lat, 99.0) / 1e3, lat_hist_percentile(lat, 99.9) / 1e3,
+           lat->max / 1e3);
+}
+
+// ---------------- sync path ----------------
+
+static int flow_update(struct rte_flow *flow, const struct rte_flow_action *actions,
+                       struct rte_flow_error *error) {
+#ifdef HAVE_FLOW_UPDATE
+    return rte_flow_actions_update(port_id, flow, actions, error);
+#else
+    return -ENOTSUP;
+#endif
+}
+
+// Rule k of a run: ids[k] for a list of rules, k itself for an id range.
+static inline uint32_t op_rule(const uint32_t *ids, uint32_t k) {
+    return ids ? ids[k] : k;
+}
+
+// Applies op to rules [first, last) (or ids[first .. last)). A failed create
+// stops the run (the table is full or the shape is unsupported); other
+// failures are counted.
+static uint32_t sync_run(int op, int shape, uint32_t first, uint32_t last, const uint32_t *ids,
+                         struct lat_hist *lat, uint32_t *failed) {
+    const struct rte_flow_attr attr = { .ingress = 1 };
+    struct rte_flow_error error;
+    struct flow_rule r;
+    uint32_t ok = 0;
+
+    for (uint32_t k = first; k < last && (keep_running || op == FLOW_OP_DESTROY); k++) {
+        uint32_t i = op_rule(ids, k);
+        uint64_t t0;
+        int rc;
+
+        if (op == FLOW_OP_CREATE ? slots[i].flow != NULL : slots[i].flow == NULL)
+            continue;
+        slots[i].op_failed = 0;
+        if (op != FLOW_OP_DESTROY)
+            rule_fill(shape, i, &r);
+        if (op == FLOW_OP_CREATE) {
+            t0 = rte_rdtsc();
+            slots[i].flow = rte_flow_create(port_id, &attr, r.pattern, r.actions, &error);
+            rc = slots[i].flow ? 0 : -1;
+        } else if (op == FLOW_OP_UPDATE) {
+            rule_update(shape, &r);
+            t0 = rte_rdtsc();
+            rc = flow_update(slots[i].flow, r.actions, &error);
+        } else {
+            t0 = rte_rdtsc();
+            rc = rte_flow_destroy(port_id, slots[i].flow, &error);
+            if (rc == 0)
+                slots[i].flow = NULL;
+        }
+        uint64_t t1 = rte_rdtsc();
+
+        if (rc != 0) {
+            slots[i].op_failed = 1;
+            if (op == FLOW_OP_CREATE) {
+                printf("Rule %u creation failed: %s\n", i, error.message ? error.message : "(no message)");
+                *failed += last - k;
+                break;
+            }
+            (*failed)++;
+            continue;
+        }
+        lat_hist_record(lat, (uint64_t)((t1 - t0) * ns_per_cycle));
+        ok++;
+
+        if (op == FLOW_OP_CREATE && !opt_bench && (k + 1) % 10000 == 0)
+            printf("Created %u rules...\n", k + 1);
+    }
+    return ok;
+}
+
+// ---------------- async path ----------------
+
+#ifdef HAVE_FLOW_ASYNC
+static struct rte_flow_pattern_template *pattern_tmpl[2];
+static uint8_t nb_pattern_tmpl;
+static struct rte_flow_actions_template *actions_tmpl;
+static struct rte_flow_template_table *table;
+static uint16_t nb_flow_queues;
+static uint32_t flow_queue_size;
+
+// One flow queue, driven by one lcore; rule i goes to queue i % nb_queues.
+struct flow_queue {
+    uint16_t id;
+    uint16_t nb_queues;
+    int op, shape;
+    uint32_t first, last;
+    const uint32_t *ids;
+    uint32_t ok, failed;
+    uint32_t inflight;
+    struct lat_hist lat;
+} __rte_cache_aligned;
+static struct flow_queue fq[MAX_FLOW_QUEUES];
+
+// Before rte_eth_dev_start. Returns the number of flow queues, 0 if unsupported.
+static uint16_t async_configure(uint16_t nb_queues) {
+    struct rte_flow_port_info port_info;
+    struct rte_flow_queue_info queue_info;
+    struct rte_flow_error error;
+
+    memset(&port_info, 0, sizeof(port_info));
+    memset(&queue_info, 0, sizeof(queue_info));
+    if (rte_flow_info_get(port_id, &port_info, &queue_info, &error) != 0) {
+        printf("Async flow API not supported: %s\n", error.message ? error.message : "(no message)");
+        return 0;
+    }
+    if (port_info.max_nb_queues && nb_queues > port_info.max_nb_queues)
+        nb_queues = port_info.max_nb_queues;
+    if (nb_queues > rte_lcore_count())
+        nb_queues = rte_lcore_count();
+
+    flow_queue_size = FLOW_QUEUE_SIZE;
+    if (queue_info.max_size && flow_queue_size > queue_info.max_size)
+        flow_queue_size = queue_info.max_size;
+
+    // steered rules each hold a counter
+    const struct rte_flow_port_attr port_attr = { .nb_counters = opt_steer > 0 ? opt_rules : 0 };
+    const struct rte_flow_queue_attr queue_attr = { .size = flow_queue_size };
+    const struct rte_flow_queue_attr *queue_attrs[MAX_FLOW_QUEUES];
+    for (uint16_t q = 0; q < nb_queues; q++)
+        queue_attrs[q] = &queue_attr;
+
+    if (rte_flow_configure(port_id, &port_attr, nb_queues, queue_attrs, &error) != 0) {
+        printf("rte_flow_configure failed: %s\n", error.message ? error.message : "(no message)");
+        return 0;
+    }
+    return nb_queues;
+}
+
+// After start: the pattern templates carry the masks of the shape (values
+// come from each rule; file rules need a UDP and a TCP one), the actions
+// template leaves every action conf unmasked so it is per rule too.
+static int async_templates(int shape, uint32_t nb_rules) {
+    const struct rte_flow_pattern_template_attr pt_attr = { .relaxed_matching = 0, .ingress = 1 };
+    const struct rte_flow_actions_template_attr at_attr = { .ingress = 1 };
+    struct flow_rule r;
+    struct rte_flow_action action_masks[RTE_DIM(r.actions)];
+    struct rte_flow_item items[MAX_ITEMS + 1];
+    struct rte_flow_error error;
+
+    for (int t = 0; t < (shape == SHAPE_FILE ? 2 : 1); t++) {
+        rule_fill_sample(shape, t, &r);
+        for (int k = 0; k <= MAX_ITEMS; k++) {
+            items[k] = r.pattern[k];
+            items[k].spec = NULL;
+            if (items[k].type == RTE_FLOW_ITEM_TYPE_END)
+                break;
+        }
+        pattern_tmpl[t] = rte_flow_pattern_template_create(port_id, &pt_attr, items, &error);
+        if (!pattern_tmpl[t]) {
+            printf("Pattern template failed: %s\n", error.message ? error.message : "(no message)");
+            return -1;
+        }
+        nb_pattern_tmpl++;
+    }
+    for (unsigned k = 0; k < RTE_DIM(r.actions); k++) {
+        action_masks[k] = (struct rte_flow_action){ .type = r.actions[k].type, .conf = NULL };
+        if (r.actions[k].type == RTE_FLOW_ACTION_TYPE_END)
+            break;
+    }
+
+    actions_tmpl = rte_flow_actions_template_create(port_id, &at_attr, r.actions, action_masks, &error);
+    if (!actions_tmpl) {
+        printf("Actions template failed: %s\n", error.message ? error.message : "(no message)");
+        return -1;
+    }
+
+    const struct rte_flow_template_table_attr table_attr = {
+        .flow_attr = { .group = 0, .ingress = 1 },
+        .nb_flows = nb_rules,
+    };
+    table = rte_flow_template_table_create(port_id, &table_attr, pattern_tmpl, nb_pattern_tmpl,
+                                           &actions_tmpl, 1, &error);
+    if (!table) {
+        printf("Template table failed: %s\n", error.message ? error.message : "(no message)");
+        return -1;
+    }
+    return 0;
+}
+
+static void async_templates_destroy(void) {
+    struct rte_flow_error error;
+
+    if (table)
+        rte_flow_template_table_destroy(port_id, table, &error);
+    if (actions_tmpl)
+        rte_flow_actions_template_destroy(port_id, actions_tmpl, &error);
+    for (uint8_t t = 0; t < nb_pattern_tmpl; t++)
+        rte_flow_pattern_template_destroy(port_id, pattern_tmpl[t], &error);
+    table = NULL;
+    actions_tmpl = NULL;
+    nb_pattern_tmpl = 0;
+}
+
+// Destroys are drained even after Ctrl+C.
+static inline bool async_active(const struct flow_queue *q) {
+    return keep_running || q->op == FLOW_OP_DESTROY;
+}
+
+// Collect completions; user_data is the rule id + 1.
+static void async_pull(struct flow_queue *q) {
+    struct rte_flow_op_result res[FLOW_PULL_BURST];
+    struct rte_flow_error error;
+
+    int n = rte_flow_pull(port_id, q->id, res, FLOW_PULL_BURST, &error);
+    if (n <= 0)
+        return;
+    uint64_t now = rte_rdtsc();
+    for (int k = 0; k < n; k++) {
+        uint32_t i = (uint32_t)((uintptr_t)res[k].user_data - 1);
+        q->inflight--;
+        if (res[k].status == RTE_FLOW_OP_SUCCESS) {
+            q->ok++;
+            lat_hist_record(&q->lat, (uint64_t)((now - slots[i].enq_tsc) * ns_per_cycle));
+        } else {
+            q->failed++;
+            slots[i].op_failed = 1;
+            if (q->op == FLOW_OP_CREATE)
+                slots[i].flow = NULL;
+        }
+    }
+}
+
+// Push what is postponed and wait until the queue has room for 'want' more ops.
+static void async_make_room(struct flow_queue *q, uint32_t want) {
+    struct rte_flow_error error;
+
+    rte_flow_push(port_id, q->id, &error);
+    while (q->inflight + want > flow_queue_size && async_active(q))
+        async_pull(q);
+}
+
+static int async_run_queue(void *arg) {
+    struct flow_queue *q = arg;
+    const struct rte_flow_op_attr postpone = { .postpone = 1 };
+    struct rte_flow_error error;
+    struct flow_rule r;
+    uint32_t pending = 0;
+
+    for (uint32_t k = q->first + q->id; k < q->last && async_active(q); k += q->nb_queues) {
+        uint32_t i = op_rule(q->ids, k);
+        void *tag = (void *)(uintptr_t)(i + 1);
+        int rc;
+
+        if (q->op == FLOW_OP_CREATE ? slots[i].flow != NULL : slots[i].flow == NULL)
+            continue;
+        if (q->inflight >= flow_queue_size) {
+            async_make_room(q, 1);
+            pending = 0;
+        }
+        if (q->op != FLOW_OP_DESTROY)
+            rule_fill(q->shape, i, &r);
+        slots[i].op_failed = 0;
+        slots[i].enq_tsc = rte_rdtsc();
+        if (q->op == FLOW_OP_CREATE) {
+            slots[i].flow = rte_flow_async_create(port_id, q->id, &postpone, table, r.pattern, r.tmpl,
+                                                  r.actions, 0, tag, &error);
+            rc = slots[i].flow ? 0 : -1;
+        } else if (q->op == FLOW_OP_UPDATE) {
+            rule_update(q->shape, &r);
+#ifdef HAVE_FLOW_UPDATE
+            rc = rte_flow_async_actions_update(port_id, q->id, &postpone, slots[i].flow, r.actions, 0,
+                                               tag, &error);
+#else
+            rc = -ENOTSUP;
+#endif
+        } else {
+            rc = rte_flow_async_destroy(port_id, q->id, &postpone, slots[i].flow, tag, &error);
+            if (rc == 0)
+                slots[i].flow = NULL;
+        }
+        if (rc != 0) {
+            q->failed++;
+            slots[i].op_failed = 1;
+            continue;
+        }
+        q->inflight++;
+        if (++pending >= opt_batch) {
+            rte_flow_push(port_id, q->id, &error);
+            pending = 0;
+        }
+        async_pull(q);
+    }
+    async_make_room(q, flow_queue_size);   // everything completed
+    return 0;
+}
+
+// Splits [first, last) over the flow queues: queue 0 runs on the calling
+// lcore, the others on idle worker lcores (inline after queue 0 if none
+// is left, e.g. when the software classifier holds them).
+static uint32_t async_run(int op, int shape, uint32_t first, uint32_t last, const uint32_t *ids,
+                          struct lat_hist *lat, uint32_t *failed) {
+    unsigned lcores[MAX_FLOW_QUEUES];
+    bool used[RTE_MAX_LCORE] = { false };
+    uint32_t ok = 0;
+
+    for (uint16_t q = 0; q < nb_flow_queues; q++) {
+        memset(&fq[q], 0, sizeof(fq[q]));
+        fq[q].id = q;
+        fq[q].nb_queues = nb_flow_queues;
+        fq[q].op = op;
+        fq[q].shape = shape;
+        fq[q].first = first;
+        fq[q].last = last;
+        fq[q].ids = ids;
+    }
+    for (uint16_t q = 1; q < nb_flow_queues; q++) {
+        lcores[q] = numa_pick_lcore(numa_port_socket(port_id), used);
+        if (lcores[q] == RTE_MAX_LCORE)
+            continue;
+        used[lcores[q]] = true;
+        rte_eal_remote_launch(async_run_queue, &fq[q], lcores[q]);
+    }
+    async_run_queue(&fq[0]);
+    for (uint16_t q = 1; q < nb_flow_queues; q++) {
+        if (lcores[q] == RTE_MAX_LCORE)
+            async_run_queue(&fq[q]);
+        else
+            rte_eal_wait_lcore(lcores[q]);
+    }
+
+    for (uint16_t q = 0; q < nb_flow_queues; q++) {
+        lat_hist_merge(lat, &fq[q].lat);
+        ok += fq[q].ok;
+        *failed += fq[q].failed;
+    }
+    return ok;
+}
+#endif // HAVE_FLOW_ASYNC
+
+// Applies op to rules [first, last), or to ids[first .. last) when ids is
+// given, through flow queues or the sync API.
+static uint32_t run_ops(int op, int shape, uint32_t first, uint32_t last, const uint32_t *ids,
+                        struct lat_hist *lat, uint32_t *failed) {
+#ifdef HAVE_FLOW_ASYNC
+    if (use_async)
+        return async_run(op, shape, first, last, ids, lat, failed);
+#endif
+    return sync_run(op, shape, first, last, ids, lat, failed);
+}
+
+// One op on one rule; returns once it has completed.
+static bool flow_op_one(int op, int shape, uint32_t i) {
+    static struct lat_hist lat;
+    uint32_t failed = 0;
+
+#ifdef HAVE_FLOW_ASYNC
+    if (use_async) {
+        struct flow_queue *q = &fq[0];
+        memset(q, 0, sizeof(*q));
+        q->nb_queues = 1;
+        q->op = op;
+        q->shape = shape;
+        q->first = i;
+        q->last = i + 1;
+        async_run_queue(q);
+        return q->ok == 1;
+    }
+#endif
+    return sync_run(op, shape, i, i + 1, NULL, &lat, &failed) == 1;
+}
+
+static bool flow_create_one(int shape, uint32_t i) {
+    return flow_op_one(FLOW_OP_CREATE, shape, i);
+}
+
+// Creates the async templates for a shape, or falls back to sync.
+static void flow_mode_select(int shape, uint32_t nb_rules) {
+    use_async = false;
+#ifdef HAVE_FLOW_ASYNC
+    if (nb_flow_queues > 0) {
+        use_async = async_templates(shape, nb_rules) == 0;
+        if (!use_async)
+            async_templates_destroy();
+    }
+#endif
+    if (opt_async && !use_async)
+        printf("Falling back to synchronous rte_flow_create\n");
+}
+
+static void flow_mode_release(void) {
+#ifdef HAVE_FLOW_ASYNC
+    if (use_async)
+        async_templates_destroy();
+#endif
+    use_async = false;
+}
+
+// Removes rules [first, last) from the NIC in one go and reports how long
+// it took. Sync: a single rte_flow_flush for the port (every rule on it is
+// ours), per-rule destroys if the PMD has no flush. Async: batched destroys
+// on every flow queue, since template table rules are not flushed.
+static void rules_flush(int shape, uint32_t first, uint32_t last) {
+    static struct lat_hist lat;
+    struct rte_flow_error error;
+    uint32_t n = 0, failed = 0;
+    const char *how;
+
+    for (uint32_t i = first; i < last; i++)
+        n += slots[i].flow != NULL;
+    uint64_t t0 = rte_rdtsc();
+    if (!use_async && rte_flow_flush(port_id, &error) == 0) {
+        for (uint32_t i = first; i < last; i++)
+            slots[i].flow = NULL;
+        how = "rte_flow_flush";
+    } else {
+        if (!use_async)
+            printf("rte_flow_flush failed: %s, destroying rules one by one\n",
+                   error.message ? error.message : "(no message)");
+        lat_hist_init(&lat);
+        run_ops(FLOW_OP_DESTROY, shape, first, last, NULL, &lat, &failed);
+        how = use_async ? "batched async destroy" : "rte_flow_destroy";
+    }
+    double s = (rte_rdtsc() - t0) * ns_per_cycle / 1e9;
+    printf("Removed %u rules in %.3f s (%s), %.0f rules/s\n",
+           n - failed, s, how, s > 0 ? (n - failed) / s : 0.0);
+}
+
+// ---------------- software fallback ----------------
+
+// Masked IPv4 5-tuple, the rte_hash key.
+struct sw_key {
+    uint32_t src_addr, dst_addr;
+    uint16_t src_port, dst_port;
+    uint8_t proto;
+    uint8_t pad[3];
+};
+
+// One RX queue polled by one worker lcore; counters have a single writer.
+struct sw_worker {
+    uint16_t queue;
+    unsigned lcore;
+    uint64_t rx;
+    uint64_t hw_marked;     // already classified by the NIC (MARK)
+    uint64_t sw_hits;
+    uint64_t miss;          // no software rule (NIC QUEUE rules land here too)
+} __rte_cache_aligned;
+
+static struct rte_hash *sw_hash;
+static struct rte_rcu_qsbr *sw_qsv;
+static struct sw_key sw_mask;       // the mask every rule of the shape uses
+static uint32_t sw_rules, hw_rules;
+static struct sw_worker sw_workers[MAX_RXQ];
+static uint16_t nb_sw_workers;
+static volatile bool sw_running;
+
+static bool sw_supported(int shape) {
+    return shape == SHAPE_UDP || shape == SHAPE_5TUPLE || shape == SHAPE_MARK_RSS || shape == SHAPE_FILE;
+}
+
+static void sw_key_from_rule(const struct flow_rule *r, struct sw_key *key, struct sw_key *mask) {
+    const struct rte_ipv4_hdr *ip = &r->ip_spec[0].hdr, *ipm = &r->ip_mask[0].hdr;
+    const struct rte_udp_hdr *udp = &r->udp_spec[0].hdr, *udpm = &r->udp_mask[0].hdr;
+    bool tcp = ip->next_proto_id == IPPROTO_TCP;
+
+    memset(key, 0, sizeof(*key));
+    memset(mask, 0, sizeof(*mask));
+    mask->src_addr = ipm->src_addr;
+    mask->dst_addr = ipm->dst_addr;
+    mask->src_port = tcp ? r->tcp_mask.hdr.src_port : udpm->src_port;
+    mask->dst_port = tcp ? r->tcp_mask.hdr.dst_port : udpm->dst_port;
+    mask->proto = ipm->next_proto_id;
+    key->src_addr = ip->src_addr & mask->src_addr;
+    key->dst_addr = ip->dst_addr & mask->dst_addr;
+    key->src_port = (tcp ? r->tcp_spec.hdr.src_port : udp->src_port) & mask->src_port;
+    key->dst_port = (tcp ? r->tcp_spec.hdr.dst_port : udp->dst_port) & mask->dst_port;
+    key->proto = ip->next_proto_id & mask->proto;
+}
+
+// Masked key of an IPv4 UDP/TCP packet (the ports sit at the same offsets);
+// false for anything else.
+static inline bool sw_pkt_key(const struct rte_mbuf *m, struct sw_key *key) {
+    const struct rte_ether_hdr *eth = rte_pktmbuf_mtod(m, const struct rte_ether_hdr *);
+    if (eth->ether_type != rte_cpu_to_be_16(RTE_ETHER_TYPE_IPV4))
+        return false;
+    const struct rte_ipv4_hdr *ip = (const struct rte_ipv4_hdr *)(eth + 1);
+    unsigned ihl = (ip->version_ihl & 0x0F) * 4;
+    if (rte_pktmbuf_data_len(m) < sizeof(*eth) + ihl + 4 ||
+        (ip->next_proto_id != IPPROTO_UDP && ip->next_proto_id != IPPROTO_TCP))
+        return false;
+    const struct rte_udp_hdr *l4 = (const struct rte_udp_hdr *)((const uint8_t *)ip + ihl);
+
+    key->src_addr = ip->src_addr & sw_mask.src_addr;
+    key->dst_addr = ip->dst_addr & sw_mask.dst_addr;
+    key->src_port = l4->src_port & sw_mask.src_port;
+    key->dst_port = l4->dst_port & sw_mask.dst_port;
+    key->proto = ip->next_proto_id & sw_mask.proto;
+    memset(key->pad, 0, sizeof(key->pad));
+    return true;
+}
+
+static int sw_init(int shape) {
+    int socket = numa_port_socket(port_id);
+    struct flow_rule r;
+    struct sw_key key;
+
+    if (!sw_supported(shape)) {
+        printf("Software fallback covers the udp, 5tuple, mark-rss and rule file shapes only\n");
+        return -1;
+    }
+    rule_fill_sample(shape, 0, &r);
+    sw_key_from_rule(&r, &key, &sw_mask);
+
+    struct rte_hash_parameters params = {
+        .name = "flow_tc_sw",
+        .entries = slot_cap,
+        .key_len = sizeof(struct sw_key),
+        .hash_func = rte_hash_crc,
+        .socket_id = socket,
+        // overflow buckets: a plain cuckoo table can be full well before 'entries'
+        .extra_flag = RTE_HASH_EXTRA_FLAGS_RW_CONCURRENCY_LF | RTE_HASH_EXTRA_FLAGS_EXT_TABLE,
+    };
+    sw_hash = rte_hash_create(&params);
+    if (!sw_hash) {
+        printf("Cannot create software flow table\n");
+        return -1;
+    }
+
+    // deleted keys are freed once every worker has passed a quiescent state
+    sw_qsv = rte_zmalloc_socket("flow_tc_qsbr", rte_rcu_qsbr_get_memsize(RTE_MAX_LCORE),
+                                RTE_CACHE_LINE_SIZE, socket);
+    if (!sw_qsv || rte_rcu_qsbr_init(sw_qsv, RTE_MAX_LCORE) != 0)
+        return -1;
+    struct rte_hash_rcu_config rcu = { .v = sw_qsv, .mode = RTE_HASH_QSBR_MODE_DQ };
+    if (rte_hash_rcu_qsbr_add(sw_hash, &rcu) != 0) {
+        printf("Cannot attach RCU to the software flow table\n");
+        return -1;
+    }
+    return 0;
+}
+
+static void sw_free(void) {
+    if (sw_hash)
+        rte_hash_free(sw_hash);
+    rte_free(sw_qsv);
+    sw_hash = NULL;
+    sw_qsv = NULL;
+}
+
+// Hash data is the rule id + 1, the value a mark-rss rule's MARK carries.
+static int sw_add(int shape, uint32_t i) {
+    struct flow_rule r;
+    struct sw_key key, mask;
+
+    rule_fill(shape, i, &r);
+    sw_key_from_rule(&r, &key, &mask);
+    int rc = rte_hash_add_key_data(sw_hash, &key, (void *)(uintptr_t)(i + 1));
+    if (rc == 0) {
+        slots[i].in_sw = 1;
+        sw_rules++;
+    }
+    return rc;
+}
+
+static void sw_del(int shape, uint32_t i) {
+    struct flow_rule r;
+    struct sw_key key, mask;
+
+    rule_fill(shape, i, &r);
+    sw_key_from_rule(&r, &key, &mask);
+    if (rte_hash_del_key(sw_hash, &key) >= 0) {
+        slots[i].in_sw = 0;
+        sw_rules--;
+    }
+}
+
+// Every rule of [first, last) (or ids[first .. last)) the NIC does not
+// hold goes into software.
+static uint32_t sw_adopt(int shape, uint32_t first, uint32_t last, const uint32_t *ids) {
+    uint32_t n = 0;
+
+    for (uint32_t k = first; k < last; k++) {
+        uint32_t i = op_rule(ids, k);
+        if (!slots[i].flow && !slots[i].in_sw && sw_add(shape, i) == 0)
+            n++;
+    }
+    return n;
+}
+
+static int sw_worker_loop(void *arg) {
+    struct sw_worker *w = arg;
+    struct rte_mbuf *pkts[SW_BURST];
+    struct sw_key keys[SW_BURST];
+    const void *key_ptrs[SW_BURST];
+    void *data[SW_BURST];
+    uint16_t idx[SW_BURST];
+    unsigned tid = rte_lcore_id();
+
+    rte_rcu_qsbr_thread_register(sw_qsv, tid);
+    rte_rcu_qsbr_thread_online(sw_qsv, tid);
+    while (sw_running) {
+        uint16_t n = rte_eth_rx_burst(port_id, w->queue, pkts, SW_BURST), nk = 0;
+
+        w->rx += n;
+        for (uint16_t k = 0; k < n; k++) {
+            if (pkts[k]->ol_flags & RTE_MBUF_F_RX_FDIR_ID) {
+                w->hw_marked++;
+            } else if (sw_pkt_key(pkts[k], &keys[nk])) {
+                key_ptrs[nk] = &keys[nk];
+                idx[nk++] = k;
+            } else {
+                w->miss++;
+            }
+        }
+        if (nk > 0) {
+            uint64_t hits = 0;
+            rte_hash_lookup_bulk_data(sw_hash, key_ptrs, nk, &hits, data);
+            for (uint16_t j = 0; j < nk; j++) {
+                if (!(hits & (1ULL << j))) {
+                    w->miss++;
+                    continue;
+                }
+                // tag it the way the NIC's MARK would; flow_tc is a sink,
+                // a forwarder would act on the rule here
+                struct rte_mbuf *m = pkts[idx[j]];
+                m->hash.fdir.hi = (uint32_t)(uintptr_t)data[j];
+                m->ol_flags |= RTE_MBUF_F_RX_FDIR | RTE_MBUF_F_RX_FDIR_ID;
+                w->sw_hits++;
+            }
+        }
+        if (n > 0)
+            rte_pktmbuf_free_bulk(pkts, n);
+        rte_rcu_qsbr_quiescent(sw_qsv, tid);
+    }
+    rte_rcu_qsbr_thread_offline(sw_qsv, tid);
+    rte_rcu_qsbr_thread_unregister(sw_qsv, tid);
+    return 0;
+}
+
+// Plain RX sink for --steer without --sw-fallback: drains and counts.
+static int rx_count_loop(void *arg) {
+    struct sw_worker *w = arg;
+    struct rte_mbuf *pkts[SW_BURST];
+
+    while (sw_running) {
+        uint16_t n = rte_eth_rx_burst(port_id, w->queue, pkts, SW_BURST);
+        if (n > 0) {
+            w->rx += n;
+            rte_pktmbuf_free_bulk(pkts, n);
+        }
+    }
+    return 0;
+}
+
+// One worker per RX queue running loop, on the port's socket when possible.
+static void sw_start(lcore_function_t *loop) {
+    bool used[RTE_MAX_LCORE] = { false };
+
+    sw_running = true;
+    for (uint16_t q = 0; q < opt_rxq; q++) {
+        unsigned lcore = numa_pick_lcore(numa_port_socket(port_id), used);
+        if (lcore == RTE_MAX_LCORE) {
+            printf("Warning: no lcore left for RX queue %u, it is not classified\n", q);
+            break;
+        }
+        used[lcore] = true;
+        numa_check_lcore(lcore, port_id);
+        sw_workers[q] = (struct sw_worker){ .queue = q, .lcore = lcore };
+        rte_eal_remote_launch(loop, &sw_workers[q], lcore);
+        nb_sw_workers++;
+    }
+}
+
+static void sw_stop(void) {
+    sw_running = false;
+    for (uint16_t q = 0; q < nb_sw_workers; q++)
+        rte_eal_wait_lcore(sw_workers[q].lcore);
+    nb_sw_workers = 0;
+}
+
+// Moves software rules into the NIC, SW_MIGRATE_BATCH per call. When the
+// NIC refuses, the next attempt waits twice as long (up to SW_RETRY_MAX_S).
+static void sw_promote(int shape) {
+    static uint32_t scan;
+    static unsigned wait_s = 1, left_s;
+    uint32_t moved = 0;
+
+    if (sw_rules == 0 || hw_rules >= opt_hw_max)
+        return;
+    if (left_s > 0) {
+        left_s--;
+        return;
+    }
+    for (; scan < slot_hwm && moved < SW_MIGRATE_BATCH && hw_rules < opt_hw_max; scan++) {
+        if (!slots[scan].in_sw)
+            continue;
+        if (slots[scan].flow) {
+            // already back in the NIC (re-created elsewhere), drop the copy
+            sw_del(shape, scan);
+            continue;
+        }
+        if (!flow_create_one(shape, scan)) {
+            wait_s = RTE_MIN(wait_s * 2, SW_RETRY_MAX_S);
+            left_s = wait_s;
+            break;
+        }
+        // the NIC rule is live before the software one goes away
+        sw_del(shape, scan);
+        hw_rules++;
+        moved++;
+    }
+    if (scan >= slot_hwm)
+        scan = 0;
+    if (moved > 0) {
+        if (left_s == 0)
+            wait_s = 1;
+        printf("Moved %u rules from software to the NIC\n", moved);
+    }
+}
+
+static void sw_report(void) {
+    uint64_t hw_marked = 0, sw_hits = 0, miss = 0;
+
+    for (uint16_t q = 0; q < nb_sw_workers; q++) {
+        hw_marked += sw_workers[q].hw_marked;
+        sw_hits += sw_workers[q].sw_hits;
+        miss += sw_workers[q].miss;
+    }
+    printf("Rules: %u in NIC, %u in software | packets: %" PRIu64 " NIC-marked, %" PRIu64
+           " software hits, %" PRIu64 " unmatched\n", hw_rules, sw_rules, hw_marked, sw_hits, miss);
+}
+
+// ---------------- rule files ----------------
+
+// Binary rule file: this header, then count rule_rec records. Every field
+// is in network order, so a file is mapped and used as it is.
+#define RULE_FILE_MAGIC "FTCR"
+#define RULE_FILE_VERSION 1
+
+struct rule_file_hdr {
+    char magic[4];
+    uint32_t version;
+    uint32_t count;
+    uint32_t reserved;
+};
+
+struct rule_set {
+    const struct rule_rec *recs;
+    uint32_t count;
+    void *map;                      // binary file mapping, NULL for text
+    size_t map_len;
+    struct rule_rec *owned;         // records parsed from text
+};
+
+static struct rte_hash *rule_index; // 5-tuple of a file rule -> its id
+static uint32_t rule_gen;           // bumped by every rules_apply
+static uint32_t file_rules;         // ids holding a file rule
+static int watch_fd = -1;
+static const char *watch_name;      // the rule file's name in the watched directory
+
+static bool rule_rec_valid(const struct rule_rec *rec) {
+    return (rec->proto == IPPROTO_UDP || rec->proto == IPPROTO_TCP) &&
+           rte_be_to_cpu_16(rec->queue) < opt_rxq;
+}
+
+static void rule_rec_key(const struct rule_rec *rec, struct sw_key *key) {
+    *key = (struct sw_key){
+        .src_addr = rec->src_addr, .dst_addr = rec->dst_addr,
+        .src_port = rec->src_port, .dst_port = rec->dst_port, .proto = rec->proto,
+    };
+}
+
+// "src dst sport dport proto [queue]": dotted IPv4 addresses, proto udp,
+// tcp, 17 or 6, queue 0 if left out.
+static int rule_parse_line(const char *line, struct rule_rec *rec) {
+    char src[64], dst[64], proto[16];
+    unsigned sport, dport, queue = 0;
+    struct in_addr a, b;
+
+    int n = sscanf(line, "%63s %63s %u %u %15s %u", src, dst, &sport, &dport, proto, &queue);
+    if (n < 5 || inet_pton(AF_INET, src, &a) != 1 || inet_pton(AF_INET, dst, &b) != 1 ||
+        sport > UINT16_MAX || dport > UINT16_MAX || queue > UINT16_MAX)
+        return -1;
+    memset(rec, 0, sizeof(*rec));
+    if (strcasecmp(proto, "udp") == 0 || strcmp(proto, "17") == 0)
+        rec->proto = IPPROTO_UDP;
+    else if (strcasecmp(proto, "tcp") == 0 || strcmp(proto, "6") == 0)
+        rec->proto = IPPROTO_TCP;
+    rec->src_addr = a.s_addr;
+    rec->dst_addr = b.s_addr;
+    rec->src_port = rte_cpu_to_be_16((uint16_t)sport);
+    rec->dst_port = rte_cpu_to_be_16((uint16_t)dport);
+    rec->queue = rte_cpu_to_be_16((uint16_t)queue);
+    return rule_rec_valid(rec) ? 0 : -1;
+}
+
+static int rule_set_parse(const char *path, struct rule_set *set) {
+    FILE *f = fopen(path, "r");
+    char *line = NULL;
+    size_t line_cap = 0;
+    uint32_t cap = 0, lineno = 0;
+    int rc = 0;
+
+    if (!f) {
+        printf("Cannot open %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    while (getline(&line, &line_cap, f) >= 0) {
+        lineno++;
+        char *hash = strchr(line, '#');
+        if (hash)
+            *hash = '\0';
+        if (line[strspn(line, " \t\r\n")] == '\0')
+            continue;
+        if (set->count == cap) {
+            cap = cap ? cap * 2 : 4096;
+            struct rule_rec *recs = realloc(set->owned, (size_t)cap * sizeof(*recs));
+            if (!recs) {
+                printf("%s: out of memory at line %u\n", path, lineno);
+                rc = -1;
+                break;
+            }
+            set->owned = recs;
+        }
+        if (rule_parse_line(line, &set->owned[set->count]) != 0) {
+            printf("%s:%u: bad rule (want: src dst sport dport udp|tcp [queue < %u])\n",
+                   path, lineno, opt_rxq);
+            rc = -1;
+            break;
+        }
+        set->count++;
+    }
+    free(line);
+    fclose(f);
+    set->recs = set->owned;
+    return rc;
+}
+
+static int rule_set_map(const char *path, int fd, size_t len, struct rule_set *set) {
+    const struct rule_file_hdr *hdr;
+
+    set->map = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (set->map == MAP_FAILED) {
+        set->map = NULL;
+        printf("Cannot map %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    set->map_len = len;
+    madvise(set->map, len, MADV_SEQUENTIAL);
+    hdr = set->map;
+    set->count = ntohl(hdr->count);
+    set->recs = (const struct rule_rec *)(hdr + 1);
+    if (ntohl(hdr->version) != RULE_FILE_VERSION ||
+        len != sizeof(*hdr) + (size_t)set->count * sizeof(struct rule_rec)) {
+        printf("%s: unsupported version or truncated file\n", path);
+        return -1;
+    }
+    for (uint32_t k = 0; k < set->count; k++) {
+        if (!rule_rec_valid(&set->recs[k])) {
+            printf("%s: record %u has a bad protocol or queue >= %u\n", path, k, opt_rxq);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static void rule_set_free(struct rule_set *set) {
+    if (set->map)
+        munmap(set->map, set->map_len);
+    free(set->owned);
+    memset(set, 0, sizeof(*set));
+}
+
+// Loads a rule file: binary when it starts with RULE_FILE_MAGIC (mapped, not
+// copied), text otherwise. A file with any bad rule is rejected as a whole.
+static int rule_set_load(const char *path, struct rule_set *set) {
+    char magic[4];
+    struct stat st;
+    int rc;
+
+    memset(set, 0, sizeof(*set));
+    int fd = open(path, O_RDONLY);
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        printf("Cannot open %s: %s\n", path, strerror(errno));
+        if (fd >= 0)
+            close(fd);
+        return -1;
+    }
+    if ((size_t)st.st_size >= sizeof(struct rule_file_hdr) && pread(fd, magic, sizeof(magic), 0) == 4 &&
+        memcmp(magic, RULE_FILE_MAGIC, sizeof(magic)) == 0)
+        rc = rule_set_map(path, fd, (size_t)st.st_size, set);
+    else
+        rc = rule_set_parse(path, set);
+    close(fd);
+    if (rc != 0)
+        rule_set_free(set);
+    return rc;
+}
+
+// Writes a rule set in the binary format; readers of path never see a
+// partial file (written aside, then renamed over it).
+static int rule_set_save(const struct rule_set *set, const char *path) {
+    const struct rule_file_hdr hdr = {
+        .magic = RULE_FILE_MAGIC, .version = htonl(RULE_FILE_VERSION), .count = htonl(set->count),
+    };
+    char tmp[PATH_MAX];
+
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    FILE *f = fopen(tmp, "wb");
+    if (!f) {
+        printf("Cannot write %s: %s\n", tmp, strerror(errno));
+        return -1;
+    }
+    bool ok = fwrite(&hdr, sizeof(hdr), 1, f) == 1 &&
+              fwrite(set->recs, sizeof(*set->recs), set->count, f) == set->count;
+    if (fclose(f) != 0 || !ok || rename(tmp, path) != 0) {
+        printf("Cannot write %s: %s\n", path, strerror(errno));
+        unlink(tmp);
+        return -1;
+    }
+    printf("Wrote %u rules to %s\n", set->count, path);
+    return 0;
+}
+
+static void rule_index_init(void) {
+    struct rte_hash_parameters params = {
+        .name = "flow_tc_index",
+        .entries = slot_cap,
+        .key_len = sizeof(struct sw_key),
+        .hash_func = rte_hash_crc,
+        .socket_id = numa_port_socket(port_id),
+        .extra_flag = RTE_HASH_EXTRA_FLAGS_EXT_TABLE,
+    };
+    rule_index = rte_hash_create(&params);
+    if (!rule_index)
+        rte_exit(EXIT_FAILURE, "Cannot create the rule index\n");
+}
+
+// Points installed rules at the queue now in their slot: an in-place
+// action update where DPDK and the PMD have it. A rule whose update is
+// missing or failed is destroyed and re-created on its own, so each one
+// is out of the NIC only for its own two ops, not for the whole batch.
+static void rules_requeue(int shape, const uint32_t *ids, uint32_t n, struct lat_hist *lat) {
+#ifdef HAVE_FLOW_UPDATE
+    uint32_t failed = 0;
+
+    run_ops(FLOW_OP_UPDATE, shape, 0, n, ids, lat, &failed);
+    if (failed == 0)
+        return;
+#endif
+    for (uint32_t k = 0; k < n; k++) {
+        uint32_t i = ids[k];
+#ifdef HAVE_FLOW_UPDATE
+        if (!slots[i].op_failed || !slots[i].flow)
+            continue;
+#endif
+        if (flow_op_one(FLOW_OP_DESTROY, shape, i))
+            flow_op_one(FLOW_OP_CREATE, shape, i);
+    }
+}
+
+// Brings the installed rules in line with a rule set, touching only the
+// difference: rules new to the set are added, rules whose queue changed
+// are re-pointed, rules the set no longer lists are removed. Adds go first
+// so traffic moving from an old rule to a new one is never unclassified.
+// A rule the NIC rejects goes to software with --sw-fallback, or is
+// retried on the next reload.
+static void rules_apply(const struct rule_set *set) {
+    static struct lat_hist lat;
+    uint32_t n_add = 0, n_upd = 0, n_del = 0, same = 0, dups = 0, full = 0, removed = 0;
+    uint32_t *add = malloc(((size_t)set->count + 1) * sizeof(*add));
+    uint32_t *upd = malloc(((size_t)set->count + 1) * sizeof(*upd));
+    uint32_t *del = malloc(((size_t)slot_hwm + set->count + 1) * sizeof(*del));
+    uint32_t failed = 0;
+    struct sw_key key;
+
+    if (!add || !upd || !del)
+        rte_exit(EXIT_FAILURE, "Cannot allocate the rule diff\n");
+    lat_hist_init(&lat);
+    uint64_t t0 = rte_rdtsc();
+
+    // listed rules get the new generation; whatever keeps an old one is gone
+    rule_gen++;
+    for (uint32_t k = 0; k < set->count; k++) {
+        const struct rule_rec *rec = &set->recs[k];
+        void *data;
+
+        rule_rec_key(rec, &key);
+        if (rte_hash_lookup_data(rule_index, &key, &data) < 0) {
+            uint32_t id = rule_alloc();
+            if (id == RULE_ID_NONE || rte_hash_add_key_data(rule_index, &key, (void *)(uintptr_t)id) != 0) {
+                if (id != RULE_ID_NONE)
+                    rule_release(id);
+                full++;
+                continue;
+            }
+            slots[id].rec = *rec;
+            slots[id].gen = rule_gen;
+            file_rules++;
+            add[n_add++] = id;
+            continue;
+        }
+        uint32_t id = (uint32_t)(uintptr_t)data;
+        if (slots[id].gen == rule_gen) {
+            dups++;
+            continue;
+        }
+        slots[id].gen = rule_gen;
+        if (!slots[id].flow && !slots[id].in_sw) {
+            slots[id].rec = *rec;
+            add[n_add++] = id;
+        } else if (slots[id].rec.queue != rec->queue) {
+            // a software-only rule just takes the new queue for its promotion
+            slots[id].rec.queue = rec->queue;
+            if (slots[id].flow)
+                upd[n_upd++] = id;
+        } else {
+            same++;
+        }
+    }
+    for (uint32_t id = 0; id < slot_hwm; id++) {
+        if (slots[id].used && slots[id].gen != rule_gen)
+            del[n_del++] = id;
+    }
+
+    uint32_t room = hw_rules < opt_hw_max ? opt_hw_max - hw_rules : 0;
+    run_ops(FLOW_OP_CREATE, SHAPE_FILE, 0, RTE_MIN(n_add, room), add, &lat, &failed);
+    if (n_upd > 0)
+        rules_requeue(SHAPE_FILE, upd, n_upd, &lat);
+    if (opt_sw_fallback) {
+        sw_adopt(SHAPE_FILE, 0, n_add, add);
+        sw_adopt(SHAPE_FILE, 0, n_upd, upd);
+    }
+    run_ops(FLOW_OP_DESTROY, SHAPE_FILE, 0, n_del, del, &lat, &failed);
+    for (uint32_t k = 0; k < n_del; k++) {
+        uint32_t id = del[k];
+        if (slots[id].in_sw)
+            sw_del(SHAPE_FILE, id);
+        if (slots[id].flow || slots[id].in_sw)
+            continue;       // still held, retried on the next reload
+        rule_rec_key(&slots[id].rec, &key);
+        rte_hash_del_key(rule_index, &key);
+        rule_release(id);
+        file_rules--;
+        removed++;
+    }
+
+    hw_rules = 0;
+    for (uint32_t id = 0; id < slot_hwm; id++)
+        hw_rules += slots[id].flow != NULL;
+    double s = (rte_rdtsc() - t0) * ns_per_cycle / 1e9;
+    printf("Applied %u rules in %.3f s (%s): +%u ~%u -%u =%u, %u in NIC, %u in software\n",
+           set->count, s, use_async ? "async" : "sync", n_add, n_upd, removed, same,
+           hw_rules, sw_rules);
+    if (dups > 0)
+        printf("  %u duplicate rules ignored\n", dups);
+    if (full > 0)
+        printf("  %u rules did not fit in the %u-slot store (raise --rules)\n", full, slot_cap);
+    if (removed < n_del)
+        printf("  %u removed rules are still in the NIC, retried on the next reload\n", n_del - removed);
+    if (file_rules > hw_rules + sw_rules)
+        printf("  %u rules not installed\n", file_rules - hw_rules - sw_rules);
+    free(add);
+    free(upd);
+    free(del);
+}
+
+// Watches the rule file's directory: editors and rule generators usually
+// replace a file (rename over it) rather than write it in place.
+static void rule_watch_init(const char *path) {
+    const char *slash = strrchr(path, '/');
+    char dir[PATH_MAX];
+
+    if (!slash)
+        snprintf(dir, sizeof(dir), ".");
+    else
+        snprintf(dir, sizeof(dir), "%.*s", slash == path ? 1 : (int)(slash - path), path);
+    watch_name = slash ? slash + 1 : path;
+    watch_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (watch_fd < 0 || inotify_add_watch(watch_fd, dir, IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+        printf("Warning: cannot watch %s (%s), reload with SIGHUP\n", dir, strerror(errno));
+        if (watch_fd >= 0)
+            close(watch_fd);
+        watch_fd = -1;
+    }
+}
+
+// True if the rule file was written or replaced since the last call.
+static bool rule_watch_changed(void) {
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    bool changed = false;
+    ssize_t n;
+
+    if (watch_fd < 0)
+        return false;
+    while ((n = read(watch_fd, buf, sizeof(buf))) > 0) {
+        for (char *p = buf; p < buf + n;) {
+            const struct inotify_event *ev = (const struct inotify_event *)p;
+            if (ev->len > 0 && strcmp(ev->name, watch_name) == 0)
+                changed = true;
+            p += sizeof(*ev) + ev->len;
+        }
+    }
+    return changed;
+}
+
+// Installs the loaded rule file, then applies every reload until Ctrl+C.
+static void run_file_mode(struct rule_set *set) {
+    rule_index_init();
+    if (opt_sw_fallback) {
+        if (sw_init(SHAPE_FILE) != 0)
+            rte_exit(EXIT_FAILURE, "Software fallback unavailable\n");
+        sw_start(sw_worker_loop);
+    }
+    flow_mode_select(SHAPE_FILE, slot_cap);
+    rules_apply(set);
+    rule_set_free(set);
+    if (opt_watch)
+        rule_watch_init(opt_rules_file);
+
+    printf("Loaded %s. Reload with SIGHUP%s, Ctrl+C to exit.\n", opt_rules_file,
+           watch_fd >= 0 ? " or by replacing the file" : "");
+
+    while (keep_running) {
+        sleep(1);
+        if (!keep_running)
+            break;
+        if (rule_watch_changed() || reload_requested) {
+            reload_requested = 0;
+            if (rule_set_load(opt_rules_file, set) == 0) {
+                if (opt_save_rules)
+                    rule_set_save(set, opt_save_rules);
+                rules_apply(set);
+                rule_set_free(set);
+            } else {
+                printf("Reload rejected, keeping the current %u rules\n", file_rules);
+            }
+        }
+        if (opt_sw_fallback) {
+            sw_promote(SHAPE_FILE);
+            sw_report();
+        }
+    }
+
+    printf("Cleaning up flow rules...\n");
+    if (opt_sw_fallback) {
+        sw_stop();
+        sw_free();
+    }
+    rules_flush(SHAPE_FILE, 0, slot_hwm);
+    flow_mode_release();
+    rte_hash_free(rule_index);
+    if (watch_fd >= 0)
+        close(watch_fd);
+}
+
+// ---------------- elephant steering ----------------
+
+struct steer_cand {
+    uint32_t id;
+    double pps;
+};
+
+static double steer_load[MAX_RXQ];      // pps of the flows pinned to each queue, last scan
+static uint32_t steer_pinned;
+static struct rte_flow *steer_default;  // catch-all RSS rule over the shared queues
+
+// Everything no rule pins goes to the shared queues: a lowest-priority
+// catch-all RSS rule, or the RSS redirection table if the PMD refuses it.
+static void steer_default_install(void) {
+    const uint16_t nb_shared = opt_rxq - opt_steer;
+    const struct rte_flow_attr attr = { .ingress = 1, .priority = STEER_DEFAULT_PRIO };
+    const struct rte_flow_item pattern[] = {
+        { .type = RTE_FLOW_ITEM_TYPE_ETH },
+        { .type = RTE_FLOW_ITEM_TYPE_END },
+    };
+    const struct rte_flow_action_rss rss = {
+        .func = RTE_ETH_HASH_FUNCTION_DEFAULT,
+        .types = RTE_ETH_RSS_IP | RTE_ETH_RSS_UDP,
+        .queue_num = nb_shared,
+        .queue = rss_queues,
+    };
+    const struct rte_flow_action actions[] = {
+        { .type = RTE_FLOW_ACTION_TYPE_RSS, .conf = &rss },
+        { .type = RTE_FLOW_ACTION_TYPE_END },
+    };
+    struct rte_eth_dev_info dev_info;
+    struct rte_flow_error error;
+
+    steer_default = rte_flow_create(port_id, &attr, pattern, actions, &error);
+    if (steer_default) {
+        printf("Shared queues 0-%u (catch-all RSS rule), dedicated queues %u-%u\n",
+               nb_shared - 1, nb_shared, opt_rxq - 1);
+        return;
+    }
+    printf("Catch-all RSS rule failed: %s, using the RSS redirection table\n",
+           error.message ? error.message : "(no message)");
+    if (rte_eth_dev_info_get(port_id, &dev_info) == 0 && dev_info.reta_size > 0 &&
+        dev_info.reta_size <= STEER_RETA_MAX) {
+        struct rte_eth_rss_reta_entry64 reta[STEER_RETA_MAX / RTE_ETH_RETA_GROUP_SIZE];
+
+        memset(reta, 0, sizeof(reta));
+        for (uint16_t j = 0; j < dev_info.reta_size; j++) {
+            reta[j / RTE_ETH_RETA_GROUP_SIZE].mask |= 1ULL << (j % RTE_ETH_RETA_GROUP_SIZE);
+            reta[j / RTE_ETH_RETA_GROUP_SIZE].reta[j % RTE_ETH_RETA_GROUP_SIZE] = j % nb_shared;
+        }
+        if (rte_eth_dev_rss_reta_update(port_id, reta, dev_info.reta_size) == 0) {
+            printf("Shared queues 0-%u (RSS redirection table), dedicated queues %u-%u\n",
+                   nb_shared - 1, nb_shared, opt_rxq - 1);
+            return;
+        }
+    }
+    printf("Warning: cannot confine RSS to the shared queues, dedicated queues get unmatched traffic too\n");
+}
+
+static void steer_default_remove(void) {
+    struct rte_flow_error error;
+
+    if (steer_default)
+        rte_flow_destroy(port_id, steer_default, &error);
+    steer_default = NULL;
+}
+
+// Keeps the k heaviest candidates seen so far: cand[0 .. *n) is a min-heap
+// on pps, so a flow only gets in by pushing out the lightest one.
+static void steer_cand_push(struct steer_cand *cand, uint32_t *n, uint32_t k, struct steer_cand c) {
+    uint32_t i;
+
+    if (*n < k) {
+        // sift up from the new leaf
+        for (i = (*n)++; i > 0 && cand[(i - 1) / 2].pps > c.pps; i = (i - 1) / 2)
+            cand[i] = cand[(i - 1) / 2];
+        cand[i] = c;
+        return;
+    }
+    if (c.pps <= cand[0].pps)
+        return;
+    // replace the root and sift down
+    for (i = 0;;) {
+        uint32_t m = 2 * i + 1;
+        if (m >= *n)
+            break;
+        if (m + 1 < *n && cand[m + 1].pps < cand[m].pps)
+            m++;
+        if (cand[m].pps >= c.pps)
+            break;
+        cand[i] = cand[m];
+        i = m;
+    }
+    cand[i] = c;
+}
+
+static int steer_cand_cmp(const void *a, const void *b) {
+    const struct steer_cand *x = a, *y = b;
+    return (x->pps < y->pps) - (x->pps > y->pps);     // heaviest first
+}
+
+// Reads and resets the hit counter of every rule in [first, last). The
+// STEER_MAX_MOVES heaviest flows above --elephant-pps are pinned, heaviest
+// first, to the least loaded dedicated queue; a pinned flow below half of
+// it (hysteresis, so flows near the threshold do not flap) returns to the
+// shared queues. A pinned flow that stays hot keeps its queue, so it is not
+// reordered for nothing. The first call only primes the counters.
+static void steer_scan(int shape, uint32_t first, uint32_t last) {
+    static struct steer_cand cand[STEER_MAX_MOVES];
+    static uint32_t moves[2 * STEER_MAX_MOVES];
+    static struct lat_hist lat;
+    static uint64_t last_tsc;
+    static bool disabled;
+    const struct rte_flow_action count = { .type = RTE_FLOW_ACTION_TYPE_COUNT };
+    struct rte_flow_error error;
+    uint32_t nb_cand = 0, nb_moves = 0, queried = 0, installed = 0, unpinned = 0;
+    uint64_t now = rte_rdtsc();
+    double dt = last_tsc ? (now - last_tsc) * ns_per_cycle / 1e9 : 0;
+
+    if (disabled)
+        return;
+    last_tsc = now;
+    for (uint16_t q = 0; q < opt_rxq; q++)
+        steer_load[q] = 0;
+    for (uint32_t i = first; i < last && keep_running; i++) {
+        struct rte_flow_query_count qc = { .reset = 1 };
+
+        if (!slots[i].flow)
+            continue;
+        installed++;
+        if (rte_flow_query(port_id, slots[i].flow, &count, &qc, &error) != 0)
+            continue;
+        queried++;
+        if (dt <= 0)
+            continue;
+        double pps = qc.hits_set ? qc.hits / dt : 0;
+        if (slots[i].steer) {
+            if (pps < opt_elephant_pps / 2.0 && nb_moves < STEER_MAX_MOVES) {
+                slots[i].steer = 0;
+                moves[nb_moves++] = i;
+                steer_pinned--;
+                unpinned++;
+            } else {
+                steer_load[slots[i].steer - 1] += pps;
+            }
+        } else if (pps >= opt_elephant_pps) {
+            steer_cand_push(cand, &nb_cand, STEER_MAX_MOVES,
+                            (struct steer_cand){ .id = i, .pps = pps });
+        }
+    }
+    if (installed > 0 && queried == 0) {
+        printf("Warning: rule counters cannot be queried: %s, steering off\n",
+               error.message ? error.message : "(no message)");
+        disabled = true;
+        return;
+    }
+
+    qsort(cand, nb_cand, sizeof(cand[0]), steer_cand_cmp);
+    for (uint32_t k = 0; k < nb_cand; k++) {
+        uint16_t best = opt_rxq - opt_steer;
+        for (uint16_t q = best + 1; q < opt_rxq; q++) {
+            if (steer_load[q] < steer_load[best])
+                best = q;
+        }
+        steer_load[best] += cand[k].pps;
+        slots[cand[k].id].steer = best + 1;
+        moves[nb_moves++] = cand[k].id;
+        steer_pinned++;
+    }
+    if (nb_moves > 0) {
+        lat_hist_init(&lat);
+        rules_requeue(shape, moves, nb_moves, &lat);
+        // a rule lost by a failed re-create is no longer pinned anywhere
+        for (uint32_t k = 0; k < nb_moves; k++) {
+            uint32_t i = moves[k];
+            if (!slots[i].flow && slots[i].steer) {
+                slots[i].steer = 0;
+                steer_pinned--;
+                nb_cand--;
+            }
+        }
+        printf("Steering: %u flows pinned, %u back to the shared queues (%u pinned)\n",
+               nb_cand, unpinned, steer_pinned);
+    }
+}
+
+// RX rate of every queue polled since the last call; * marks dedicated ones.
+static void steer_report(void) {
+    static uint64_t prev_rx[MAX_RXQ], prev_tsc;
+    uint64_t now = rte_rdtsc();
+    double dt = (now - prev_tsc) * ns_per_cycle / 1e9;
+
+    if (prev_tsc != 0) {
+        printf("RX pps per queue:");
+        for (uint16_t q = 0; q < nb_sw_workers; q++) {
+            const struct sw_worker *w = &sw_workers[q];
+            printf(" %s%u=%.0f", w->queue >= opt_rxq - opt_steer ? "*" : "", w->queue,
+                   (w->rx - prev_rx[q]) / dt);
+        }
+        printf(" | %u elephants pinned\n", steer_pinned);
+    }
+    for (uint16_t q = 0; q < nb_sw_workers; q++)
+        prev_rx[q] = sw_workers[q].rx;
+    prev_tsc = now;
+}
+
+// ---------------- benchmark ----------------
+
+struct op_stat {
+    uint32_t ok, failed;
+    double rps;
+    uint64_t p50, p99;      // ns
 };
 
+static void op_measure(int op, int shape, uint32_t first, uint32_t last, struct op_stat *s) {
+    static struct lat_hist lat;
+
+    lat_hist_init(&lat);
+    s->failed = 0;
+    uint64_t t0 = rte_rdtsc();
+    s->ok = run_ops(op, shape, first, last, NULL, &lat, &s->failed);
+    double sec = (rte_rdtsc() - t0) * ns_per_cycle / 1e9;
+    s->rps = sec > 0 ? s->ok / sec : 0.0;
+    s->p50 = lat_hist_percentile(&lat, 50.0);
+    s->p99 = lat_hist_percentile(&lat, 99.0);
+}
+
+// Bytes allocated from the DPDK heaps of all sockets (PMD flow memory
+// shows up here when the driver uses rte_malloc for it).
+static uint64_t heap_used(void) {
+    struct rte_malloc_socket_stats st;
+    uint64_t used = 0;
+
+    for (unsigned s = 0; s < rte_socket_count(); s++) {
+        if (rte_malloc_get_socket_stats(rte_socket_id_by_idx(s), &st) == 0)
+            used += st.heap_allocsz_bytes;
+    }
+    return used;
+}
+
+static uint16_t item_hdr_len(enum rte_flow_item_type type) {
+    switch (type) {
+    case RTE_FLOW_ITEM_TYPE_ETH:   return sizeof(struct rte_ether_hdr);
+    case RTE_FLOW_ITEM_TYPE_IPV4:  return sizeof(struct rte_ipv4_hdr);
+    case RTE_FLOW_ITEM_TYPE_IPV6:  return sizeof(struct rte_ipv6_hdr);
+    case RTE_FLOW_ITEM_TYPE_UDP:   return sizeof(struct rte_udp_hdr);
+    case RTE_FLOW_ITEM_TYPE_VXLAN: return sizeof(struct rte_vxlan_hdr);
+    default:                       return 0;
+    }
+}
+
+// A packet that matches rule i: the headers are the rule's specs, with
+// ethertypes, protocols and lengths filled in from the item sequence.
+static void pkt_fill(int shape, uint32_t i, struct rte_mbuf *m) {
+    struct flow_rule r;
+    uint16_t off[MAX_ITEMS], len = 0;
+    int n;
+
+    rule_fill(shape, i, &r);
+    for (n = 0; r.pattern[n].type != RTE_FLOW_ITEM_TYPE_END; n++) {
+        off[n] = len;
+        len += item_hdr_len(r.pattern[n].type);
+    }
+    len += BENCH_PAYLOAD;
+    uint8_t *p = (uint8_t *)rte_pktmbuf_append(m, len);
+    if (!p)
+        return;
+    memset(p, 0, len);
+
+    for (int k = 0; k < n; k++) {
+        const struct rte_flow_item *it = &r.pattern[k];
+        enum rte_flow_item_type next = r.pattern[k + 1].type;
+        uint8_t *h = p + off[k];
+        uint16_t rest = len - off[k];
+
+        if (it->spec)
+            memcpy(h, it->spec, item_hdr_len(it->type));
+        switch (it->type) {
+        case RTE_FLOW_ITEM_TYPE_ETH: {
+            struct rte_ether_hdr *eth = (struct rte_ether_hdr *)h;
+            eth->ether_type = rte_cpu_to_be_16(next == RTE_FLOW_ITEM_TYPE_IPV6 ?
+                                               RTE_ETHER_TYPE_IPV6 : RTE_ETHER_TYPE_IPV4);
+            break;
+        }
+        case RTE_FLOW_ITEM_TYPE_IPV4: {
+            struct rte_ipv4_hdr *ip = (struct rte_ipv4_hdr *)h;
+            ip->version_ihl = 0x45;
+            ip->time_to_live = 64;
+            ip->next_proto_id = IPPROTO_UDP;
+            ip->total_length = rte_cpu_to_be_16(rest);
+            break;
+        }
+        case RTE_FLOW_ITEM_TYPE_IPV6: {
+            struct rte_ipv6_hdr *ip6 = (struct rte_ipv6_hdr *)h;
+            ip6->vtc_flow = rte_cpu_to_be_32(6u << 28);
+            ip6->hop_limits = 64;
+            ip6->proto = IPPROTO_UDP;
+            ip6->payload_len = rte_cpu_to_be_16(rest - sizeof(*ip6));
+            break;
+        }
+        case RTE_FLOW_ITEM_TYPE_UDP:
+            ((struct rte_udp_hdr *)h)->dgram_len = rte_cpu_to_be_16(rest);
+            break;
+        default:
+            break;
+        }
+    }
+}
+
+// Loopback forwarding rate with rules [0, occ) installed: send packets that
+// hit up to BENCH_PKT_SET of them round robin on TX queue 0 and count what
+// returns on any RX queue.
+static double measure_pps(int shape, uint32_t occ, unsigned ms) {
+    struct rte_mbuf *set[BENCH_PKT_SET], *pkts[BENCH_BURST];
+    uint32_t nb_set = RTE_MIN(occ, (uint32_t)BENCH_PKT_SET), built = 0;
+    uint64_t rx = 0, k = 0;
+
+    // packets for rules spread over the table, built once: sending takes a
+    // reference, so the generator core is not what the sample measures
+    for (; built < nb_set; built++) {
+        set[built] = rte_pktmbuf_alloc(mbuf_pool);
+        if (!set[built])
+            break;
+        pkt_fill(shape, (uint32_t)((uint64_t)built * occ / nb_set), set[built]);
+    }
+    if (built == 0)
+        return 0.0;
+
+    uint64_t t0 = rte_rdtsc(), end = t0 + rte_get_tsc_hz() * ms / 1000;
+    while (rte_rdtsc() < end && keep_running) {
+        for (int n = 0; n < BENCH_BURST; n++) {
+            pkts[n] = set[k++ % built];
+            rte_mbuf_refcnt_update(pkts[n], 1);
+        }
+        uint16_t sent = rte_eth_tx_burst(port_id, 0, pkts, BENCH_BURST);
+        for (uint16_t n = sent; n < BENCH_BURST; n++)
+            rte_pktmbuf_free(pkts[n]);
+        for (uint16_t q = 0; q < opt_rxq; q++) {
+            uint16_t n = rte_eth_rx_burst(port_id, q, pkts, BENCH_BURST);
+            rx += n;
+            rte_pktmbuf_free_bulk(pkts, n);
+        }
+    }
+    double sec = (rte_rdtsc() - t0) * ns_per_cycle / 1e9;
+    for (uint32_t n = 0; n < built; n++)
+        rte_pktmbuf_free(set[n]);
+    return sec > 0 ? rx / sec : 0.0;
+}
+
+// 1000, 2000, 5000, 10000, ...
+static uint32_t bench_next(uint32_t level) {
+    uint32_t d = level;
+    while (d >= 10)
+        d /= 10;
+    return d == 2 ? level / 2 * 5 : level * 2;
+}
+
+static void bench_shape(FILE *csv, int shape, const char *driver, const char *fw) {
+    const char *name = shape_names[shape];
+    uint32_t probe_first = opt_bench_max, probe_last = opt_bench_max + opt_bench_probe;
+    uint32_t occ = 0;
+
+    rule_reserve(probe_last);   // ids 0 .. max - 1 for the fill, then the probe
+
+    flow_mode_select(shape, probe_last);
+    const char *mode = use_async ? "async" : "sync";
+    printf("Benchmark %s (%s): up to %u rules, probe %u\n", name, mode, opt_bench_max, opt_bench_probe);
+
+    uint64_t heap0 = heap_used();
+    for (uint32_t level = BENCH_MIN; occ < opt_bench_max && keep_running; level = bench_next(level)) {
+        struct op_stat fill, ins, upd = { 0 }, del;
+        double pps = 0.0;
+
+        if (level > opt_bench_max)
+            level = opt_bench_max;
+        op_measure(FLOW_OP_CREATE, shape, occ, level, &fill);
+        occ += fill.ok;
+        uint64_t now_used = heap_used();
+        uint64_t heap = now_used > heap0 ? now_used - heap0 : 0;   // the heap may shrink
+
+        op_measure(FLOW_OP_CREATE, shape, probe_first, probe_last, &ins);
+#ifdef HAVE_FLOW_UPDATE
+        op_measure(FLOW_OP_UPDATE, shape, probe_first, probe_last, &upd);
+#endif
+        if (opt_bench_pps && occ > 0)
+            pps = measure_pps(shape, occ, opt_bench_pps);
+        op_measure(FLOW_OP_DESTROY, shape, probe_first, probe_last, &del);
+
+        fprintf(csv, "%s,%s,%s,%s,%u,%.0f,%u,%.0f,%.2f,%.2f,%u,%.0f,%.2f,%.0f,%.2f,%" PRIu64 ",%.0f,%.0f\n",
+                driver, fw, name, mode, occ, fill.rps, fill.failed,
+                ins.rps, ins.p50 / 1e3, ins.p99 / 1e3, ins.failed,
+                upd.rps, upd.p99 / 1e3, del.rps, del.p99 / 1e3,
+                heap, occ ? (double)heap / occ : 0.0, pps);
+        fflush(csv);
+        printf("  %-8s %8u rules: insert %8.0f/s p99 %7.1f us, update %8.0f/s, delete %8.0f/s, "
+               "heap %7.1f MB, %.2f Mpps\n",
+               name, occ, ins.rps, ins.p99 / 1e3, upd.rps, del.rps, heap / (1024.0 * 1024.0), pps / 1e6);
+
+        if (fill.failed) {
+            printf("  %s: table full at %u rules\n", name, occ);
+            break;
+        }
+    }
+
+    rules_flush(shape, 0, opt_bench_max);
+    flow_mode_release();
+    rule_store_reset();
+}
+
+static void run_bench(void) {
+    struct rte_eth_dev_info dev_info;
+    char fw[64] = "n/a";
+
+    FILE *csv = fopen(opt_csv, "w");
+    if (!csv)
+        rte_exit(EXIT_FAILURE, "Cannot open %s\n", opt_csv);
+    if (rte_eth_dev_info_get(port_id, &dev_info) != 0)
+        dev_info.driver_name = "unknown";
+    if (rte_eth_dev_fw_version_get(port_id, fw, sizeof(fw)) != 0)
+        snprintf(fw, sizeof(fw), "n/a");
+
+    fprintf(csv, "driver,fw_version,shape,mode,occupancy,fill_rps,fill_failed,"
+                 "insert_rps,insert_p50_us,insert_p99_us,insert_failed,update_rps,update_p99_us,"
+                 "delete_rps,delete_p99_us,heap_bytes,heap_bytes_per_rule,pps\n");
+
+    for (int s = 0; s < NB_SHAPES && keep_running; s++) {
+        if (opt_shape == SHAPE_ALL || opt_shape == s)
+            bench_shape(csv, s, dev_info.driver_name, fw);
+    }
+    fclose(csv);
+    printf("Results written to %s\n", opt_csv);
+}
+
+static void parse_args(int argc, char **argv) {
+    for (int i = 1; i < argc; i++) {
+        const char *opt = argv[i], *val = (i + 1 < argc) ? argv[i + 1] : NULL;
+        if (strcmp(opt, "--bench") == 0) {
+            opt_bench = true;
+            continue;
+        }
+        if (strcmp(opt, "--sw-fallback") == 0) {
+            opt_sw_fallback = true;
+            continue;
+        }
+        if (strcmp(opt, "--watch") == 0) {
+            opt_watch = true;
+            continue;
+        }
+        if (!val)
+            rte_exit(EXIT_FAILURE, "Unknown option or missing value: %s\n", opt);
+        i++;
+        if (strcmp(opt, "--rules") == 0) {
+            opt_rules = (uint32_t)strtoul(val, NULL, 0);
+            if (opt_rules == 0)
+                rte_exit(EXIT_FAILURE, "--rules must be > 0\n");
+        } else if (strcmp(opt, "--mode") == 0) {
+            if (strcmp(val, "sync") == 0)
+                opt_async = false;
+            else if (strcmp(val, "async") == 0)
+                opt_async = true;
+            else
+                rte_exit(EXIT_FAILURE, "--mode must be sync or async\n");
+        } else if (strcmp(opt, "--flow-queues") == 0) {
+            opt_flow_queues = (uint16_t)atoi(val);
+            if (opt_flow_queues < 1 || opt_flow_queues > MAX_FLOW_QUEUES)
+                rte_exit(EXIT_FAILURE, "--flow-queues must be 1..%d\n", MAX_FLOW_QUEUES);
+        } else if (strcmp(opt, "--batch") == 0) {
+            opt_batch = (uint32_t)strtoul(val, NULL, 0);
+            if (opt_batch == 0)
+                rte_exit(EXIT_FAILURE, "--batch must be > 0\n");
+        } else if (strcmp(opt, "--rxq") == 0) {
+            opt_rxq = (uint16_t)atoi(val);
+            if (opt_rxq < 1 || opt_rxq > MAX_RXQ)
+                rte_exit(EXIT_FAILURE, "--rxq must be 1..%d\n", MAX_RXQ);
+        } else if (strcmp(opt, "--shape") == 0) {
+            opt_shape = -1;
+            if (strcmp(val, "all") == 0)
+                opt_shape = SHAPE_ALL;
+            for (int s = 0; s < NB_SHAPES; s++) {
+                if (strcmp(val, shape_names[s]) == 0)
+                    opt_shape = s;
+            }
+            if (opt_shape < 0)
+                rte_exit(EXIT_FAILURE, "--shape must be udp, 5tuple, ipv6, vxlan, mark-rss or all\n");
+        } else if (strcmp(opt, "--bench-max") == 0) {
+            opt_bench_max = (uint32_t)strtoul(val, NULL, 0);
+            if (opt_bench_max == 0)
+                rte_exit(EXIT_FAILURE, "--bench-max must be > 0\n");
+        } else if (strcmp(opt, "--bench-probe") == 0) {
+            opt_bench_probe = (uint32_t)strtoul(val, NULL, 0);
+            if (opt_bench_probe == 0)
+                rte_exit(EXIT_FAILURE, "--bench-probe must be > 0\n");
+        } else if (strcmp(opt, "--bench-pps") == 0) {
+            opt_bench_pps = (unsigned)strtoul(val, NULL, 0);
+        } else if (strcmp(opt, "--csv") == 0) {
+            opt_csv = val;
+        } else if (strcmp(opt, "--hw-max") == 0) {
+            opt_hw_max = (uint32_t)strtoul(val, NULL, 0);
+        } else if (strcmp(opt, "--rules-file") == 0) {
+            opt_rules_file = val;
+        } else if (strcmp(opt, "--save-rules") == 0) {
+            opt_save_rules = val;
+        } else if (strcmp(opt, "--steer") == 0) {
+            opt_steer = (uint16_t)atoi(val);
+            if (opt_steer < 1 || opt_steer >= MAX_RXQ)
+                rte_exit(EXIT_FAILURE, "--steer must be 1..%d\n", MAX_RXQ - 1);
+        } else if (strcmp(opt, "--elephant-pps") == 0) {
+            opt_elephant_pps = (uint32_t)strtoul(val, NULL, 0);
+            if (opt_elephant_pps == 0)
+                rte_exit(EXIT_FAILURE, "--elephant-pps must be > 0\n");
+        } else {
+            rte_exit(EXIT_FAILURE, "Unknown option: %s\n", opt);
+        }
+    }
+    if (opt_shape == SHAPE_ALL && !opt_bench)
+        rte_exit(EXIT_FAILURE, "--shape all needs --bench\n");
+    if (opt_sw_fallback && opt_bench)
+        rte_exit(EXIT_FAILURE, "--sw-fallback and --bench both poll the RX queues\n");
+    if (opt_rules_file && opt_bench)
+        rte_exit(EXIT_FAILURE, "--rules-file and --bench cannot be combined\n");
+    if ((opt_watch || opt_save_rules) && !opt_rules_file)
+        rte_exit(EXIT_FAILURE, "--watch and --save-rules need --rules-file\n");
+    if (opt_steer > 0 && opt_steer >= opt_rxq)
+        rte_exit(EXIT_FAILURE, "--steer needs --rxq above the number of dedicated queues\n");
+    if (opt_steer > 0 && (opt_bench || opt_rules_file))
+        rte_exit(EXIT_FAILURE, "--steer cannot be combined with --bench or --rules-file\n");
+}
+
 int main(int argc, char **argv) {
     signal(SIGINT, handle_signal);
     signal(SIGTERM, handle_signal);
@@ -32,31 +2151,65 @@ int main(int argc, char **argv) {
     int ret = rte_eal_init(argc, argv);
     if (ret < 0)
         rte_exit(EXIT_FAILURE, "EAL init failed\n");
+    parse_args(argc - ret, argv + ret);
+    if (opt_rules_file)
+        signal(SIGHUP, handle_reload);  // otherwise SIGHUP still ends the run
+    ns_per_cycle = 1e9 / (double)rte_get_tsc_hz();
+    for (uint16_t q = 0; q < MAX_RXQ; q++)
+        rss_queues[q] = q;
 
     uint16_t nb_ports = rte_eth_dev_count_avail();
     if (nb_ports == 0)
         rte_exit(EXIT_FAILURE, "No ports found\n");
 
-    uint16_t port_id = 0;
-
-    mbuf_pool = rte_pktmbuf_pool_create("MBUF_POOL", NB_MBUF, 0, 0,
-                                        RTE_MBUF_DEFAULT_BUF_SIZE,
-                                        rte_socket_id());
+    // mbufs on the NIC's socket, not the main lcore's, sized for the RX queues and one TX queue
+    struct pool_size_req req = {
+        .nb_rxq = opt_rxq, .rx_desc = NUM_DESC, .nb_txq = 1, .tx_desc = NUM_DESC,
+        .nb_lcores = rte_lcore_count(), .cache = 0, .burst = BENCH_BURST,
+        .depth = 1 + BENCH_PKT_SET / BENCH_BURST,  // plus the prebuilt --bench-pps packets
+    };
+    unsigned nb_mbufs = pool_size_calc(&req);
+    mbuf_pool = numa_pool_get("MBUF_POOL", numa_port_socket(port_id), nb_mbufs, 0);
     if (!mbuf_pool)
         rte_exit(EXIT_FAILURE, "Failed to create mempool\n");
+    pool_size_report(mbuf_pool->name, &req, nb_mbufs, RTE_MBUF_DEFAULT_BUF_SIZE);
 
-    ret = rte_eth_dev_configure(port_id, 1, 1, &port_conf_default);
+    struct rte_eth_conf port_conf = {
+        .rxmode = { .mq_mode = RTE_ETH_MQ_RX_NONE },
+        .txmode = { .mq_mode = RTE_ETH_MQ_TX_NONE },
+    };
+    if (opt_rxq > 1) {
+        struct rte_eth_dev_info dev_info;
+        if (rte_eth_dev_info_get(port_id, &dev_info) != 0)
+            rte_exit(EXIT_FAILURE, "Cannot get device info\n");
+        port_conf.rxmode.mq_mode = RTE_ETH_MQ_RX_RSS;
+        port_conf.rx_adv_conf.rss_conf.rss_hf =
+            (RTE_ETH_RSS_IP | RTE_ETH_RSS_UDP) & dev_info.flow_type_rss_offloads;
+    }
+
+    ret = rte_eth_dev_configure(port_id, opt_rxq, 1, &port_conf);
     if (ret < 0)
         rte_exit(EXIT_FAILURE, "Cannot configure device\n");
 
-    ret = rte_eth_rx_queue_setup(port_id, 0, NUM_DESC, rte_eth_dev_socket_id(port_id), NULL, mbuf_pool);
-    if (ret < 0)
-        rte_exit(EXIT_FAILURE, "RX queue setup failed\n");
+    for (uint16_t q = 0; q < opt_rxq; q++) {
+        ret = rte_eth_rx_queue_setup(port_id, q, NUM_DESC, rte_eth_dev_socket_id(port_id), NULL, mbuf_pool);
+        if (ret < 0)
+            rte_exit(EXIT_FAILURE, "RX queue %u setup failed\n", q);
+    }
 
     ret = rte_eth_tx_queue_setup(port_id, 0, NUM_DESC, rte_eth_dev_socket_id(port_id), NULL);
     if (ret < 0)
         rte_exit(EXIT_FAILURE, "TX queue setup failed\n");
 
+    // flow queues have to exist before the port starts
+#ifdef HAVE_FLOW_ASYNC
+    if (opt_async)
+        nb_flow_queues = async_configure(opt_flow_queues);
+#else
+    if (opt_async)
+        printf("Async flow API needs DPDK 22.03 or later\n");
+#endif
+
     ret = rte_eth_dev_start(port_id);
     if (ret < 0)
         rte_exit(EXIT_FAILURE, "Failed to start port\n");
@@ -65,68 +2218,87 @@ int main(int argc, char **argv) {
 
     printf("Initialized port %u\n", port_id);
 
-    // Create 1000 rules
-    struct rte_flow *flows[100000];
-    struct rte_flow_error error;
-
-    for (uint16_t i = 0; i < 100000; i++) {
-        struct rte_flow_attr attr = {
-            .ingress = 1,
-        };
+    // a reload adds new rules before it removes old ones, so the store
+    // holds two files' worth by default
+    struct rule_set set;
+    uint32_t nb_slots = opt_bench ? opt_bench_max + opt_bench_probe : opt_rules;
+    if (opt_rules_file) {
+        if (rule_set_load(opt_rules_file, &set) != 0)
+            rte_exit(EXIT_FAILURE, "Cannot load %s\n", opt_rules_file);
+        if (opt_save_rules)
+            rule_set_save(&set, opt_save_rules);
+        nb_slots = RTE_MAX(opt_rules, (uint32_t)RTE_MIN(2ULL * set.count, (uint64_t)UINT32_MAX - 1));
+    }
+    rule_store_init(nb_slots, numa_port_socket(port_id));
 
-        struct rte_flow_item_eth eth_spec = {0};
-        struct rte_flow_item_eth eth_mask = {0};
-
-        struct rte_flow_item_ipv4 ip_spec = {0};
-        struct rte_flow_item_ipv4 ip_mask = {0};
-        ip_spec.hdr.next_proto_id = IPPROTO_UDP;
-        ip_mask.hdr.next_proto_id = 0xFF;
-
-        struct rte_flow_item_udp udp_spec = {0};
-        struct rte_flow_item_udp udp_mask = {0};
-        udp_spec.hdr.dst_port = rte_cpu_to_be_16(10000 + i);
-        udp_mask.hdr.dst_port = 0xFFFF;
-
-        const struct rte_flow_item pattern[] = {
-            { .type = RTE_FLOW_ITEM_TYPE_ETH,
-              .spec = &eth_spec,
-              .mask = &eth_mask },
-            { .type = RTE_FLOW_ITEM_TYPE_IPV4,
-              .spec = &ip_spec,
-              .mask = &ip_mask },
-            { .type = RTE_FLOW_ITEM_TYPE_UDP,
-              .spec = &udp_spec,
-              .mask = &udp_mask },
-            { .type = RTE_FLOW_ITEM_TYPE_END },
-        };
+    if (opt_bench) {
+        run_bench();
+    } else if (opt_rules_file) {
+        run_file_mode(&set);
+    } else {
+        static struct lat_hist lat;
+        uint32_t ok, failed = 0;
+        uint32_t first = rule_reserve(opt_rules);
+        uint32_t hw_last = first + RTE_MIN(opt_rules, opt_hw_max);
 
-        struct rte_flow_action_queue queue = { .index = 0 };
-        const struct rte_flow_action actions[] = {
-            { .type = RTE_FLOW_ACTION_TYPE_QUEUE, .conf = &queue },
-            { .type = RTE_FLOW_ACTION_TYPE_END },
-        };
+        if (opt_sw_fallback) {
+            if (sw_init(opt_shape) != 0)
+                rte_exit(EXIT_FAILURE, "Software fallback unavailable\n");
+            sw_start(sw_worker_loop);   // classify while the rules go in
+        } else if (opt_steer > 0) {
+            sw_start(rx_count_loop);
+        }
+        if (opt_steer > 0)
+            steer_default_install();
 
-        flows[i] = rte_flow_create(port_id, &attr, pattern, actions, &error);
-        if (!flows[i]) {
-            printf("Rule %u creation failed: %s\n", i, error.message ? error.message : "(no message)");
-            break;
+        flow_mode_select(opt_shape, opt_rules);
+#ifdef HAVE_FLOW_ASYNC
+        if (use_async)
+            printf("Installing %u %s rules: async, %u flow queues x %u, push every %u\n",
+                   opt_rules, shape_names[opt_shape], nb_flow_queues, flow_queue_size, opt_batch);
+#endif
+        if (!use_async)
+            printf("Installing %u %s rules: sync\n", opt_rules, shape_names[opt_shape]);
+        uint64_t t0 = rte_rdtsc();
+        ok = run_ops(FLOW_OP_CREATE, opt_shape, first, hw_last, NULL, &lat, &failed);
+        print_report(use_async ? "async" : "sync", ok, failed, rte_rdtsc() - t0, &lat);
+        hw_rules = ok;
+        if (opt_sw_fallback) {
+            sw_adopt(opt_shape, first, first + opt_rules, NULL);
+            sw_report();
+            if (hw_rules + sw_rules < opt_rules)
+                printf("%u rules in neither the NIC nor the software table\n",
+                       opt_rules - hw_rules - sw_rules);
+        } else if (ok < opt_rules) {
+            printf("%u rules not installed\n", opt_rules - ok);
         }
 
-        if ((i+1)%100 == 0)
-            printf("Created %u rules...\n", i+1);
-    }
+        printf("Created flow rules. Press Ctrl+C to exit.\n");
 
-    printf("Created flow rules. Press Ctrl+C to exit.\n");
+        while (keep_running) {
+            sleep(1);
+            if (opt_sw_fallback && keep_running) {
+                sw_promote(opt_shape);
+                sw_report();
+            }
+            if (opt_steer > 0 && keep_running) {
+                steer_scan(opt_shape, first, first + opt_rules);
+                steer_report();
+            }
+        }
 
-    while (keep_running)
-        sleep(1);
+        printf("Cleaning up flow rules...\n");
 
-    printf("Cleaning up flow rules...\n");
+        if (opt_sw_fallback || opt_steer > 0)
+            sw_stop();
+        if (opt_sw_fallback)
+            sw_free();
+        steer_default_remove();
 
-    for (uint16_t i = 0; i < 100000; i++) {
-        if (flows[i])
-            rte_flow_destroy(port_id, flows[i], &error);
+        rules_flush(opt_shape, first, first + opt_rules);
+        flow_mode_release();
     }
+    rule_store_free();
 
     rte_eth_dev_stop(port_id);
     rte_eth_dev_close(port_id);
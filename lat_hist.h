@@ -0,0 +1,136 @@
+// lat_hist.h
+// Header-only log-linear latency histogram (HDR-style) with percentiles.
+// - Values below 2^LAT_HIST_SUB_BITS are exact; above that, every power of
+//   two is split into 2^LAT_HIST_SUB_BITS linear sub-buckets, so the relative
+//   error stays below 1/2^LAT_HIST_SUB_BITS (~3%) over the whole range
+// - One writer per histogram (e.g. the thread owning a queue); records are
+//   plain relaxed stores, no locks, no read-modify-write atomics
+// - Readers snapshot, merge and subtract histograms:
+//     cumulative:  snapshot every queue, merge, report
+//     interval:    subtract the previous snapshot before merging, so the
+//                  writer never has to be reset
+// No DPDK dependency; used by the simulator in test_nodpdk.c and by the
+// DPDK forwarders for mbuf-timestamp latencies.
+//
+// Usage:
+//   lat_hist_record(&h[q], ns);                      // writer
+//   lat_hist_snapshot(&h[q], &cur[q]);               // reader
+//   lat_hist_sub(&delta, &cur[q], &prev[q]); lat_hist_merge(&all, &delta);
+//   lat_hist_percentile(&all, 99.9);
+
+#ifndef LAT_HIST_H
+#define LAT_HIST_H
+
+#include <stdint.h>
+#include <string.h>
+
+#define LAT_HIST_SUB_BITS 5                       // 32 sub-buckets per power of two
+#define LAT_HIST_MAX_BITS 40                      // values up to 2^40 (~18 min in ns)
+#define LAT_HIST_SUB      (1u << LAT_HIST_SUB_BITS)
+#define LAT_HIST_BUCKETS  ((LAT_HIST_MAX_BITS - LAT_HIST_SUB_BITS + 1) * LAT_HIST_SUB)
+
+struct lat_hist {
+    uint64_t count;
+    uint64_t sum;
+    uint64_t max;
+    uint64_t b[LAT_HIST_BUCKETS];
+} __attribute__((aligned(64)));
+
+static inline unsigned lat_hist_index(uint64_t v)
+{
+    if (v < LAT_HIST_SUB) return (unsigned)v;
+    if (v >> LAT_HIST_MAX_BITS) return LAT_HIST_BUCKETS - 1;
+    unsigned msb = 63 - (unsigned)__builtin_clzll(v);
+    unsigned shift = msb - LAT_HIST_SUB_BITS;
+    return ((shift + 1) << LAT_HIST_SUB_BITS) | (unsigned)((v >> shift) & (LAT_HIST_SUB - 1));
+}
+
+// Lowest value that falls into bucket idx.
+static inline uint64_t lat_hist_lower(unsigned idx)
+{
+    if (idx < LAT_HIST_SUB) return idx;
+    unsigned shift = (idx >> LAT_HIST_SUB_BITS) - 1;
+    return (uint64_t)(LAT_HIST_SUB | (idx & (LAT_HIST_SUB - 1))) << shift;
+}
+
+// Highest value that falls into bucket idx.
+static inline uint64_t lat_hist_upper(unsigned idx)
+{
+    if (idx < LAT_HIST_SUB) return idx;
+    unsigned shift = (idx >> LAT_HIST_SUB_BITS) - 1;
+    return lat_hist_lower(idx) + ((uint64_t)1 << shift) - 1;
+}
+
+static inline void lat_hist_init(struct lat_hist *h)
+{
+    memset(h, 0, sizeof(*h));
+}
+
+// Writer side: single thread per histogram.
+static inline void lat_hist_record(struct lat_hist *h, uint64_t v)
+{
+    unsigned i = lat_hist_index(v);
+    __atomic_store_n(&h->b[i], h->b[i] + 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&h->sum, h->sum + v, __ATOMIC_RELAXED);
+    if (v > h->max) __atomic_store_n(&h->max, v, __ATOMIC_RELAXED);
+    __atomic_store_n(&h->count, h->count + 1, __ATOMIC_RELAXED);
+}
+
+// Reader side. Counters only grow, so a copy taken while the writer runs
+// is off by at most the few records in flight.
+static inline void lat_hist_snapshot(const struct lat_hist *h, struct lat_hist *out)
+{
+    for (unsigned i = 0; i < LAT_HIST_BUCKETS; i++)
+        out->b[i] = __atomic_load_n(&h->b[i], __ATOMIC_RELAXED);
+    out->sum = __atomic_load_n(&h->sum, __ATOMIC_RELAXED);
+    out->max = __atomic_load_n(&h->max, __ATOMIC_RELAXED);
+    out->count = 0;
+    for (unsigned i = 0; i < LAT_HIST_BUCKETS; i++) out->count += out->b[i];
+}
+
+static inline void lat_hist_merge(struct lat_hist *dst, const struct lat_hist *src)
+{
+    for (unsigned i = 0; i < LAT_HIST_BUCKETS; i++) dst->b[i] += src->b[i];
+    dst->count += src->count;
+    dst->sum += src->sum;
+    if (src->max > dst->max) dst->max = src->max;
+}
+
+// dst = cur - prev (one interval). The interval max is the upper bound of
+// the highest non-empty bucket, capped by the cumulative max.
+static inline void lat_hist_sub(struct lat_hist *dst, const struct lat_hist *cur, const struct lat_hist *prev)
+{
+    dst->count = 0;
+    dst->max = 0;
+    for (unsigned i = 0; i < LAT_HIST_BUCKETS; i++) {
+        dst->b[i] = cur->b[i] - prev->b[i];
+        dst->count += dst->b[i];
+        if (dst->b[i]) dst->max = lat_hist_upper(i);
+    }
+    dst->sum = cur->sum - prev->sum;
+    if (dst->max > cur->max) dst->max = cur->max;
+}
+
+// Value at percentile p (0..100): upper bound of the bucket that holds it.
+static inline uint64_t lat_hist_percentile(const struct lat_hist *h, double p)
+{
+    if (h->count == 0) return 0;
+    uint64_t rank = (uint64_t)(p / 100.0 * (double)h->count + 0.5);
+    if (rank == 0) rank = 1;
+    uint64_t seen = 0;
+    for (unsigned i = 0; i < LAT_HIST_BUCKETS; i++) {
+        seen += h->b[i];
+        if (seen >= rank) {
+            uint64_t v = lat_hist_upper(i);
+            return v < h->max ? v : h->max;
+        }
+    }
+    return h->max;
+}
+
+static inline uint64_t lat_hist_mean(const struct lat_hist *h)
+{
+    return h->count ? h->sum / h->count : 0;
+}
+
+#endif // LAT_HIST_H
@@ -0,0 +1,118 @@
+// mac_swap.h
+// Software-pipelined L2 MAC swap over a burst of mbufs.
+// - Packet i + MAC_SWAP_PREFETCH is prefetched while packet i is swapped,
+//   so headers arrive in L1 ahead of the loop instead of one miss per packet
+// - The swap is one byte shuffle over the first 16 header bytes (dst, src,
+//   ethertype and two payload bytes, the last four stay in place):
+//     AVX2   two headers per 256-bit shuffle
+//     SSSE3  one header per 128-bit shuffle
+//     else   rte_ether_addr_copy
+// - Packets with less than 16 bytes in the first segment use the scalar swap
+//
+// Tune the prefetch distance at build time with -DMAC_SWAP_PREFETCH=N.
+
+#ifndef MAC_SWAP_H
+#define MAC_SWAP_H
+
+#include <stdint.h>
+
+#include <rte_branch_prediction.h>
+#include <rte_ether.h>
+#include <rte_mbuf.h>
+#include <rte_prefetch.h>
+#if defined(__SSSE3__) || defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+#ifndef MAC_SWAP_PREFETCH
+#define MAC_SWAP_PREFETCH 4
+#endif
+
+#define MAC_SWAP_VEC_LEN 16
+
+static inline void mac_swap_scalar(struct rte_mbuf *m)
+{
+    struct rte_ether_hdr *eth = rte_pktmbuf_mtod(m, struct rte_ether_hdr *);
+    struct rte_ether_addr tmp;
+    rte_ether_addr_copy(&eth->src_addr, &tmp);
+    rte_ether_addr_copy(&eth->dst_addr, &eth->src_addr);
+    rte_ether_addr_copy(&tmp, &eth->dst_addr);
+}
+
+static inline void mac_swap_one(struct rte_mbuf *m)
+{
+#if defined(__SSSE3__) || defined(__AVX2__)
+    if (likely(rte_pktmbuf_data_len(m) >= MAC_SWAP_VEC_LEN)) {
+        const __m128i mask = _mm_setr_epi8(6, 7, 8, 9, 10, 11, 0, 1, 2, 3, 4, 5, 12, 13, 14, 15);
+        __m128i *h = rte_pktmbuf_mtod(m, __m128i *);
+        _mm_storeu_si128(h, _mm_shuffle_epi8(_mm_loadu_si128(h), mask));
+        return;
+    }
+#endif
+    mac_swap_scalar(m);
+}
+
+#if defined(__AVX2__)
+static inline void mac_swap_two(struct rte_mbuf *a, struct rte_mbuf *b)
+{
+    if (unlikely(rte_pktmbuf_data_len(a) < MAC_SWAP_VEC_LEN ||
+                 rte_pktmbuf_data_len(b) < MAC_SWAP_VEC_LEN)) {
+        mac_swap_one(a);
+        mac_swap_one(b);
+        return;
+    }
+    // _mm256_shuffle_epi8 works per 128-bit lane: same mask in both lanes
+    const __m256i mask = _mm256_setr_epi8(6, 7, 8, 9, 10, 11, 0, 1, 2, 3, 4, 5, 12, 13, 14, 15,
+                                          6, 7, 8, 9, 10, 11, 0, 1, 2, 3, 4, 5, 12, 13, 14, 15);
+    __m128i *ha = rte_pktmbuf_mtod(a, __m128i *);
+    __m128i *hb = rte_pktmbuf_mtod(b, __m128i *);
+    __m256i v = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128(ha)),
+                                        _mm_loadu_si128(hb), 1);
+    v = _mm256_shuffle_epi8(v, mask);
+    _mm_storeu_si128(ha, _mm256_castsi256_si128(v));
+    _mm_storeu_si128(hb, _mm256_extracti128_si256(v, 1));
+}
+#endif
+
+static inline void mac_swap_prefetch(struct rte_mbuf **pkts, uint16_t i, uint16_t n)
+{
+    if (i < n)
+        rte_prefetch0(rte_pktmbuf_mtod(pkts[i], void *));
+}
+
+// Pipelined loop with the per-packet scalar swap (the baseline for mac_swap_burst).
+static inline void mac_swap_burst_scalar(struct rte_mbuf **pkts, uint16_t n)
+{
+    uint16_t i;
+
+    for (i = 0; i < MAC_SWAP_PREFETCH && i < n; i++)
+        rte_prefetch0(rte_pktmbuf_mtod(pkts[i], void *));
+    for (i = 0; i < n; i++) {
+        mac_swap_prefetch(pkts, i + MAC_SWAP_PREFETCH, n);
+        mac_swap_scalar(pkts[i]);
+    }
+}
+
+static inline void mac_swap_burst(struct rte_mbuf **pkts, uint16_t n)
+{
+    uint16_t i;
+
+    for (i = 0; i < MAC_SWAP_PREFETCH && i < n; i++)
+        rte_prefetch0(rte_pktmbuf_mtod(pkts[i], void *));
+#if defined(__AVX2__)
+    for (i = 0; i + 1 < n; i += 2) {
+        mac_swap_prefetch(pkts, i + MAC_SWAP_PREFETCH, n);
+        mac_swap_prefetch(pkts, i + 1 + MAC_SWAP_PREFETCH, n);
+        mac_swap_two(pkts[i], pkts[i + 1]);
+    }
+    if (i < n)
+        mac_swap_one(pkts[i]);
+#else
+    for (i = 0; i < n; i++) {
+        mac_swap_prefetch(pkts, i + MAC_SWAP_PREFETCH, n);
+        mac_swap_one(pkts[i]);
+    }
+#endif
+}
+
+#endif // MAC_SWAP_H
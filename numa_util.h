@@ -0,0 +1,85 @@
+// numa_util.h
+// NUMA placement helpers shared by the DPDK apps.
+// - numa_port_socket: socket of a port's NIC, the main lcore's socket when
+//   the PMD does not know (SOCKET_ID_ANY)
+// - numa_pool_get: one mbuf pool per socket, created on first use, so RX
+//   queues DMA into memory local to their port
+// - numa_pick_lcore: an idle worker lcore, on the wanted socket if any
+// - numa_check_lcore: warns once per (lcore, port) pair when polling has
+//   to cross sockets
+// Every helper works unchanged on single-socket machines.
+
+#ifndef NUMA_UTIL_H
+#define NUMA_UTIL_H
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdint.h>
+
+#include <rte_ethdev.h>
+#include <rte_launch.h>
+#include <rte_lcore.h>
+#include <rte_mbuf.h>
+#include <rte_mempool.h>
+
+static struct rte_mempool *numa_pools[RTE_MAX_NUMA_NODES];
+
+static inline int numa_port_socket(uint16_t port)
+{
+    int s = rte_eth_dev_socket_id(port);
+    if (s < 0 || s >= RTE_MAX_NUMA_NODES) s = (int)rte_socket_id();
+    return s;
+}
+
+// Pool of the socket, created with nb_mbufs/cache on the first call for it.
+// Falls back to any socket (with a warning) if the local one has no memory.
+static inline struct rte_mempool *numa_pool_get(const char *prefix, int socket,
+                                                unsigned nb_mbufs, unsigned cache)
+{
+    char name[RTE_MEMPOOL_NAMESIZE];
+
+    if (socket < 0 || socket >= RTE_MAX_NUMA_NODES) socket = (int)rte_socket_id();
+    if (numa_pools[socket]) return numa_pools[socket];
+
+    snprintf(name, sizeof(name), "%s_S%d", prefix, socket);
+    numa_pools[socket] = rte_pktmbuf_pool_create(name, nb_mbufs, cache, 0,
+                                                 RTE_MBUF_DEFAULT_BUF_SIZE, socket);
+    if (!numa_pools[socket]) {
+        fprintf(stderr, "Warning: no mbuf pool on socket %d, trying any socket\n", socket);
+        numa_pools[socket] = rte_pktmbuf_pool_create(name, nb_mbufs, cache, 0,
+                                                     RTE_MBUF_DEFAULT_BUF_SIZE, SOCKET_ID_ANY);
+    }
+    return numa_pools[socket];
+}
+
+// Idle worker lcore, preferring 'socket'; used[] (may be NULL) marks lcores
+// already given work that has not been launched yet. RTE_MAX_LCORE if none.
+static inline unsigned numa_pick_lcore(int socket, const bool *used)
+{
+    unsigned l, other = RTE_MAX_LCORE;
+
+    RTE_LCORE_FOREACH_WORKER(l) {
+        if ((used && used[l]) || rte_eal_get_lcore_state(l) != WAIT) continue;
+        if ((int)rte_lcore_to_socket_id(l) == socket) return l;
+        if (other == RTE_MAX_LCORE) other = l;
+    }
+    return other;
+}
+
+// Returns true (and warns once per pair) when lcore and port sit on different sockets.
+static inline bool numa_check_lcore(unsigned lcore, uint16_t port)
+{
+    static uint8_t warned[RTE_MAX_LCORE][(RTE_MAX_ETHPORTS + 7) / 8];
+    int ps = numa_port_socket(port);
+    int ls = (int)rte_lcore_to_socket_id(lcore);
+
+    if (ps == ls || rte_socket_count() < 2) return false;
+    if (!(warned[lcore][port / 8] & (1u << (port % 8)))) {
+        warned[lcore][port / 8] |= 1u << (port % 8);
+        printf("Warning: lcore %u (socket %d) polls port %u (socket %d) across sockets\n",
+               lcore, ls, port, ps);
+    }
+    return true;
+}
+
+#endif // NUMA_UTIL_H
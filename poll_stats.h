@@ -0,0 +1,150 @@
+// poll_stats.h
+// Header-only poll-loop instrumentation shared by the RX loops in this repo.
+// - Histogram of nb_rx per poll (0..POLL_STATS_MAX_BURST)
+// - Cycles spent on non-empty bursts vs. empty polls
+// - Busy ratio = useful cycles / all cycles, which is what matters on a
+//   poll-mode core that always shows 100% in /proc/stat
+//
+// One writer (the polling thread) per struct poll_stats. Readers take a
+// consistent copy with poll_stats_snapshot() without ever stalling the writer.
+// No DPDK dependency, so the simulator in test_nodpdk.c can use it as well.
+//
+// Usage in an RX loop:
+//   uint64_t t = poll_stats_cycles();
+//   while (running) {
+//       n = rx_burst(...);
+//       if (n == 0) { pause(); t = poll_stats_record(ps, 0, t); continue; }
+//       ...process...
+//       t = poll_stats_record(ps, n, t);
+//   }
+
+#ifndef POLL_STATS_H
+#define POLL_STATS_H
+
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#ifndef POLL_STATS_MAX_BURST
+#define POLL_STATS_MAX_BURST 32
+#endif
+
+struct poll_stats {
+    uint32_t seq;          // odd while the writer is updating
+    uint64_t polls;
+    uint64_t pkts;
+    uint64_t busy_cycles;  // polls that returned packets, incl. processing
+    uint64_t idle_cycles;  // empty polls, incl. any pause/yield after them
+    uint64_t burst_hist[POLL_STATS_MAX_BURST + 1];
+} __attribute__((aligned(64)));
+
+// cycle counter: TSC on x86, virtual counter on arm64, ns elsewhere
+static inline uint64_t poll_stats_cycles(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#elif defined(__aarch64__)
+    uint64_t v;
+    __asm__ __volatile__("mrs %0, cntvct_el0" : "=r"(v));
+    return v;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+static inline void poll_stats_init(struct poll_stats *ps)
+{
+    memset(ps, 0, sizeof(*ps));
+}
+
+static inline void poll_stats_write_begin(struct poll_stats *ps)
+{
+    __atomic_store_n(&ps->seq, ps->seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static inline void poll_stats_write_end(struct poll_stats *ps)
+{
+    __atomic_store_n(&ps->seq, ps->seq + 1, __ATOMIC_RELEASE);
+}
+
+// Account one poll that returned nb_rx packets and started at t_start.
+// Returns the end timestamp, to be passed as t_start of the next poll.
+static inline uint64_t poll_stats_record(struct poll_stats *ps, unsigned nb_rx, uint64_t t_start)
+{
+    uint64_t now = poll_stats_cycles();
+    if (nb_rx > POLL_STATS_MAX_BURST) nb_rx = POLL_STATS_MAX_BURST;
+
+    poll_stats_write_begin(ps);
+    ps->polls++;
+    ps->pkts += nb_rx;
+    ps->burst_hist[nb_rx]++;
+    if (nb_rx) ps->busy_cycles += now - t_start;
+    else       ps->idle_cycles += now - t_start;
+    poll_stats_write_end(ps);
+    return now;
+}
+
+// Charge cycles since t_start to idle time without counting a poll
+// (e.g. a pause after a round of empty polls). Returns the new timestamp.
+static inline uint64_t poll_stats_idle(struct poll_stats *ps, uint64_t t_start)
+{
+    uint64_t now = poll_stats_cycles();
+    poll_stats_write_begin(ps);
+    ps->idle_cycles += now - t_start;
+    poll_stats_write_end(ps);
+    return now;
+}
+
+// Consistent copy of a poll_stats block written by another thread.
+static inline void poll_stats_snapshot(const struct poll_stats *ps, struct poll_stats *out)
+{
+    uint32_t seq0, seq1;
+    do {
+        seq0 = __atomic_load_n(&ps->seq, __ATOMIC_ACQUIRE);
+        if (seq0 & 1) continue;
+        memcpy(out, ps, sizeof(*out));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        seq1 = __atomic_load_n(&ps->seq, __ATOMIC_RELAXED);
+    } while ((seq0 & 1) || seq0 != seq1);
+}
+
+// Fraction 0..1 of cycles spent on non-empty polls between two snapshots.
+static inline double poll_stats_busy_ratio(const struct poll_stats *cur, const struct poll_stats *prev)
+{
+    uint64_t busy = cur->busy_cycles - prev->busy_cycles;
+    uint64_t idle = cur->idle_cycles - prev->idle_cycles;
+    if (busy + idle == 0) return 0.0;
+    return (double)busy / (double)(busy + idle);
+}
+
+// Average cycles per non-empty burst between two snapshots.
+static inline double poll_stats_cycles_per_burst(const struct poll_stats *cur, const struct poll_stats *prev)
+{
+    uint64_t bursts = (cur->polls - prev->polls) - (cur->burst_hist[0] - prev->burst_hist[0]);
+    if (bursts == 0) return 0.0;
+    return (double)(cur->busy_cycles - prev->busy_cycles) / (double)bursts;
+}
+
+// Fraction 0..1 of polls that came back empty / completely full.
+static inline double poll_stats_empty_ratio(const struct poll_stats *cur, const struct poll_stats *prev)
+{
+    uint64_t polls = cur->polls - prev->polls;
+    if (polls == 0) return 0.0;
+    return (double)(cur->burst_hist[0] - prev->burst_hist[0]) / (double)polls;
+}
+
+static inline double poll_stats_full_ratio(const struct poll_stats *cur, const struct poll_stats *prev, unsigned burst)
+{
+    uint64_t polls = cur->polls - prev->polls;
+    if (burst > POLL_STATS_MAX_BURST) burst = POLL_STATS_MAX_BURST;
+    if (polls == 0) return 0.0;
+    return (double)(cur->burst_hist[burst] - prev->burst_hist[burst]) / (double)polls;
+}
+
+#endif // POLL_STATS_H
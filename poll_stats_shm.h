@@ -0,0 +1,102 @@
+// poll_stats_shm.h
+// Per-lcore poll_stats published in a named memzone.
+// - RX workers attach a slot for their lcore and record into it
+// - Monitors look the memzone up (also from a --proc-type=secondary
+//   process) and read "useful vs. idle-poll cycles" per port, instead of
+//   sampling /proc/stat where a poll-mode core is always 100% busy
+
+#ifndef POLL_STATS_SHM_H
+#define POLL_STATS_SHM_H
+
+#include <stdint.h>
+#include <string.h>
+
+#include <rte_lcore.h>
+#include <rte_memzone.h>
+
+#include "poll_stats.h"
+
+#define POLL_STATS_SHM_NAME "scalemate_poll_stats"
+
+struct poll_stats_slot {
+    struct poll_stats ps;
+    uint16_t port;          // port polled by this lcore
+    uint16_t queue;         // first queue polled by this lcore
+    volatile uint8_t active;
+} __attribute__((aligned(64)));
+
+struct poll_stats_shm {
+    uint32_t max_burst;     // POLL_STATS_MAX_BURST of the writer (layout check)
+    struct poll_stats_slot slot[RTE_MAX_LCORE];
+};
+
+// Reserve the memzone, or reuse it if this process already created it.
+static inline struct poll_stats_shm *poll_stats_shm_create(void)
+{
+    const struct rte_memzone *mz = rte_memzone_lookup(POLL_STATS_SHM_NAME);
+    if (mz) return (struct poll_stats_shm *)mz->addr;
+
+    mz = rte_memzone_reserve(POLL_STATS_SHM_NAME, sizeof(struct poll_stats_shm),
+                             rte_socket_id(), 0);
+    if (!mz) return NULL;
+    struct poll_stats_shm *shm = (struct poll_stats_shm *)mz->addr;
+    memset(shm, 0, sizeof(*shm));
+    shm->max_burst = POLL_STATS_MAX_BURST;
+    return shm;
+}
+
+// Find a memzone published by another process; NULL if there is none yet.
+static inline struct poll_stats_shm *poll_stats_shm_lookup(void)
+{
+    const struct rte_memzone *mz = rte_memzone_lookup(POLL_STATS_SHM_NAME);
+    if (!mz) return NULL;
+    struct poll_stats_shm *shm = (struct poll_stats_shm *)mz->addr;
+    if (shm->max_burst != POLL_STATS_MAX_BURST) return NULL;
+    return shm;
+}
+
+// Called by an RX worker on its own lcore before it starts polling.
+// The counters are zeroed once by poll_stats_shm_create() and keep counting
+// across detach/attach (autoscale re-growing onto an lcore): monitors keep
+// the last sample of a slot as 'prev', and a reset would wrap their deltas.
+static inline struct poll_stats *poll_stats_shm_attach(struct poll_stats_shm *shm,
+                                                       uint16_t port, uint16_t queue)
+{
+    struct poll_stats_slot *slot = &shm->slot[rte_lcore_id()];
+    slot->port = port;
+    slot->queue = queue;
+    __atomic_store_n(&slot->active, 1, __ATOMIC_RELEASE);
+    return &slot->ps;
+}
+
+static inline void poll_stats_shm_detach(struct poll_stats_shm *shm)
+{
+    __atomic_store_n(&shm->slot[rte_lcore_id()].active, 0, __ATOMIC_RELEASE);
+}
+
+// Snapshot every active slot once per interval, so all ports share one window.
+static inline void poll_stats_shm_sample(const struct poll_stats_shm *shm, struct poll_stats *cur)
+{
+    for (unsigned l = 0; l < RTE_MAX_LCORE; l++) {
+        if (__atomic_load_n(&shm->slot[l].active, __ATOMIC_ACQUIRE))
+            poll_stats_snapshot(&shm->slot[l].ps, &cur[l]);
+    }
+}
+
+// Busy ratio (0..1) of the most loaded lcore polling 'port' between two
+// samples; -1 if no lcore polls it.
+static inline double poll_stats_shm_port_busy(const struct poll_stats_shm *shm,
+                                              const struct poll_stats *cur,
+                                              const struct poll_stats *prev,
+                                              uint16_t port)
+{
+    double busy = -1.0;
+    for (unsigned l = 0; l < RTE_MAX_LCORE; l++) {
+        if (!shm->slot[l].active || shm->slot[l].port != port) continue;
+        double b = poll_stats_busy_ratio(&cur[l], &prev[l]);
+        if (b > busy) busy = b;
+    }
+    return busy;
+}
+
+#endif // POLL_STATS_SHM_H
@@ -0,0 +1,92 @@
+// pool_size.h
+// mbuf pool sizing and exhaustion tracking shared by the DPDK apps.
+// - pool_size_calc: every place an mbuf can sit at the same time
+//     RX rings       nb_rxq * rx_desc (all descriptors armed)
+//     TX rings       nb_txq * tx_desc (sent, not yet reclaimed)
+//     lcore caches   nb_lcores * cache * 3/2 (the flush threshold)
+//     in flight      nb_lcores * burst * depth (RX bursts, TX buffers, ...)
+//   rounded up to 2^n - 1, the size the ring-backed mempool stores best
+// - pool_size_report: the breakdown and the hugepage footprint
+// - pool_watch: low-water mark of free mbufs and rx_nombuf (RX refill
+//   failures) of the ports filling from the pool; a low-water mark near 0
+//   or a growing rx_nombuf means the pool is too small
+
+#ifndef POOL_SIZE_H
+#define POOL_SIZE_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <rte_common.h>
+#include <rte_ethdev.h>
+#include <rte_mbuf.h>
+#include <rte_mempool.h>
+
+struct pool_size_req {
+    unsigned nb_rxq, rx_desc;
+    unsigned nb_txq, tx_desc;
+    unsigned nb_lcores;     // lcores that allocate or free from the pool
+    unsigned cache;         // per-lcore mempool cache size
+    unsigned burst;
+    unsigned depth;         // bursts each lcore can hold outside the rings
+};
+
+static inline unsigned pool_size_calc(const struct pool_size_req *r)
+{
+    uint64_t n = (uint64_t)r->nb_rxq * r->rx_desc
+               + (uint64_t)r->nb_txq * r->tx_desc
+               + (uint64_t)r->nb_lcores * r->cache * 3 / 2
+               + (uint64_t)r->nb_lcores * r->burst * r->depth;
+    if (n < 1023) n = 1023;
+    if (n >= UINT32_MAX / 2) return UINT32_MAX / 2;
+    return rte_align32pow2((uint32_t)n + 1) - 1;
+}
+
+// Print the breakdown and the memory the pool will take.
+static inline void pool_size_report(const char *name, const struct pool_size_req *r,
+                                    unsigned n, uint16_t data_room)
+{
+    struct rte_mempool_objsz sz;
+    uint32_t obj = rte_mempool_calc_obj_size(sizeof(struct rte_mbuf) + data_room, 0, &sz);
+    uint64_t bytes = (uint64_t)n * obj;
+
+    printf("%s: %u mbufs (rx %u + tx %u + cache %u + in-flight %u), %u B each, "
+           "%.1f MB = %u x 2 MB hugepages\n",
+           name, n, r->nb_rxq * r->rx_desc, r->nb_txq * r->tx_desc,
+           r->nb_lcores * r->cache * 3 / 2, r->nb_lcores * r->burst * r->depth,
+           obj, bytes / (1024.0 * 1024.0), (unsigned)((bytes + (2u << 20) - 1) >> 21));
+}
+
+struct pool_watch {
+    struct rte_mempool *mp;
+    unsigned min_avail;     // fewest free mbufs seen
+    uint64_t nombuf;        // rx_nombuf of the ports filling from mp, last sample
+    uint64_t nombuf_prev;   // previous sample, for the per-interval delta
+};
+
+static inline void pool_watch_init(struct pool_watch *w, struct rte_mempool *mp)
+{
+    memset(w, 0, sizeof(*w));
+    w->mp = mp;
+    w->min_avail = UINT32_MAX;
+}
+
+// One sample; a port belongs to the pool its RX queue 0 refills from.
+static inline void pool_watch_sample(struct pool_watch *w)
+{
+    unsigned avail = rte_mempool_avail_count(w->mp);
+    uint16_t port;
+
+    if (avail < w->min_avail) w->min_avail = avail;
+    w->nombuf_prev = w->nombuf;
+    w->nombuf = 0;
+    RTE_ETH_FOREACH_DEV(port) {
+        struct rte_eth_rxq_info qinfo;
+        struct rte_eth_stats st;
+        if (rte_eth_rx_queue_info_get(port, 0, &qinfo) != 0 || qinfo.mp != w->mp) continue;
+        if (rte_eth_stats_get(port, &st) == 0) w->nombuf += st.rx_nombuf;
+    }
+}
+
+#endif // POOL_SIZE_H
@@ -0,0 +1,113 @@
+// queue_xstats.h
+// Per-queue RX counters from ethdev xstats for the ScaleMate dashboards.
+// - Names are resolved to xstat IDs once (rte_eth_xstats_get_names_by_id)
+// - Each tick fetches only those IDs (rte_eth_xstats_get_by_id)
+// - Skew = busiest queue pps / mean queue pps, 1.0 means RSS spreads evenly
+
+#ifndef QUEUE_XSTATS_H
+#define QUEUE_XSTATS_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <rte_ethdev.h>
+
+#define QX_MAX_QUEUES   16
+#define QX_SKEW_WARN    1.5     // flag RSS imbalance above this skew
+#define QX_SKEW_MIN_PPS 1000.0  // ...but only when the port carries traffic
+
+enum { QX_RX_PKTS = 0, QX_RX_BYTES, QX_RX_ERRORS, QX_RX_MISSED, QX_FIELDS };
+
+// candidate xstat names per field; PMDs differ on the missed counter
+static const char *const qx_name_fmt[QX_FIELDS][3] = {
+    [QX_RX_PKTS]   = { "rx_q%u_packets", NULL, NULL },
+    [QX_RX_BYTES]  = { "rx_q%u_bytes", NULL, NULL },
+    [QX_RX_ERRORS] = { "rx_q%u_errors", NULL, NULL },
+    [QX_RX_MISSED] = { "rx_q%u_missed", "rx_q%u_missed_errors", "rx_queue_%u_missed" },
+};
+
+struct queue_xstats {
+    uint16_t port;
+    uint16_t nb_q;
+    unsigned nb_ids;
+    uint64_t ids[QX_MAX_QUEUES * QX_FIELDS];
+    int slot[QX_MAX_QUEUES][QX_FIELDS];       // index into ids/values, -1 if absent
+    uint64_t values[QX_MAX_QUEUES * QX_FIELDS];
+    uint64_t prev[QX_MAX_QUEUES * QX_FIELDS];
+    int primed;                               // prev holds a valid sample
+};
+
+// Resolve the per-queue xstat IDs of a port. Returns number of IDs found, <0 on error.
+static inline int queue_xstats_init(struct queue_xstats *qx, uint16_t port)
+{
+    struct rte_eth_dev_info dev_info;
+    memset(qx, 0, sizeof(*qx));
+    memset(qx->slot, -1, sizeof(qx->slot));
+    qx->port = port;
+
+    if (rte_eth_dev_info_get(port, &dev_info) != 0) return -1;
+    qx->nb_q = dev_info.nb_rx_queues < QX_MAX_QUEUES ? dev_info.nb_rx_queues : QX_MAX_QUEUES;
+
+    int n = rte_eth_xstats_get_names_by_id(port, NULL, 0, NULL);
+    if (n <= 0) return n;
+    struct rte_eth_xstat_name *names = calloc(n, sizeof(*names));
+    if (!names) return -1;
+    if (rte_eth_xstats_get_names_by_id(port, names, n, NULL) != n) { free(names); return -1; }
+
+    for (uint16_t q = 0; q < qx->nb_q; q++) {
+        for (int f = 0; f < QX_FIELDS; f++) {
+            for (int c = 0; c < 3 && qx_name_fmt[f][c] && qx->slot[q][f] < 0; c++) {
+                char want[RTE_ETH_XSTATS_NAME_SIZE];
+                snprintf(want, sizeof(want), qx_name_fmt[f][c], q);
+                for (int i = 0; i < n; i++) {
+                    if (strcmp(names[i].name, want) != 0) continue;
+                    qx->slot[q][f] = (int)qx->nb_ids;
+                    qx->ids[qx->nb_ids++] = (uint64_t)i;
+                    break;
+                }
+            }
+        }
+    }
+    free(names);
+    return (int)qx->nb_ids;
+}
+
+// Fetch the resolved IDs; previous values are kept for rates.
+static inline int queue_xstats_sample(struct queue_xstats *qx)
+{
+    if (qx->nb_ids == 0) return -1;
+    memcpy(qx->prev, qx->values, sizeof(qx->values));
+    int ret = rte_eth_xstats_get_by_id(qx->port, qx->ids, qx->values, qx->nb_ids);
+    if (ret != (int)qx->nb_ids) return -1;
+    if (!qx->primed) { memcpy(qx->prev, qx->values, sizeof(qx->values)); qx->primed = 1; }
+    return 0;
+}
+
+// Per-second rate of one field of one queue; -1 when the PMD has no such xstat.
+static inline double queue_xstats_rate(const struct queue_xstats *qx, uint16_t q, int field, double dt)
+{
+    int s = qx->slot[q][field];
+    if (s < 0 || dt <= 0) return -1.0;
+    uint64_t d = qx->values[s] >= qx->prev[s] ? qx->values[s] - qx->prev[s] : qx->values[s];
+    return (double)d / dt;
+}
+
+// Busiest queue pps over mean queue pps; 1.0 with a single queue or no data.
+static inline double queue_xstats_skew(const struct queue_xstats *qx, double dt, double *total_pps)
+{
+    double sum = 0.0, max = 0.0;
+    unsigned n = 0;
+    for (uint16_t q = 0; q < qx->nb_q; q++) {
+        double pps = queue_xstats_rate(qx, q, QX_RX_PKTS, dt);
+        if (pps < 0) continue;
+        sum += pps; n++;
+        if (pps > max) max = pps;
+    }
+    if (total_pps) *total_pps = sum;
+    if (n < 2 || sum <= 0) return 1.0;
+    return max / (sum / n);
+}
+
+#endif // QUEUE_XSTATS_H
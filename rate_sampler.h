@@ -0,0 +1,198 @@
+// rate_sampler.h
+// Sub-second port rate sampling for the ScaleMate dashboards.
+// - All ports are read back-to-back and stamped with one TSC value (the
+//   midpoint of the read), so every port shares the same window
+// - A ring buffer keeps the last 'depth' samples
+// - Window rate: average between the newest sample and the oldest one
+//   inside the window
+// - Peak rate: highest rate between two consecutive samples in the window.
+//   Microbursts that fill a 1024-entry RX ring in a few ms show up here and
+//   vanish in a 1 s average.
+// - EWMA rate: alpha = dt / (tau + dt) per sample, so uneven sample spacing
+//   does not skew the average
+
+#ifndef RATE_SAMPLER_H
+#define RATE_SAMPLER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <rte_cycles.h>
+#include <rte_ethdev.h>
+
+struct rs_counters {
+    uint64_t ipackets, opackets;
+    uint64_t ibytes, obytes;
+    uint64_t imissed;
+    uint8_t ok;             // rte_eth_stats_get succeeded
+};
+
+struct rs_rates {
+    double rx_pps, tx_pps;
+    double rx_bps, tx_bps;
+    double missed_pps;
+    double dt;              // seconds covered
+};
+
+struct rate_sampler {
+    uint16_t nb_ports;
+    unsigned depth;         // ring entries
+    unsigned head;          // next slot to write
+    unsigned count;         // valid entries
+    uint64_t hz;
+    uint64_t ewma_tau;      // EWMA time constant in TSC cycles
+    uint64_t *tsc;          // [depth]
+    struct rs_counters *c;  // [depth][nb_ports]
+    struct rs_rates *ewma;  // [nb_ports]
+};
+
+static inline int rate_sampler_init(struct rate_sampler *rs, uint16_t nb_ports,
+                                    unsigned depth, unsigned ewma_ms)
+{
+    memset(rs, 0, sizeof(*rs));
+    if (nb_ports == 0 || depth < 2) return -1;
+    rs->nb_ports = nb_ports;
+    rs->depth = depth;
+    rs->hz = rte_get_tsc_hz();
+    rs->ewma_tau = rs->hz / 1000 * ewma_ms;
+    rs->tsc = calloc(depth, sizeof(*rs->tsc));
+    rs->c = calloc((size_t)depth * nb_ports, sizeof(*rs->c));
+    rs->ewma = calloc(nb_ports, sizeof(*rs->ewma));
+    if (!rs->tsc || !rs->c || !rs->ewma) return -1;
+    return 0;
+}
+
+static inline void rate_sampler_free(struct rate_sampler *rs)
+{
+    free(rs->tsc); free(rs->c); free(rs->ewma);
+    memset(rs, 0, sizeof(*rs));
+}
+
+// i-th newest entry (0 = newest); caller checks i < count
+static inline unsigned rs_slot(const struct rate_sampler *rs, unsigned i)
+{
+    return (rs->head + rs->depth - 1 - i) % rs->depth;
+}
+
+static inline const struct rs_counters *rs_at(const struct rate_sampler *rs, unsigned slot, uint16_t port)
+{
+    return &rs->c[(size_t)slot * rs->nb_ports + port];
+}
+
+static inline uint64_t rs_delta(uint64_t cur, uint64_t prev)
+{
+    return cur >= prev ? cur - prev : cur; // counter reset
+}
+
+// Rates between two entries of one port; false if either stats read failed.
+static inline bool rs_rates_between(const struct rate_sampler *rs, unsigned new_slot,
+                                    unsigned old_slot, uint16_t port, struct rs_rates *r)
+{
+    const struct rs_counters *a = rs_at(rs, new_slot, port), *b = rs_at(rs, old_slot, port);
+    uint64_t cyc = rs->tsc[new_slot] - rs->tsc[old_slot];
+    memset(r, 0, sizeof(*r));
+    if (!a->ok || !b->ok || cyc == 0) return false;
+    double dt = (double)cyc / (double)rs->hz;
+    r->dt = dt;
+    r->rx_pps = (double)rs_delta(a->ipackets, b->ipackets) / dt;
+    r->tx_pps = (double)rs_delta(a->opackets, b->opackets) / dt;
+    r->rx_bps = (double)rs_delta(a->ibytes, b->ibytes) * 8.0 / dt;
+    r->tx_bps = (double)rs_delta(a->obytes, b->obytes) * 8.0 / dt;
+    r->missed_pps = (double)rs_delta(a->imissed, b->imissed) / dt;
+    return true;
+}
+
+static inline void rs_ewma_update(struct rs_rates *e, const struct rs_rates *r, double alpha)
+{
+    e->rx_pps     += alpha * (r->rx_pps - e->rx_pps);
+    e->tx_pps     += alpha * (r->tx_pps - e->tx_pps);
+    e->rx_bps     += alpha * (r->rx_bps - e->rx_bps);
+    e->tx_bps     += alpha * (r->tx_bps - e->tx_bps);
+    e->missed_pps += alpha * (r->missed_pps - e->missed_pps);
+    e->dt = r->dt;
+}
+
+// Read every port back-to-back and push one entry. Returns the entry's TSC.
+static inline uint64_t rate_sampler_take(struct rate_sampler *rs)
+{
+    unsigned slot = rs->head;
+    struct rs_counters *row = &rs->c[(size_t)slot * rs->nb_ports];
+    uint64_t t0 = rte_rdtsc();
+    for (uint16_t p = 0; p < rs->nb_ports; p++) {
+        struct rte_eth_stats st;
+        row[p].ok = rte_eth_stats_get(p, &st) == 0;
+        if (!row[p].ok) continue;
+        row[p].ipackets = st.ipackets;
+        row[p].opackets = st.opackets;
+        row[p].ibytes   = st.ibytes;
+        row[p].obytes   = st.obytes;
+        row[p].imissed  = st.imissed;
+    }
+    uint64_t t1 = rte_rdtsc();
+    rs->tsc[slot] = t0 + (t1 - t0) / 2;
+
+    rs->head = (rs->head + 1) % rs->depth;
+    if (rs->count < rs->depth) rs->count++;
+
+    if (rs->count >= 2) {
+        unsigned prev = rs_slot(rs, 1);
+        for (uint16_t p = 0; p < rs->nb_ports; p++) {
+            struct rs_rates r;
+            if (!rs_rates_between(rs, slot, prev, p, &r)) continue;
+            double alpha = rs->ewma_tau ? r.dt / ((double)rs->ewma_tau / (double)rs->hz + r.dt) : 1.0;
+            if (rs->count == 2) alpha = 1.0; // seed with the first rate
+            rs_ewma_update(&rs->ewma[p], &r, alpha);
+        }
+    }
+    return rs->tsc[slot];
+}
+
+// Oldest entry no more than 'window' cycles older than the newest one.
+static inline unsigned rs_window_depth(const struct rate_sampler *rs, uint64_t window)
+{
+    uint64_t newest = rs->tsc[rs_slot(rs, 0)];
+    unsigned i = 1;
+    while (i + 1 < rs->count && newest - rs->tsc[rs_slot(rs, i + 1)] <= window) i++;
+    return i;
+}
+
+// Average rates of a port over the last 'window_ms'.
+static inline bool rate_sampler_window(const struct rate_sampler *rs, uint16_t port,
+                                       unsigned window_ms, struct rs_rates *out)
+{
+    memset(out, 0, sizeof(*out));
+    if (rs->count < 2 || port >= rs->nb_ports) return false;
+    unsigned i = rs_window_depth(rs, rs->hz / 1000 * window_ms);
+    return rs_rates_between(rs, rs_slot(rs, 0), rs_slot(rs, i), port, out);
+}
+
+// Per-field maximum of the sample-to-sample rates over the last 'window_ms'.
+static inline bool rate_sampler_peak(const struct rate_sampler *rs, uint16_t port,
+                                     unsigned window_ms, struct rs_rates *out)
+{
+    memset(out, 0, sizeof(*out));
+    if (rs->count < 2 || port >= rs->nb_ports) return false;
+    unsigned n = rs_window_depth(rs, rs->hz / 1000 * window_ms);
+    bool any = false;
+    for (unsigned i = 0; i < n; i++) {
+        struct rs_rates r;
+        if (!rs_rates_between(rs, rs_slot(rs, i), rs_slot(rs, i + 1), port, &r)) continue;
+        if (r.rx_pps > out->rx_pps) out->rx_pps = r.rx_pps;
+        if (r.tx_pps > out->tx_pps) out->tx_pps = r.tx_pps;
+        if (r.rx_bps > out->rx_bps) out->rx_bps = r.rx_bps;
+        if (r.tx_bps > out->tx_bps) out->tx_bps = r.tx_bps;
+        if (r.missed_pps > out->missed_pps) out->missed_pps = r.missed_pps;
+        if (!any || r.dt < out->dt) out->dt = r.dt; // finest resolution seen
+        any = true;
+    }
+    return any;
+}
+
+static inline const struct rs_rates *rate_sampler_ewma(const struct rate_sampler *rs, uint16_t port)
+{
+    return &rs->ewma[port];
+}
+
+#endif // RATE_SAMPLER_H
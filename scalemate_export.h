@@ -0,0 +1,159 @@
+// scalemate_export.h
+// Headless exporter for the ScaleMate tools (--headless).
+// - The sampler publishes its per-port metrics and decision once per tick
+// - The DPDK telemetry socket serves them, e.g. with usertools/dpdk-telemetry.py:
+//     --> /scalemate/ports          all ports
+//     --> /scalemate/port,0         one port
+// - Requests are answered on the telemetry thread. The two sides share only
+//   a memcpy under a spinlock, so neither side blocks the other.
+// Ratios are exported as parts-per-million integers (telemetry has no floats).
+
+#ifndef SCALEMATE_EXPORT_H
+#define SCALEMATE_EXPORT_H
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <rte_common.h>
+#include <rte_ethdev.h>
+#include <rte_spinlock.h>
+#include <rte_telemetry.h>
+#include <rte_version.h>
+
+#if RTE_VERSION >= RTE_VERSION_NUM(23, 3, 0, 0)
+#define sm_tel_add_uint rte_tel_data_add_dict_uint
+#else
+#define sm_tel_add_uint rte_tel_data_add_dict_u64
+#endif
+
+struct sm_port_metrics {
+    uint16_t port;
+    uint8_t valid;          // stats read succeeded this tick
+    double rx_pps, tx_pps;
+    double rx_bps, tx_bps;
+    double rx_pps_ewma;     // 0 when the tool keeps no EWMA
+    double rx_pps_peak;     // highest sub-interval rate, 0 if not sampled
+    double missed_pps_peak;
+    double rx_util;         // rx_bps / link capacity
+    double drop_ratio;
+    double busy;            // RX lcore poll-loop busy ratio, -1 if unknown
+    double buf_fill;        // mempool / descriptor ring pressure
+    double skew;            // per-queue RSS skew, 1.0 if balanced/unknown
+    double score;           // tool-specific composite score (CS), -1 if none
+    char decision[24];
+    char reason[128];
+};
+
+static struct {
+    rte_spinlock_t lock;
+    const char *tool;
+    uint64_t ticks;
+    uint16_t nb_ports;
+    struct sm_port_metrics m[RTE_MAX_ETHPORTS];
+} sm_export = { .lock = RTE_SPINLOCK_INITIALIZER };
+
+static inline uint64_t sm_ppm(double ratio)
+{
+    return ratio <= 0 ? 0 : (uint64_t)(ratio * 1e6 + 0.5);
+}
+
+static inline void sm_export_port_dict(struct rte_tel_data *d, const struct sm_port_metrics *m)
+{
+    rte_tel_data_start_dict(d);
+    sm_tel_add_uint(d, "port", m->port);
+    sm_tel_add_uint(d, "valid", m->valid);
+    sm_tel_add_uint(d, "rx_pps", (uint64_t)m->rx_pps);
+    sm_tel_add_uint(d, "tx_pps", (uint64_t)m->tx_pps);
+    sm_tel_add_uint(d, "rx_bps", (uint64_t)m->rx_bps);
+    sm_tel_add_uint(d, "tx_bps", (uint64_t)m->tx_bps);
+    sm_tel_add_uint(d, "rx_pps_ewma", (uint64_t)m->rx_pps_ewma);
+    sm_tel_add_uint(d, "rx_pps_peak", (uint64_t)m->rx_pps_peak);
+    sm_tel_add_uint(d, "missed_pps_peak", (uint64_t)m->missed_pps_peak);
+    sm_tel_add_uint(d, "rx_util_ppm", sm_ppm(m->rx_util));
+    sm_tel_add_uint(d, "drop_ppm", sm_ppm(m->drop_ratio));
+    rte_tel_data_add_dict_int(d, "busy_ppm", m->busy < 0 ? -1 : (int64_t)sm_ppm(m->busy));
+    sm_tel_add_uint(d, "buf_fill_ppm", sm_ppm(m->buf_fill));
+    sm_tel_add_uint(d, "skew_ppm", sm_ppm(m->skew));
+    rte_tel_data_add_dict_int(d, "score_ppm", m->score < 0 ? -1 : (int64_t)sm_ppm(m->score));
+    rte_tel_data_add_dict_string(d, "decision", m->decision);
+    rte_tel_data_add_dict_string(d, "reason", m->reason);
+}
+
+static int sm_export_tel_ports(const char *cmd __rte_unused, const char *params __rte_unused,
+                               struct rte_tel_data *d)
+{
+    struct sm_port_metrics snap[RTE_MAX_ETHPORTS]; // per call: clients run on their own threads
+    const char *tool;
+    uint16_t n;
+    uint64_t ticks;
+
+    rte_spinlock_lock(&sm_export.lock);
+    tool = sm_export.tool;
+    n = sm_export.nb_ports;
+    ticks = sm_export.ticks;
+    memcpy(snap, sm_export.m, n * sizeof(snap[0]));
+    rte_spinlock_unlock(&sm_export.lock);
+
+    rte_tel_data_start_dict(d);
+    rte_tel_data_add_dict_string(d, "tool", tool);
+    sm_tel_add_uint(d, "ticks", ticks);
+    for (uint16_t i = 0; i < n; i++) {
+        struct rte_tel_data *pd = rte_tel_data_alloc();
+        if (!pd) return -ENOMEM;
+        sm_export_port_dict(pd, &snap[i]);
+        char key[16];
+        snprintf(key, sizeof(key), "port%u", snap[i].port);
+        rte_tel_data_add_dict_container(d, key, pd, 0);
+    }
+    return 0;
+}
+
+static int sm_export_tel_port(const char *cmd __rte_unused, const char *params,
+                              struct rte_tel_data *d)
+{
+    struct sm_port_metrics snap;
+    char *end = NULL;
+
+    if (!params || !*params) return -EINVAL;
+    unsigned long port = strtoul(params, &end, 0);
+    if (*end != '\0' || port >= RTE_MAX_ETHPORTS) return -EINVAL;
+
+    rte_spinlock_lock(&sm_export.lock);
+    int found = port < sm_export.nb_ports;
+    if (found) snap = sm_export.m[port];
+    rte_spinlock_unlock(&sm_export.lock);
+
+    if (!found) return -EINVAL;
+    sm_export_port_dict(d, &snap);
+    return 0;
+}
+
+// Register the telemetry commands; call once after rte_eal_init.
+static inline int sm_export_init(const char *tool)
+{
+    rte_spinlock_lock(&sm_export.lock);
+    sm_export.tool = tool;
+    rte_spinlock_unlock(&sm_export.lock);
+    int ret = rte_telemetry_register_cmd("/scalemate/ports", sm_export_tel_ports,
+                                         "Per-port ScaleMate metrics and decision. No parameters");
+    if (ret == 0)
+        ret = rte_telemetry_register_cmd("/scalemate/port", sm_export_tel_port,
+                                         "ScaleMate metrics of one port. Parameters: int port_id");
+    return ret;
+}
+
+// Publish one tick worth of per-port metrics (m[i] is port i).
+static inline void sm_export_publish(const struct sm_port_metrics *m, uint16_t nb_ports)
+{
+    if (nb_ports > RTE_MAX_ETHPORTS) nb_ports = RTE_MAX_ETHPORTS;
+    rte_spinlock_lock(&sm_export.lock);
+    memcpy(sm_export.m, m, nb_ports * sizeof(m[0]));
+    sm_export.nb_ports = nb_ports;
+    sm_export.ticks++;
+    rte_spinlock_unlock(&sm_export.lock);
+}
+
+#endif // SCALEMATE_EXPORT_H
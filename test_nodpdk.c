@@ -2,15 +2,29 @@
 // Minimal testpmd-like packet pipeline without DPDK.
 // - 8 RX queues -> 8 worker threads -> 8 TX threads
 // - Simulated FPGA NIC sets hardware timestamps (T_hw_rx/T_hw_tx)
-// - Uses SPSC lock-free rings for queue handoff
+// - Uses SPSC lock-free rings for queue handoff, moved in bursts: one index
+//   publish per burst, remote index cached, producer/consumer on own lines
 // - Stores sw timestamps in packet->sw_ts_ns (for latency calc)
+// - Latencies go into per-queue log-linear histograms (lat_hist.h), one
+//   writer each (the TX thread); the stats thread merges them into
+//   p50/p90/p99/p99.9/max, per interval or cumulative
 //
 // Build:
-//   gcc -O3 -march=native test_nodpdk.c -o test_nodpdk -pthread
+//   gcc -O3 -march=native test_nodpdk.c -o test_nodpdk -pthread -lm
 //
 // Run:
 //   ./test_nodpdk
 //
+// Options:
+//   --zero-copy   packets stay in a preallocated pool, rings carry handles
+//   --lat-mode interval|cumulative   latency percentiles per stats interval
+//                                    (default) or since start
+//   Traffic generator (any of these replaces the fixed round-robin NIC):
+//   --pps N                 target rate, TSC token bucket (0 = unthrottled)
+//   --sizes imix|N|S:W,...  packet size mix, e.g. 64:7,576:4,1500:1
+//   --arrival const|poisson|onoff:ON_US:OFF_US
+//   --skew S                Zipf exponent over the queues (RSS imbalance)
+//
 // Ctrl+C to stop and print final stats.
 
 #define _GNU_SOURCE
@@ -25,12 +39,19 @@
 #include <time.h>
 #include <unistd.h>
 #include <inttypes.h>
+#include <math.h>
+#include <sys/mman.h>
 
 #define N_QUEUES 8
 #define RING_SIZE 1024  // must be power of two
 #define RING_MASK (RING_SIZE - 1)
 #define BATCH_SIZE 32
 #define PKT_PAYLOAD 64
+#define CACHE_LINE 64
+
+#define POLL_STATS_MAX_BURST BATCH_SIZE
+#include "poll_stats.h"
+#include "lat_hist.h"
 
 // Offload flags (simulated)
 #define OFFLOAD_TS   (1 << 0)
@@ -56,14 +77,70 @@ typedef struct {
 } pkt_t;
 
 // Single-producer single-consumer ring (lock-free)
-typedef struct {
-    pkt_t buffer[RING_SIZE];
-    atomic_size_t head; // next write index (producer)
-    atomic_size_t tail; // next read index (consumer)
-} spsc_ring_t;
+// Indices run free and are masked on access, so all RING_SIZE slots are usable.
+// Each side keeps a private copy of the other side's index and only reloads
+// it (acquire) when the copy says the ring is full/empty.
+// SPSC_RING_DEFINE(prefix, ring_type, obj_type) declares ring_type and
+// prefix_push_burst/prefix_pop_burst: move up to n objects, return how many
+// were moved; one release store per call.
+#define SPSC_RING_DEFINE(prefix, ring_type, obj_type)                                   \
+typedef struct {                                                                        \
+    /* producer cache line */                                                           \
+    _Alignas(CACHE_LINE) atomic_size_t head; /* next write index */                     \
+    size_t tail_cache;                       /* producer's view of tail */              \
+    /* consumer cache line */                                                           \
+    _Alignas(CACHE_LINE) atomic_size_t tail; /* next read index */                      \
+    size_t head_cache;                       /* consumer's view of head */              \
+    _Alignas(CACHE_LINE) obj_type buffer[RING_SIZE];                                    \
+} ring_type;                                                                            \
+                                                                                        \
+static inline unsigned prefix##_push_burst(ring_type *r, const obj_type *objs, unsigned n) { \
+    size_t head = atomic_load_explicit(&r->head, memory_order_relaxed);                 \
+    size_t room = RING_SIZE - (head - r->tail_cache);                                   \
+    if (room < n) {                                                                     \
+        r->tail_cache = atomic_load_explicit(&r->tail, memory_order_acquire);           \
+        room = RING_SIZE - (head - r->tail_cache);                                      \
+        if (n > room) n = (unsigned)room;                                               \
+    }                                                                                   \
+    for (unsigned i = 0; i < n; i++) r->buffer[(head + i) & RING_MASK] = objs[i];       \
+    if (n) atomic_store_explicit(&r->head, head + n, memory_order_release);             \
+    return n;                                                                           \
+}                                                                                       \
+                                                                                        \
+static inline unsigned prefix##_pop_burst(ring_type *r, obj_type *objs, unsigned n) {   \
+    size_t tail = atomic_load_explicit(&r->tail, memory_order_relaxed);                 \
+    size_t avail = r->head_cache - tail;                                                \
+    if (avail < n) {                                                                    \
+        r->head_cache = atomic_load_explicit(&r->head, memory_order_acquire);           \
+        avail = r->head_cache - tail;                                                   \
+        if (n > avail) n = (unsigned)avail;                                             \
+    }                                                                                   \
+    for (unsigned i = 0; i < n; i++) objs[i] = r->buffer[(tail + i) & RING_MASK];       \
+    if (n) atomic_store_explicit(&r->tail, tail + n, memory_order_release);             \
+    return n;                                                                           \
+}
+
+// Copy mode: rings carry whole packets
+SPSC_RING_DEFINE(ring, spsc_ring_t, pkt_t)
+
+// Single-packet forms. Return true on success.
+static inline bool ring_push(spsc_ring_t *r, const pkt_t *p) {
+    return ring_push_burst(r, p, 1) == 1;
+}
+
+static inline bool ring_pop(spsc_ring_t *r, pkt_t *p) {
+    return ring_pop_burst(r, p, 1) == 1;
+}
+
+// Zero-copy mode (--zero-copy): packets live in pkt_pool, rings carry
+// 8-byte handles (pool indices), like mbuf pointers in the DPDK apps.
+typedef uint64_t pkt_handle_t;
+SPSC_RING_DEFINE(hring, hring_t, pkt_handle_t)
 
 static spsc_ring_t rx_rings[N_QUEUES];
 static spsc_ring_t tx_rings[N_QUEUES];
+static hring_t rx_hrings[N_QUEUES];
+static hring_t tx_hrings[N_QUEUES];
 
 // Stats per queue
 typedef struct {
@@ -71,30 +148,363 @@ typedef struct {
     uint64_t proc_pkts;
     uint64_t tx_pkts;
     uint64_t dropped;
-    uint64_t hw_latency_sum_ns; // sum of (hw_tx - hw_rx)
-    uint64_t sw_latency_sum_ns; // sum of (hw_tx - sw_rx)
 } stats_t;
 
 static stats_t stats[N_QUEUES];
 
-// Ring operations (producer pushes, consumer pops). Return true on success.
-static inline bool ring_push(spsc_ring_t *r, const pkt_t *p) {
-    size_t head = atomic_load_explicit(&r->head, memory_order_relaxed);
-    size_t next = (head + 1) & RING_MASK;
-    size_t tail = atomic_load_explicit(&r->tail, memory_order_acquire);
-    if (next == tail) return false; // full
-    r->buffer[head & RING_MASK] = *p;
-    atomic_store_explicit(&r->head, next, memory_order_release);
-    return true;
+// Latency histograms per TX queue, written only by that queue's TX thread
+static struct lat_hist hw_lat[N_QUEUES]; // hw_tx - hw_rx
+static struct lat_hist sw_lat[N_QUEUES]; // hw_tx - sw_rx
+static bool lat_cumulative = false;
+
+// Worker poll instrumentation (batch-size histogram, busy/idle cycles)
+static struct poll_stats worker_poll_stats[N_QUEUES];
+
+// ---------------- Packet pool (zero-copy mode) ----------------
+// Preallocated packets, hugepage-backed when the system allows it.
+// Each thread keeps a private cache of free handles and only touches the
+// shared free stack (spinlock) in POOL_CACHE_BULK chunks, like the per-lcore
+// cache of an rte_mempool.
+// Sized for full rx+tx rings, full caches and in-flight batches.
+#define POOL_CACHE_SIZE 256
+#define POOL_CACHE_BULK (POOL_CACHE_SIZE / 2)
+#define POOL_SIZE (2 * N_QUEUES * RING_SIZE + (2 * N_QUEUES + 1) * POOL_CACHE_SIZE + 2 * N_QUEUES * BATCH_SIZE)
+#define HUGEPAGE_SZ (2UL << 20)
+
+static pkt_t *pkt_pool;
+static size_t pkt_pool_bytes;
+static bool pkt_pool_huge;
+
+static struct {
+    pthread_spinlock_t lock;
+    uint32_t top;
+    pkt_handle_t stack[POOL_SIZE];
+} pool_free;
+
+typedef struct {
+    uint32_t len;
+    pkt_handle_t h[POOL_CACHE_SIZE];
+    uint64_t empty;          // allocations that found the pool exhausted
+} pool_cache_t;
+
+static inline pkt_t *pkt_of(pkt_handle_t h) { return &pkt_pool[h]; }
+
+static int pool_init(void) {
+    pkt_pool_bytes = ((POOL_SIZE * sizeof(pkt_t)) + HUGEPAGE_SZ - 1) & ~(HUGEPAGE_SZ - 1);
+    pkt_pool = mmap(NULL, pkt_pool_bytes, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    pkt_pool_huge = pkt_pool != MAP_FAILED;
+    if (!pkt_pool_huge) {
+        // no reserved hugepages: fall back to THP
+        pkt_pool = mmap(NULL, pkt_pool_bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (pkt_pool == MAP_FAILED) return -1;
+        madvise(pkt_pool, pkt_pool_bytes, MADV_HUGEPAGE);
+    }
+    memset(pkt_pool, 0, pkt_pool_bytes); // fault the pages in now, not on the fast path
+    pthread_spin_init(&pool_free.lock, PTHREAD_PROCESS_PRIVATE);
+    for (uint32_t i = 0; i < POOL_SIZE; i++) pool_free.stack[i] = POOL_SIZE - 1 - i;
+    pool_free.top = POOL_SIZE;
+    return 0;
 }
 
-static inline bool ring_pop(spsc_ring_t *r, pkt_t *p) {
-    size_t tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
-    size_t head = atomic_load_explicit(&r->head, memory_order_acquire);
-    if (tail == head) return false; // empty
-    *p = r->buffer[tail & RING_MASK];
-    atomic_store_explicit(&r->tail, (tail + 1) & RING_MASK, memory_order_release);
-    return true;
+// Get n handles; returns how many were available.
+static inline unsigned pool_get_burst(pool_cache_t *c, pkt_handle_t *h, unsigned n) {
+    if (c->len < n) {
+        pthread_spin_lock(&pool_free.lock);
+        unsigned take = POOL_CACHE_SIZE - c->len;
+        if (take > POOL_CACHE_BULK + n) take = POOL_CACHE_BULK + n;
+        if (take > pool_free.top) take = pool_free.top;
+        pool_free.top -= take;
+        memcpy(&c->h[c->len], &pool_free.stack[pool_free.top], take * sizeof(pkt_handle_t));
+        pthread_spin_unlock(&pool_free.lock);
+        c->len += take;
+        if (c->len < n) { c->empty++; n = c->len; }
+    }
+    c->len -= n;
+    memcpy(h, &c->h[c->len], n * sizeof(pkt_handle_t));
+    return n;
+}
+
+static inline void pool_put_burst(pool_cache_t *c, const pkt_handle_t *h, unsigned n) {
+    if (c->len + n > POOL_CACHE_SIZE) {
+        // spill down to half a cache (keeps recently freed, cache-warm handles)
+        unsigned spill = c->len + n - POOL_CACHE_BULK;
+        if (spill > c->len) spill = c->len;
+        pthread_spin_lock(&pool_free.lock);
+        memcpy(&pool_free.stack[pool_free.top], &c->h[c->len - spill], spill * sizeof(pkt_handle_t));
+        pool_free.top += spill;
+        pthread_spin_unlock(&pool_free.lock);
+        c->len -= spill;
+    }
+    memcpy(&c->h[c->len], h, n * sizeof(pkt_handle_t));
+    c->len += n;
+}
+
+static void pool_cache_flush(pool_cache_t *c) {
+    pthread_spin_lock(&pool_free.lock);
+    memcpy(&pool_free.stack[pool_free.top], c->h, c->len * sizeof(pkt_handle_t));
+    pool_free.top += c->len;
+    pthread_spin_unlock(&pool_free.lock);
+    c->len = 0;
+}
+
+static uint64_t pool_empty_total; // pool_cache_t.empty of exited threads
+
+// ---------------- Per-packet work shared by both modes ----------------
+// NIC ingress: fill the packet and stamp hw_rx. len is the wire length; only
+// the first PKT_PAYLOAD bytes are simulated.
+static inline void pkt_fill(pkt_t *p, uint64_t pkt_idx, uint16_t len, uint64_t hw_ts) {
+    p->len = len;
+    // fill payload with some pattern
+    for (int i = 0; i < PKT_PAYLOAD; i++) p->payload[i] = (uint8_t)(pkt_idx + i);
+    // simulate offloads available on NIC - pretend all offloads supported
+    p->offloads = OFFLOAD_CSUM | OFFLOAD_TS | OFFLOAD_VLAN;
+    p->hw_rx_ts_ns = hw_ts; // hw timestamp at ingress
+    p->sw_rx_ts_ns = 0;
+    p->hw_tx_ts_ns = 0;
+}
+
+// Worker: minimal in-path processing.
+static inline void pkt_process(pkt_t *p, uint64_t sw_ts) {
+    p->sw_rx_ts_ns = sw_ts; // mark software dequeue timestamp
+
+    // - swap first 6 bytes and next 6 bytes to mimic MAC swap (cheap)
+    if (p->len >= 12) {
+        for (int k = 0; k < 6; k++) {
+            uint8_t tmp = p->payload[k];
+            p->payload[k] = p->payload[6 + k];
+            p->payload[6 + k] = tmp;
+        }
+    }
+
+    // Simulate checksum offload handling: we would check ol_flags; here we just pretend it's done
+    // (no action needed in app hot path)
+}
+
+// TX: simulated DMA, NIC sets hw_tx timestamp, latency accounting.
+static inline void pkt_transmit(int q, pkt_t *p) {
+    // simulate DMA latency jitter (small)
+    // nanosleep with 100-500 ns would be ideal, but nanosleep granularity is ms — so simulate by busy loop
+    // very small busy loop to simulate processing latency
+    uint64_t start = now_ns();
+    while (now_ns() - start < 200) { /* spin ~200 ns */ __asm__ __volatile__(""); }
+
+    // NIC assigns hw_tx timestamp on egress
+    p->hw_tx_ts_ns = now_ns();
+
+    // compute latencies
+    if (p->hw_rx_ts_ns) {
+        uint64_t dev_lat = (p->hw_tx_ts_ns > p->hw_rx_ts_ns) ? (p->hw_tx_ts_ns - p->hw_rx_ts_ns) : 0;
+        lat_hist_record(&hw_lat[q], dev_lat);
+    }
+    if (p->sw_rx_ts_ns) {
+        uint64_t e2e = (p->hw_tx_ts_ns > p->sw_rx_ts_ns) ? (p->hw_tx_ts_ns - p->sw_rx_ts_ns) : 0;
+        lat_hist_record(&sw_lat[q], e2e);
+    }
+
+    stats[q].tx_pkts++;
+    // "send" complete: in a real system packet goes out on wire.
+}
+
+// ---------------- Traffic generator ----------------
+// Replaces the fixed NIC when any generator option is given. Each loop:
+// 1. the arrival model says how many packets are due at this TSC value
+// 2. all of them get one hw_rx timestamp (batched timestamping)
+// 3. each picks a size from the size mix and a queue from the queue weights
+// 4. one burst push per queue
+#define GEN_MAX_SIZES    8
+#define GEN_BURST        64    // max packets per loop
+#define GEN_BUCKET_DEPTH 256   // token bucket depth, max catch-up burst
+
+typedef enum { ARRIVAL_CONST = 0, ARRIVAL_POISSON, ARRIVAL_ONOFF } arrival_t;
+
+static bool zero_copy = false;
+
+static struct {
+    bool enabled;
+    double pps;                          // 0 = as fast as possible
+    arrival_t arrival;
+    double on_us, off_us;                // on/off model periods
+    unsigned nb_sizes;
+    uint16_t size[GEN_MAX_SIZES];
+    uint32_t size_cum[GEN_MAX_SIZES];    // cumulative weights
+    double skew;                         // Zipf exponent over queues, 0 = uniform
+    uint32_t q_cum[N_QUEUES];            // cumulative queue weights, total 1 << 16
+    uint64_t hz;                         // poll_stats_cycles() per second
+} gen = { .nb_sizes = 1, .size = { PKT_PAYLOAD }, .size_cum = { 1 } };
+
+static uint64_t gen_pkts, gen_bytes;     // written by the generator only
+
+typedef struct {
+    uint64_t rng;
+    uint64_t last;                       // TSC of the previous refill
+    uint64_t t0;                         // start of the on/off schedule
+    double tokens;
+    double next_arrival;                 // poisson: TSC of the next packet
+} gen_state_t;
+
+static inline uint64_t gen_rand(gen_state_t *g) {
+    // xorshift64*
+    g->rng ^= g->rng >> 12; g->rng ^= g->rng << 25; g->rng ^= g->rng >> 27;
+    return g->rng * 0x2545F4914F6CDD1DULL;
+}
+
+static inline void cpu_relax(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#endif
+}
+
+static uint64_t calibrate_hz(void) {
+    struct timespec d = { 0, 50 * 1000 * 1000 };
+    uint64_t n0 = now_ns(), c0 = poll_stats_cycles();
+    nanosleep(&d, NULL);
+    uint64_t n1 = now_ns(), c1 = poll_stats_cycles();
+    return (uint64_t)((double)(c1 - c0) * 1e9 / (double)(n1 - n0));
+}
+
+// Packets due at TSC 'now' under the configured arrival model.
+static inline unsigned gen_due(gen_state_t *g, uint64_t now) {
+    if (gen.pps <= 0) return GEN_BURST;
+    double cyc_per_pkt = (double)gen.hz / gen.pps;
+
+    if (gen.arrival == ARRIVAL_POISSON) {
+        // exponential inter-arrival gaps, mean 1/pps
+        unsigned n = 0;
+        while (n < GEN_BURST && g->next_arrival <= (double)now) {
+            double u = (double)(gen_rand(g) >> 11) * 0x1.0p-53;  // [0,1)
+            g->next_arrival += -log(1.0 - u) * cyc_per_pkt;
+            n++;
+        }
+        if ((double)now - g->next_arrival > GEN_BUCKET_DEPTH * cyc_per_pkt) g->next_arrival = (double)now;
+        return n;
+    }
+
+    double rate = 1.0 / cyc_per_pkt;  // packets per cycle
+    if (gen.arrival == ARRIVAL_ONOFF) {
+        // same mean rate, all of it sent during the on phase
+        uint64_t on = (uint64_t)(gen.on_us * 1e-6 * gen.hz), off = (uint64_t)(gen.off_us * 1e-6 * gen.hz);
+        if ((now - g->t0) % (on + off) >= on) { g->last = now; return 0; }
+        rate *= (double)(on + off) / (double)on;
+    }
+    g->tokens += (double)(now - g->last) * rate;
+    g->last = now;
+    if (g->tokens > GEN_BUCKET_DEPTH) g->tokens = GEN_BUCKET_DEPTH;
+    unsigned n = g->tokens >= GEN_BURST ? GEN_BURST : (unsigned)g->tokens;
+    g->tokens -= n;
+    return n;
+}
+
+static inline uint16_t gen_pick_size(gen_state_t *g) {
+    uint32_t r = (uint32_t)(gen_rand(g) % gen.size_cum[gen.nb_sizes - 1]);
+    unsigned i = 0;
+    while (r >= gen.size_cum[i]) i++;
+    return gen.size[i];
+}
+
+static inline int gen_pick_queue(gen_state_t *g) {
+    uint32_t r = (uint32_t)(gen_rand(g) >> 48);
+    int q = 0;
+    while (q < N_QUEUES - 1 && r >= gen.q_cum[q]) q++;
+    return q;
+}
+
+void *nic_thread_gen(void *arg) {
+    (void)arg;
+    static pkt_t staged[N_QUEUES][GEN_BURST];
+    pkt_handle_t hstaged[N_QUEUES][GEN_BURST];
+    unsigned cnt[N_QUEUES];
+    pool_cache_t cache = {0};
+    gen_state_t g = { .rng = 0x9E3779B97F4A7C15ULL };
+    g.last = g.t0 = poll_stats_cycles();
+    g.next_arrival = (double)g.t0;
+    uint64_t pkt_idx = 0;
+
+    while (running) {
+        unsigned n = gen_due(&g, poll_stats_cycles());
+        if (n == 0) { cpu_relax(); continue; }
+
+        uint64_t hw_ts = now_ns(); // one timestamp for the whole burst
+        uint64_t bytes = 0;
+        memset(cnt, 0, sizeof(cnt));
+        for (unsigned i = 0; i < n; i++) {
+            int q = gen_pick_queue(&g);
+            uint16_t len = gen_pick_size(&g);
+            pkt_t *p;
+            if (zero_copy) {
+                if (pool_get_burst(&cache, &hstaged[q][cnt[q]], 1) == 0) { stats[q].dropped++; continue; }
+                p = pkt_of(hstaged[q][cnt[q]]);
+            } else {
+                p = &staged[q][cnt[q]];
+            }
+            pkt_fill(p, pkt_idx++, len, hw_ts);
+            cnt[q]++;
+            bytes += len;
+        }
+
+        for (int q = 0; q < N_QUEUES; q++) {
+            if (cnt[q] == 0) continue;
+            unsigned pushed;
+            if (zero_copy) {
+                pushed = hring_push_burst(&rx_hrings[q], hstaged[q], cnt[q]);
+                if (pushed < cnt[q]) pool_put_burst(&cache, &hstaged[q][pushed], cnt[q] - pushed);
+            } else {
+                pushed = ring_push_burst(&rx_rings[q], staged[q], cnt[q]);
+            }
+            stats[q].rx_pkts += pushed;
+            stats[q].dropped += cnt[q] - pushed;
+        }
+        __atomic_store_n(&gen_pkts, gen_pkts + n, __ATOMIC_RELAXED);
+        __atomic_store_n(&gen_bytes, gen_bytes + bytes, __ATOMIC_RELAXED);
+    }
+    if (zero_copy) {
+        pool_cache_flush(&cache);
+        __atomic_fetch_add(&pool_empty_total, cache.empty, __ATOMIC_RELAXED);
+    }
+    return NULL;
+}
+
+// "imix", "N" or "S:W,S:W,..."
+static int gen_parse_sizes(const char *arg) {
+    if (strcmp(arg, "imix") == 0) arg = "64:7,576:4,1500:1";
+    char buf[256];
+    snprintf(buf, sizeof(buf), "%s", arg);
+    unsigned n = 0;
+    uint32_t cum = 0;
+    for (char *tok = strtok(buf, ","); tok; tok = strtok(NULL, ",")) {
+        if (n == GEN_MAX_SIZES) return -1;
+        char *colon = strchr(tok, ':');
+        long sz = strtol(tok, NULL, 10);
+        long w = colon ? strtol(colon + 1, NULL, 10) : 1;
+        if (sz < 12 || sz > 9216 || w <= 0) return -1;
+        gen.size[n] = (uint16_t)sz;
+        cum += (uint32_t)w;
+        gen.size_cum[n] = cum;
+        n++;
+    }
+    if (n == 0) return -1;
+    gen.nb_sizes = n;
+    return 0;
+}
+
+static int gen_parse_arrival(const char *arg) {
+    if (strcmp(arg, "const") == 0) gen.arrival = ARRIVAL_CONST;
+    else if (strcmp(arg, "poisson") == 0) gen.arrival = ARRIVAL_POISSON;
+    else if (sscanf(arg, "onoff:%lf:%lf", &gen.on_us, &gen.off_us) == 2 && gen.on_us > 0 && gen.off_us >= 0)
+        gen.arrival = ARRIVAL_ONOFF;
+    else return -1;
+    return 0;
+}
+
+// Zipf weights 1/(q+1)^skew over the queues, scaled to 1 << 16.
+static void gen_init_queue_weights(void) {
+    double w[N_QUEUES], sum = 0.0, acc = 0.0;
+    for (int q = 0; q < N_QUEUES; q++) { w[q] = 1.0 / pow(q + 1, gen.skew); sum += w[q]; }
+    for (int q = 0; q < N_QUEUES; q++) {
+        acc += w[q];
+        gen.q_cum[q] = (uint32_t)(acc / sum * 65536.0);
+    }
+    gen.q_cum[N_QUEUES - 1] = 65536;
 }
 
 // Simulated NIC/FPGA: generates packets into rx_rings for each queue (round-robin)
@@ -102,28 +512,16 @@ static inline bool ring_pop(spsc_ring_t *r, pkt_t *p) {
 void *nic_thread(void *arg) {
     (void)arg;
     uint64_t pkt_idx = 0;
+    pkt_t burst[4];
     while (running) {
         for (int q = 0; q < N_QUEUES && running; q++) {
             // produce a small burst for queue q
-            for (int b = 0; b < 4; b++) {
-                pkt_t p;
-                p.len = PKT_PAYLOAD;
-                // fill payload with some pattern
-                for (int i = 0; i < PKT_PAYLOAD; i++) p.payload[i] = (uint8_t)(pkt_idx + i);
-                // simulate offloads available on NIC - pretend all offloads supported
-                p.offloads = OFFLOAD_CSUM | OFFLOAD_TS | OFFLOAD_VLAN;
-                p.hw_rx_ts_ns = now_ns(); // hw timestamp at ingress
-                p.sw_rx_ts_ns = 0;
-                p.hw_tx_ts_ns = 0;
-
-                // try to push; if full, count drop and continue
-                if (!ring_push(&rx_rings[q], &p)) {
-                    stats[q].dropped++;
-                } else {
-                    stats[q].rx_pkts++;
-                }
-                pkt_idx++;
-            }
+            for (int b = 0; b < 4; b++) pkt_fill(&burst[b], pkt_idx++, PKT_PAYLOAD, now_ns());
+
+            // push the burst; whatever does not fit is dropped
+            unsigned pushed = ring_push_burst(&rx_rings[q], burst, 4);
+            stats[q].rx_pkts += pushed;
+            stats[q].dropped += 4 - pushed;
             // simulate NIC rate - small sleep to avoid runaway CPU
             // In real system this is hardware-driven; here we use a tight pause to simulate high-rate
             // usleep(0) yields - but keep very small sleep occasionally
@@ -133,21 +531,43 @@ void *nic_thread(void *arg) {
     return NULL;
 }
 
+// Zero-copy NIC: fills pool packets in place and enqueues their handles.
+void *nic_thread_zc(void *arg) {
+    (void)arg;
+    pool_cache_t cache = {0};
+    uint64_t pkt_idx = 0, slots = 0;
+    pkt_handle_t burst[4];
+    while (running) {
+        for (int q = 0; q < N_QUEUES && running; q++) {
+            unsigned n = pool_get_burst(&cache, burst, 4);
+            for (unsigned b = 0; b < n; b++) pkt_fill(pkt_of(burst[b]), pkt_idx++, PKT_PAYLOAD, now_ns());
+
+            unsigned pushed = hring_push_burst(&rx_hrings[q], burst, n);
+            if (pushed < n) pool_put_burst(&cache, &burst[pushed], n - pushed);
+            stats[q].rx_pkts += pushed;
+            stats[q].dropped += 4 - pushed; // ring full or pool exhausted
+            slots += 4;
+            if ((slots & 0x3FFF) == 0) usleep(100);
+        }
+    }
+    pool_cache_flush(&cache);
+    __atomic_fetch_add(&pool_empty_total, cache.empty, __ATOMIC_RELAXED);
+    return NULL;
+}
+
 // Worker per RX queue: pulls from rx_rings[q], does minimal processing, pushes to tx_rings[q]
 void *worker_thread(void *arg) {
     int q = (int)(uintptr_t)arg;
     pkt_t batch[BATCH_SIZE];
+    struct poll_stats *ps = &worker_poll_stats[q];
+    uint64_t t = poll_stats_cycles();
     while (running) {
-        int got = 0;
         // batch pop
-        for (int i = 0; i < BATCH_SIZE; i++) {
-            pkt_t p;
-            if (!ring_pop(&rx_rings[q], &p)) break;
-            batch[got++] = p;
-        }
+        int got = (int)ring_pop_burst(&rx_rings[q], batch, BATCH_SIZE);
         if (got == 0) {
             // polite pause
             sched_yield();
+            t = poll_stats_record(ps, 0, t);
             continue;
         }
 
@@ -155,85 +575,151 @@ void *worker_thread(void *arg) {
         for (int i = 0; i < got && i < 4; i++) __builtin_prefetch(batch[i].payload);
 
         uint64_t sw_ts = now_ns();
-        for (int i = 0; i < got; i++) {
-            pkt_t *p = &batch[i];
-            p->sw_rx_ts_ns = sw_ts; // mark software dequeue timestamp
-
-            // Minimal in-path processing:
-            // - swap first 6 bytes and next 6 bytes to mimic MAC swap (cheap)
-            if (p->len >= 12) {
-                for (int k = 0; k < 6; k++) {
-                    uint8_t tmp = p->payload[k];
-                    p->payload[k] = p->payload[6 + k];
-                    p->payload[6 + k] = tmp;
-                }
-            }
+        for (int i = 0; i < got; i++) pkt_process(&batch[i], sw_ts);
+        stats[q].proc_pkts += (unsigned)got;
 
-            // Simulate checksum offload handling: we would check ol_flags; here we just pretend it's done
-            // (no action needed in app hot path)
+        // push the batch to the tx ring, drop what does not fit (simulate system drop)
+        unsigned sent = ring_push_burst(&tx_rings[q], batch, (unsigned)got);
+        stats[q].dropped += (unsigned)got - sent;
+        t = poll_stats_record(ps, (unsigned)got, t);
+    }
+    return NULL;
+}
 
-            stats[q].proc_pkts++;
+// Zero-copy worker: processes packets in the pool, forwards handles.
+void *worker_thread_zc(void *arg) {
+    int q = (int)(uintptr_t)arg;
+    pool_cache_t cache = {0};
+    pkt_handle_t batch[BATCH_SIZE];
+    struct poll_stats *ps = &worker_poll_stats[q];
+    uint64_t t = poll_stats_cycles();
+    while (running) {
+        int got = (int)hring_pop_burst(&rx_hrings[q], batch, BATCH_SIZE);
+        if (got == 0) {
+            sched_yield();
+            t = poll_stats_record(ps, 0, t);
+            continue;
+        }
 
-            // push to tx ring, if full drop (simulate system drop)
-            if (!ring_push(&tx_rings[q], p)) {
-                stats[q].dropped++;
-            }
+        for (int i = 0; i < got && i < 4; i++) __builtin_prefetch(pkt_of(batch[i])->payload);
+
+        uint64_t sw_ts = now_ns();
+        for (int i = 0; i < got; i++) {
+            if (i + 4 < got) __builtin_prefetch(pkt_of(batch[i + 4])->payload);
+            pkt_process(pkt_of(batch[i]), sw_ts);
         }
+        stats[q].proc_pkts += (unsigned)got;
+
+        unsigned sent = hring_push_burst(&tx_hrings[q], batch, (unsigned)got);
+        if (sent < (unsigned)got) {
+            pool_put_burst(&cache, &batch[sent], (unsigned)got - sent);
+            stats[q].dropped += (unsigned)got - sent;
+        }
+        t = poll_stats_record(ps, (unsigned)got, t);
     }
+    pool_cache_flush(&cache);
     return NULL;
 }
 
 // TX thread per queue: consumes tx_rings[q], simulates DMA to NIC, NIC sets hw_tx timestamp and "sends"
 void *tx_thread(void *arg) {
     int q = (int)(uintptr_t)arg;
-    pkt_t p;
+    pkt_t burst[BATCH_SIZE];
     while (running) {
-        if (!ring_pop(&tx_rings[q], &p)) {
+        unsigned n = ring_pop_burst(&tx_rings[q], burst, BATCH_SIZE);
+        if (n == 0) {
             sched_yield();
             continue;
         }
-        // simulate DMA latency jitter (small)
-        // nanosleep with 100-500 ns would be ideal, but nanosleep granularity is ms — so simulate by busy loop
-        // very small busy loop to simulate processing latency
-        uint64_t start = now_ns();
-        while (now_ns() - start < 200) { /* spin ~200 ns */ __asm__ __volatile__(""); }
-
-        // NIC assigns hw_tx timestamp on egress
-        p.hw_tx_ts_ns = now_ns();
-
-        // compute latencies
-        if (p.hw_rx_ts_ns) {
-            uint64_t dev_lat = (p.hw_tx_ts_ns > p.hw_rx_ts_ns) ? (p.hw_tx_ts_ns - p.hw_rx_ts_ns) : 0;
-            stats[q].hw_latency_sum_ns += dev_lat;
-        }
-        if (p.sw_rx_ts_ns) {
-            uint64_t e2e = (p.hw_tx_ts_ns > p.sw_rx_ts_ns) ? (p.hw_tx_ts_ns - p.sw_rx_ts_ns) : 0;
-            stats[q].sw_latency_sum_ns += e2e;
-        }
+        for (unsigned i = 0; i < n; i++) pkt_transmit(q, &burst[i]);
+        // Here we drop/free the packets.
+    }
+    return NULL;
+}
 
-        stats[q].tx_pkts++;
-        // "send" complete: in a real system packet goes out on wire. Here we drop/free it.
+// Zero-copy TX: transmits from the pool and returns the handles to it.
+void *tx_thread_zc(void *arg) {
+    int q = (int)(uintptr_t)arg;
+    pool_cache_t cache = {0};
+    pkt_handle_t burst[BATCH_SIZE];
+    while (running) {
+        unsigned n = hring_pop_burst(&tx_hrings[q], burst, BATCH_SIZE);
+        if (n == 0) {
+            sched_yield();
+            continue;
+        }
+        for (unsigned i = 0; i < n; i++) pkt_transmit(q, pkt_of(burst[i]));
+        pool_put_burst(&cache, burst, n);
     }
+    pool_cache_flush(&cache);
     return NULL;
 }
 
+static void print_lat_line(const char *name, const struct lat_hist *h) {
+    printf("%s: n=%-9" PRIu64 " avg=%6" PRIu64 " p50=%6" PRIu64 " p90=%6" PRIu64
+           " p99=%6" PRIu64 " p99.9=%7" PRIu64 " max=%8" PRIu64 " ns\n",
+           name, h->count, lat_hist_mean(h),
+           lat_hist_percentile(h, 50.0), lat_hist_percentile(h, 90.0),
+           lat_hist_percentile(h, 99.0), lat_hist_percentile(h, 99.9), h->max);
+}
+
+// Snapshot every queue and merge; in interval mode only what was recorded
+// since the previous call (prev holds the last snapshots).
+static void lat_collect(const struct lat_hist *src, struct lat_hist *prev,
+                        struct lat_hist *per_q, struct lat_hist *all) {
+    static struct lat_hist cur;
+    lat_hist_init(all);
+    for (int q = 0; q < N_QUEUES; q++) {
+        lat_hist_snapshot(&src[q], &cur);
+        if (lat_cumulative) per_q[q] = cur;
+        else lat_hist_sub(&per_q[q], &cur, &prev[q]);
+        prev[q] = cur;
+        lat_hist_merge(all, &per_q[q]);
+    }
+}
+
 void print_stats_periodic(void) {
+    static struct poll_stats prev_poll[N_QUEUES];
+    static struct lat_hist prev_hw[N_QUEUES], prev_sw[N_QUEUES];
+    static struct lat_hist q_hw[N_QUEUES], q_sw[N_QUEUES], all_hw, all_sw;
     uint64_t last_print = now_ns();
     while (running) {
         sleep(1);
         uint64_t now = now_ns();
         if (now - last_print >= 1000000000ULL) {
             printf("=== Stats (per-queue) ===\n");
+            lat_collect(hw_lat, prev_hw, q_hw, &all_hw);
+            lat_collect(sw_lat, prev_sw, q_sw, &all_sw);
             for (int q = 0; q < N_QUEUES; q++) {
                 uint64_t rx = stats[q].rx_pkts;
                 uint64_t proc = stats[q].proc_pkts;
                 uint64_t tx = stats[q].tx_pkts;
                 uint64_t drop = stats[q].dropped;
-                uint64_t hw_lat_avg = (tx ? stats[q].hw_latency_sum_ns / tx : 0);
-                uint64_t sw_lat_avg = (tx ? stats[q].sw_latency_sum_ns / tx : 0);
+                struct poll_stats cur;
+                poll_stats_snapshot(&worker_poll_stats[q], &cur);
                 printf("Q%02d: rx=%8" PRIu64 " proc=%8" PRIu64 " tx=%8" PRIu64 " drop=%6" PRIu64
-                       " hw_lat_avg=%6" PRIu64 "ns sw_lat_avg=%6" PRIu64 "ns\n",
-                       q, rx, proc, tx, drop, hw_lat_avg, sw_lat_avg);
+                       " hw_p99=%6" PRIu64 "ns sw_p99=%6" PRIu64 "ns"
+                       " busy=%5.1f%% empty=%5.1f%% full=%5.1f%% cyc/batch=%6.0f\n",
+                       q, rx, proc, tx, drop,
+                       lat_hist_percentile(&q_hw[q], 99.0), lat_hist_percentile(&q_sw[q], 99.0),
+                       100.0 * poll_stats_busy_ratio(&cur, &prev_poll[q]),
+                       100.0 * poll_stats_empty_ratio(&cur, &prev_poll[q]),
+                       100.0 * poll_stats_full_ratio(&cur, &prev_poll[q], BATCH_SIZE),
+                       poll_stats_cycles_per_burst(&cur, &prev_poll[q]));
+                prev_poll[q] = cur;
+            }
+            printf("Latency (%s):\n", lat_cumulative ? "cumulative" : "interval");
+            print_lat_line("  hw", &all_hw);
+            print_lat_line("  sw", &all_sw);
+            if (gen.enabled) {
+                static uint64_t prev_pkts, prev_bytes;
+                uint64_t pk = __atomic_load_n(&gen_pkts, __ATOMIC_RELAXED);
+                uint64_t by = __atomic_load_n(&gen_bytes, __ATOMIC_RELAXED);
+                double dt = (now - last_print) * 1e-9;
+                printf("Generator: offered %.0f pps %.1f Mbps avg %.0f B\n",
+                       (pk - prev_pkts) / dt, (by - prev_bytes) * 8e-6 / dt,
+                       pk > prev_pkts ? (double)(by - prev_bytes) / (pk - prev_pkts) : 0.0);
+                prev_pkts = pk; prev_bytes = by;
             }
             printf("=========================\n");
             last_print = now;
@@ -248,8 +734,52 @@ void handle_sigint(int sig) {
 }
 
 int main(int argc, char **argv) {
-    (void)argc; (void)argv;
-    printf("Starting test_nodpdk simulation (8 queues). Ctrl+C to stop.\n");
+    for (int i = 1; i < argc; i++) {
+        const char *opt = argv[i], *val = (i + 1 < argc) ? argv[i + 1] : NULL;
+        if (strcmp(opt, "--zero-copy") == 0) { zero_copy = true; continue; }
+        if (!val) { fprintf(stderr, "unknown option or missing value: %s\n", opt); return 1; }
+        i++;
+        if (strcmp(opt, "--lat-mode") == 0) {
+            if (strcmp(val, "interval") == 0) lat_cumulative = false;
+            else if (strcmp(val, "cumulative") == 0) lat_cumulative = true;
+            else { fprintf(stderr, "bad value for %s: %s\n", opt, val); return 1; }
+            continue;
+        }
+        int bad = 0;
+        if (strcmp(opt, "--pps") == 0)          bad = (gen.pps = atof(val)) < 0;
+        else if (strcmp(opt, "--sizes") == 0)   bad = gen_parse_sizes(val) != 0;
+        else if (strcmp(opt, "--arrival") == 0) bad = gen_parse_arrival(val) != 0;
+        else if (strcmp(opt, "--skew") == 0)    bad = (gen.skew = atof(val)) < 0;
+        else { fprintf(stderr, "unknown option: %s\n", opt); return 1; }
+        if (bad) { fprintf(stderr, "bad value for %s: %s\n", opt, val); return 1; }
+        gen.enabled = true;
+    }
+    if (gen.enabled) {
+        gen.hz = calibrate_hz();
+        gen_init_queue_weights();
+        if (gen.arrival != ARRIVAL_CONST && gen.pps <= 0) {
+            fprintf(stderr, "--arrival needs --pps\n");
+            return 1;
+        }
+        printf("Generator: pps=%.0f%s sizes=%u arrival=%s skew=%.2f (q0 gets %.1f%%)\n",
+               gen.pps, gen.pps > 0 ? "" : " (unthrottled)", gen.nb_sizes,
+               gen.arrival == ARRIVAL_POISSON ? "poisson" : gen.arrival == ARRIVAL_ONOFF ? "onoff" : "const",
+               gen.skew, gen.q_cum[0] * 100.0 / 65536.0);
+    }
+    printf("Starting test_nodpdk simulation (8 queues, %s). Ctrl+C to stop.\n",
+           zero_copy ? "zero-copy" : "copy");
+
+    if (zero_copy) {
+        if (pool_init() != 0) {
+            perror("mmap(pkt_pool)");
+            return 1;
+        }
+        printf("Packet pool: %d pkts, %zu KB, %s\n", POOL_SIZE, pkt_pool_bytes >> 10,
+               pkt_pool_huge ? "hugepages" : "THP advised");
+    }
+    void *(*nic_fn)(void *)    = gen.enabled ? nic_thread_gen : zero_copy ? nic_thread_zc : nic_thread;
+    void *(*worker_fn)(void *) = zero_copy ? worker_thread_zc : worker_thread;
+    void *(*tx_fn)(void *)     = zero_copy ? tx_thread_zc : tx_thread;
 
     // init rings
     for (int i = 0; i < N_QUEUES; i++) {
@@ -257,7 +787,14 @@ int main(int argc, char **argv) {
         atomic_init(&rx_rings[i].tail, 0);
         atomic_init(&tx_rings[i].head, 0);
         atomic_init(&tx_rings[i].tail, 0);
+        atomic_init(&rx_hrings[i].head, 0);
+        atomic_init(&rx_hrings[i].tail, 0);
+        atomic_init(&tx_hrings[i].head, 0);
+        atomic_init(&tx_hrings[i].tail, 0);
         memset(&stats[i], 0, sizeof(stats[i]));
+        lat_hist_init(&hw_lat[i]);
+        lat_hist_init(&sw_lat[i]);
+        poll_stats_init(&worker_poll_stats[i]);
     }
 
     signal(SIGINT, handle_sigint);
@@ -265,7 +802,7 @@ int main(int argc, char **argv) {
 
     // create NIC thread
     pthread_t nic;
-    if (pthread_create(&nic, NULL, nic_thread, NULL) != 0) {
+    if (pthread_create(&nic, NULL, nic_fn, NULL) != 0) {
         perror("pthread_create(nic)");
         return 1;
     }
@@ -273,7 +810,7 @@ int main(int argc, char **argv) {
     // create worker threads (one per RX queue)
     pthread_t workers[N_QUEUES];
     for (int q = 0; q < N_QUEUES; q++) {
-        if (pthread_create(&workers[q], NULL, worker_thread, (void *)(uintptr_t)q) != 0) {
+        if (pthread_create(&workers[q], NULL, worker_fn, (void *)(uintptr_t)q) != 0) {
             perror("pthread_create(worker)");
             return 1;
         }
@@ -282,7 +819,7 @@ int main(int argc, char **argv) {
     // create tx threads (one per TX queue)
     pthread_t txs[N_QUEUES];
     for (int q = 0; q < N_QUEUES; q++) {
-        if (pthread_create(&txs[q], NULL, tx_thread, (void *)(uintptr_t)q) != 0) {
+        if (pthread_create(&txs[q], NULL, tx_fn, (void *)(uintptr_t)q) != 0) {
             perror("pthread_create(tx)");
             return 1;
         }
@@ -301,14 +838,29 @@ int main(int argc, char **argv) {
 
     // final stats
     printf("Final stats:\n");
+    struct lat_hist *all_hw = calloc(2, sizeof(*all_hw)), *all_sw = all_hw + 1;
     for (int q = 0; q < N_QUEUES; q++) {
         uint64_t rx = stats[q].rx_pkts;
         uint64_t tx = stats[q].tx_pkts;
         uint64_t drop = stats[q].dropped;
-        uint64_t hw_lat_avg = (tx ? stats[q].hw_latency_sum_ns / tx : 0);
-        uint64_t sw_lat_avg = (tx ? stats[q].sw_latency_sum_ns / tx : 0);
-        printf("Q%02d: rx=%" PRIu64 " tx=%" PRIu64 " drop=%" PRIu64 " hw_lat_avg=%" PRIu64 "ns sw_lat_avg=%" PRIu64 "ns\n",
-               q, rx, tx, drop, hw_lat_avg, sw_lat_avg);
+        printf("Q%02d: rx=%" PRIu64 " tx=%" PRIu64 " drop=%" PRIu64 " hw_lat_avg=%" PRIu64 "ns sw_lat_avg=%" PRIu64
+               "ns sw_p99=%" PRIu64 "ns\n",
+               q, rx, tx, drop, lat_hist_mean(&hw_lat[q]), lat_hist_mean(&sw_lat[q]),
+               lat_hist_percentile(&sw_lat[q], 99.0));
+        if (all_hw) { lat_hist_merge(all_hw, &hw_lat[q]); lat_hist_merge(all_sw, &sw_lat[q]); }
+    }
+    if (all_hw) {
+        printf("Latency (cumulative):\n");
+        print_lat_line("  hw", all_hw);
+        print_lat_line("  sw", all_sw);
+        free(all_hw);
+    }
+
+    if (zero_copy) {
+        // handles still sitting in the rings were never freed; everything else is back
+        printf("Packet pool: %u/%d free at exit, %" PRIu64 " allocation misses\n",
+               pool_free.top, POOL_SIZE, pool_empty_total);
+        munmap(pkt_pool, pkt_pool_bytes);
     }
 
     printf("Bye\n");
@@ -1,4 +1,8 @@
 // test_scaleup.c – DPDK Scale-Up / Scale-Out Telemetry Tool
+// Busy% is the RX lcores' poll-loop busy ratio read from the poll_stats
+// memzone (poll_stats_shm.h); run as --proc-type=secondary next to the RX app.
+// --headless skips ncurses and serves the rows on the DPDK telemetry socket
+// (/scalemate/ports, scalemate_export.h); --interval-ms sets the refresh.
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
@@ -12,11 +16,16 @@
 #include <rte_eal.h>
 #include <rte_ethdev.h>
 
+#include "buf_util.h"
+#include "poll_stats_shm.h"
+#include "scalemate_export.h"
+
 // --------------------- CONFIG ------------------------
 #define LINK_CAPACITY_GBPS 100.0
 #define T_WARN_DEFAULT 0.60
 #define T_CRIT_DEFAULT 0.85
 #define REFRESH_MS 1000
+#define MIN_REFRESH_MS 100
 
 // Custom ncurses color IDs (avoid COLOR_CYAN conflict)
 #define CLR_RED     1
@@ -26,6 +35,8 @@
 
 // CLI options
 bool opt_verbose = false;
+bool opt_headless = false;
+unsigned opt_refresh_ms = REFRESH_MS;
 
 // ---------------- SATURATION FUNCTIONS -----------------
 double compute_SI(double util, double T_WARN, double T_CRIT) {
@@ -38,8 +49,9 @@ double compute_SI(double util, double T_WARN, double T_CRIT) {
     return (tmp > 1.0) ? 1.0 : tmp;
 }
 
-double compute_CS(double bw_si, double cpu_si, double buf_si) {
-    return (bw_si * 0.5 + cpu_si * 0.3 + buf_si * 0.2) * 100.0;
+// busy_si: saturation of the RX lcores' poll-loop busy ratio
+double compute_CS(double bw_si, double busy_si, double buf_si) {
+    return (bw_si * 0.5 + busy_si * 0.3 + buf_si * 0.2) * 100.0;
 }
 
 const char* decide_scale(double CS) {
@@ -48,42 +60,31 @@ const char* decide_scale(double CS) {
     return "Scale-Out";
 }
 
-// ---------------- CPU UTIL FUNCTION --------------------
-double get_cpu_util() {
-    static long prev_total = 0, prev_idle = 0;
-
-    FILE* fp = fopen("/proc/stat", "r");
-    if (!fp) return 0.5;
-
-    char buf[256];
-    fgets(buf, sizeof(buf), fp);
-    fclose(fp);
-
-    long user, nicev, systemv, idle, iowait, irq, softirq, steal;
-    sscanf(buf, "cpu  %ld %ld %ld %ld %ld %ld %ld %ld",
-           &user,&nicev,&systemv,&idle,&iowait,&irq,&softirq,&steal);
-
-    long idle_all = idle + iowait;
-    long non_idle = user + nicev + systemv + irq + softirq + steal;
-    long total = idle_all + non_idle;
-
-    long diff_total = total - prev_total;
-    long diff_idle  = idle_all - prev_idle;
-
-    prev_total = total;
-    prev_idle  = idle_all;
-
-    if (diff_total == 0) return 0.5;
+// ---------------- POLL-LOOP BUSY ----------------------
+static struct poll_stats_shm *poll_shm = NULL;
+static struct poll_stats poll_cur[RTE_MAX_LCORE];
+static struct poll_stats poll_prev[RTE_MAX_LCORE];
+
+// Take one busy-cycle sample for all ports; false if no RX app publishes one.
+bool sample_busy(void) {
+    if (!poll_shm) poll_shm = poll_stats_shm_lookup();
+    if (!poll_shm) return false;
+    memcpy(poll_prev, poll_cur, sizeof(poll_cur));
+    poll_stats_shm_sample(poll_shm, poll_cur);
+    return true;
+}
 
-    double util = 1.0 - ((double)diff_idle / diff_total);
-    if (util < 0) util = 0;
-    if (util > 1) util = 1;
-    return util;
+// Busy ratio (0..1) of the lcores polling this port, -1 if none do.
+double get_busy_util(uint16_t port) {
+    if (!poll_shm) return -1.0;
+    return poll_stats_shm_port_busy(poll_shm, poll_cur, poll_prev, port);
 }
 
-// Dummy for now (replace with mempool stats later)
-double get_buffer_util() {
-    return 0.30; 
+// Buffer pressure (0..1): fullest of the RX mempool, RX and TX descriptor rings
+double get_buffer_util(uint16_t port) {
+    struct buf_util bu;
+    buf_util_port(port, &bu);
+    return buf_util_max(&bu);
 }
 
 // ---------------- DASHBOARD ----------------------------
@@ -101,18 +102,18 @@ void init_dashboard() {
 }
 
 void print_header(uint16_t nb_ports, double T_WARN, double T_CRIT) {
-    mvprintw(0,0,"DPDK Scale-Up/Scale-Out Monitor   Ports=%u  Refresh=%dms",
-             nb_ports, REFRESH_MS);
+    mvprintw(0,0,"DPDK Scale-Up/Scale-Out Monitor   Ports=%u  Refresh=%ums",
+             nb_ports, opt_refresh_ms);
     mvprintw(1,0,"Thresholds:  WARN=%.2f   CRIT=%.2f\n", T_WARN, T_CRIT);
 
     mvprintw(3,0,"+------+-------+-------+-------+-------+-----+------------------+");
-    mvprintw(4,0,"|Port | BW%   | CPU%  | Buf%  |  SI   | CS  | Decision         |");
+    mvprintw(4,0,"|Port | BW%   | Busy% | Buf%  |  SI   | CS  | Decision         |");
     mvprintw(5,0,"+------+-------+-------+-------+-------+-----+------------------+");
 }
 
 void print_port_row(
         int row, int port,
-        double bw, double cpu, double buf,
+        double bw, double busy, double buf,
         double SI, double CS,
         const char* decision)
 {
@@ -123,7 +124,7 @@ void print_port_row(
     attron(COLOR_PAIR(color));
     mvprintw(row, 0,
         "| %3d | %5.1f | %5.1f | %5.1f | %.3f | %3.0f | %-16s |",
-        port, bw*100, cpu*100, buf*100, SI, CS, decision);
+        port, bw*100, busy*100, buf*100, SI, CS, decision);
     attroff(COLOR_PAIR(color));
 }
 
@@ -131,9 +132,20 @@ void print_port_row(
 int main(int argc, char** argv)
 {
     // CLI parse (minimal)
-    for (int i=1; i<argc; i++)
+    for (int i=1; i<argc; i++) {
         if (strcmp(argv[i], "--verbose") == 0)
             opt_verbose = true;
+        if (strcmp(argv[i], "--headless") == 0)
+            opt_headless = true;
+        if (strcmp(argv[i], "--interval-ms") == 0 && i+1 < argc) {
+            int n = atoi(argv[++i]);
+            if (n < MIN_REFRESH_MS) {
+                fprintf(stderr, "--interval-ms must be >= %d\n", MIN_REFRESH_MS);
+                return 1;
+            }
+            opt_refresh_ms = (unsigned)n;
+        }
+    }
 
     int ret = rte_eal_init(argc, argv);
     if (ret < 0)
@@ -146,39 +158,72 @@ int main(int argc, char** argv)
     double T_WARN = T_WARN_DEFAULT;
     double T_CRIT = T_CRIT_DEFAULT;
 
-    init_dashboard();
+    if (sm_export_init("test_scaleup") != 0 && opt_headless)
+        rte_exit(EXIT_FAILURE, "ERROR: telemetry command registration failed\n");
+
+    static struct sm_port_metrics metrics[RTE_MAX_ETHPORTS];
+
+    if (opt_headless)
+        printf("Headless: ports=%u refresh=%ums, query /scalemate/ports on the DPDK telemetry socket\n",
+               nb_ports, opt_refresh_ms);
+    else
+        init_dashboard();
 
     while (1) {
-        print_header(nb_ports, T_WARN, T_CRIT);
+        if (!opt_headless)
+            print_header(nb_ports, T_WARN, T_CRIT);
         int row = 6;
+        sample_busy();
 
         for (uint16_t port = 0; port < nb_ports; port++) {
+            struct sm_port_metrics *m = &metrics[port];
+            memset(m, 0, sizeof(*m));
+            m->port = port;
+            m->busy = m->score = -1.0;
+            m->skew = 1.0;
+
             struct rte_eth_stats st;
-            if (rte_eth_stats_get(port, &st) != 0)
+            if (rte_eth_stats_get(port, &st) != 0) {
+                snprintf(m->decision, sizeof(m->decision), "error");
                 continue;
+            }
 
             double bw_util =
                 ((double)(st.ipackets + st.opackets) / (LINK_CAPACITY_GBPS * 1e6));
             if (bw_util > 1.0) bw_util = 1.0;
 
-            double cpu_util = get_cpu_util();
-            double buf_util = get_buffer_util();
+            double busy = get_busy_util(port);
+            double busy_util = (busy < 0) ? 0.0 : busy;
+            double buf_util = get_buffer_util(port);
 
-            double SI_bw  = compute_SI(bw_util, T_WARN, T_CRIT);
-            double SI_cpu = compute_SI(cpu_util, T_WARN, T_CRIT);
-            double SI_buf = compute_SI(buf_util, T_WARN, T_CRIT);
+            double SI_bw   = compute_SI(bw_util, T_WARN, T_CRIT);
+            double SI_busy = compute_SI(busy_util, T_WARN, T_CRIT);
+            double SI_buf  = compute_SI(buf_util, T_WARN, T_CRIT);
 
-            double CS = compute_CS(SI_bw, SI_cpu, SI_buf);
+            double CS = compute_CS(SI_bw, SI_busy, SI_buf);
             const char* decision = decide_scale(CS);
 
-            print_port_row(row++, port, bw_util, cpu_util, buf_util,
-                           SI_bw, CS, decision);
+            m->valid = 1;
+            m->rx_util = bw_util;
+            m->busy = busy;
+            m->buf_fill = buf_util;
+            m->score = CS / 100.0;
+            snprintf(m->decision, sizeof(m->decision), "%s", decision);
+            snprintf(m->reason, sizeof(m->reason), "SI_bw=%.3f SI_busy=%.3f SI_buf=%.3f",
+                     SI_bw, SI_busy, SI_buf);
+
+            if (!opt_headless)
+                print_port_row(row++, port, bw_util, busy_util, buf_util,
+                               SI_bw, CS, decision);
         }
 
-        refresh();
-        usleep(REFRESH_MS * 1000);
+        sm_export_publish(metrics, nb_ports);
+        if (!opt_headless)
+            refresh();
+        usleep(opt_refresh_ms * 1000);
     }
 
-    endwin();
+    if (!opt_headless)
+        endwin();
     return 0;
 }